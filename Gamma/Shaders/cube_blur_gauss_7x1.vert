@@ -0,0 +1,8 @@
+#version 330 core
+
+layout (location = 0) in vec3 posAttrib;
+
+// Unit cube at the origin, already in world space
+void main() {
+	gl_Position = vec4(posAttrib, 1.0);
+}
\ No newline at end of file
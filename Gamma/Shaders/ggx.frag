@@ -5,17 +5,18 @@
 #include "shadow_funcs.glh"
 
 $MAX_LIGHTS
+#include "uniform_blocks.glh"
 
 out vec4 FragColor;
 in vec2 TexCoords;
 in vec3 WorldPos;
 in vec3 Normal;
 
-// Mesh's global material
-uniform vec3 Kd;
-uniform float metallic;
-uniform float shininess;
-uniform uint texMask;
+// Mesh's material, from the draw data (ggx.vert)
+flat in vec3 Kd;
+flat in float metallic;
+flat in float shininess;
+flat in uint texMask;
 
 // Texture units 0-3
 uniform sampler2D albedoMap;
@@ -28,16 +29,11 @@ uniform samplerCube irradianceMap;
 uniform samplerCube radianceMap;
 uniform sampler2D brdfLUT;
 
-// Lights
-uniform vec4 lightVectors[MAX_LIGHTS]; // position or direction
-uniform vec3 emissions[MAX_LIGHTS];
-uniform mat4 lightTransforms[MAX_LIGHTS];
+// Lights, vectors and emissions in LightData
 uniform sampler2D shadowMaps[MAX_LIGHTS]; // units 8->
 uniform samplerCube shadowCubeMaps[MAX_LIGHTS]; // units 8 + MAX_LIGHTS ->
-uniform uint nLights;
 
 // Other parameters
-uniform vec3 cameraPos;
 uniform bool useVSM;
 uniform float svmBleedFix;
 
@@ -62,7 +58,7 @@ void main() {
 		float shadow = 0.0;
 		if (lightVec.w == 0.0) {
 			L = -1.0 * normalize(vec3(lightVec));
-			radiance = emissions[i];
+			radiance = emissions[i].rgb;
 			vec4 posLightSpace = lightTransforms[i] * vec4(WorldPos, 1.0);
 			shadow = (useVSM) ? checkShadowDepthDirVSM(shadowMaps[i], posLightSpace, svmBleedFix)
 							  : checkShadowDepthDir(shadowMaps[i], posLightSpace, dot(N, L));
@@ -71,7 +67,7 @@ void main() {
 			vec3 lightPos = vec3(lightVec);
 			vec3 toLight = lightPos - WorldPos;
 			float dist = length(toLight);
-			radiance = emissions[i] / (dist * dist);
+			radiance = emissions[i].rgb / (dist * dist);
 			L = normalize(toLight);
 			shadow = (useVSM) ? checkShadowDepthPointVSM(shadowCubeMaps[i], -toLight, svmBleedFix)
 							  : checkShadowDepthPoint(shadowCubeMaps[i], -toLight, N);
@@ -1,5 +1,9 @@
 #version 330
 
+#include "vertex_decode.glh"
+#include "uniform_blocks.glh"
+#include "draw_data.glh"
+
 layout(location = 0) in vec3 posAttrib;
 layout(location = 1) in vec3 normAttrib;
 layout(location = 2) in vec2 texAttrib;
@@ -7,16 +11,24 @@ layout(location = 2) in vec2 texAttrib;
 out vec2 TexCoords;
 out vec3 WorldPos;
 out vec3 Normal;
-                
-uniform mat4 P;
-uniform mat4 V;
-uniform mat4 M;
-uniform mat4 M_it; // inverse transpose
 
+// Mesh's material, constant over the draw
+flat out vec3 Kd;
+flat out float metallic;
+flat out float shininess;
+flat out uint texMask;
+                
 void main() {
 	TexCoords = texAttrib;
-	WorldPos = vec3(M * vec4(posAttrib, 1.0));
-	Normal = vec3(M_it * vec4(normAttrib, 0.0));
+	WorldPos = vec3(drawModel() * vec4(decodePosition(posAttrib), 1.0));
+	Normal = vec3(drawModelInverseTranspose() * vec4(decodeNormal(normAttrib), 0.0));
+
+	vec4 material = drawMaterial();
+	vec2 params = drawMaterialParams();
+	Kd = material.rgb;
+	metallic = material.a;
+	shininess = params.x;
+	texMask = uint(params.y);
 					
 	gl_Position = P * V * vec4(WorldPos, 1.0);
 }
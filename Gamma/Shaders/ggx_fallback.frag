@@ -0,0 +1,42 @@
+#version 330
+
+#include "common.glh"
+
+$MAX_LIGHTS
+#include "uniform_blocks.glh"
+
+// Diffuse-only stand-in for ggx.frag while it compiles
+
+out vec4 FragColor;
+in vec2 TexCoords;
+in vec3 WorldPos;
+in vec3 Normal;
+
+flat in vec3 Kd;
+flat in uint texMask;
+uniform sampler2D albedoMap;
+uniform samplerCube irradianceMap;
+
+void main() {
+	vec3 albedo = Kd;
+	if ((texMask & DIFFUSE_MASK) != 0U)
+		albedo = pow(texture(albedoMap, TexCoords).rgb, vec3(2.2));
+	vec3 N = normalize(Normal);
+
+	vec3 Lo = vec3(0.0);
+	for (uint i = 0U; i < nLights; i++) {
+		vec4 lightVec = lightVectors[i];
+		vec3 L = -1.0 * normalize(vec3(lightVec));
+		vec3 radiance = emissions[i].rgb;
+		if (lightVec.w != 0.0) {
+			vec3 toLight = vec3(lightVec) - WorldPos;
+			float dist = length(toLight);
+			radiance = emissions[i].rgb / (dist * dist);
+			L = normalize(toLight);
+		}
+		Lo += albedo / PI * radiance * max(dot(N, L), 0.0);
+	}
+
+	Lo += texture(irradianceMap, N).rgb * albedo;
+	FragColor = vec4(Lo, 1.0);
+}
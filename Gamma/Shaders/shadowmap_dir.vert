@@ -1,9 +1,11 @@
 #version 330
 
+#include "vertex_decode.glh"
+#include "uniform_blocks.glh"
+#include "draw_data.glh"
+
 layout(location = 0) in vec3 posAttrib;
-uniform mat4 lightSpaceMatrix;
-uniform mat4 M;
 
 void main() {
-	gl_Position = lightSpaceMatrix * M * vec4(posAttrib, 1.0);
+	gl_Position = lightSpaceMatrix * drawModel() * vec4(decodePosition(posAttrib), 1.0);
 }
\ No newline at end of file
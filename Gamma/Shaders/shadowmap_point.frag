@@ -3,8 +3,8 @@
 in vec4 FragPos;
 out vec4 FragColor;
 
-uniform vec3 lightPos;
-uniform float farPlane;
+#include "uniform_blocks.glh"
+
 uniform bool useVSM;
 
 // Handles both normal and VSM shadows based on uniform toggle
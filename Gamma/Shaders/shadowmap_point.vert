@@ -1,8 +1,10 @@
 #version 330 core
-layout (location = 0) in vec3 posAttrib;
 
-uniform mat4 M;
+#include "vertex_decode.glh"
+#include "draw_data.glh"
+
+layout (location = 0) in vec3 posAttrib;
 
 void main() {
-	gl_Position = M * vec4(posAttrib, 1.0);
+	gl_Position = drawModel() * vec4(decodePosition(posAttrib), 1.0);
 }
\ No newline at end of file
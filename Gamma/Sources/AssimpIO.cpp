@@ -0,0 +1,49 @@
+#include "AssimpIO.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+// Whole items only, like fread
+size_t VFSIOStream::Read(void *pvBuffer, size_t pSize, size_t pCount) {
+    if (pSize == 0)
+        return 0;
+
+    const size_t count = std::min(pCount, (buffer.size - pos) / pSize);
+    std::memcpy(pvBuffer, buffer.data + pos, count * pSize);
+    pos += count * pSize;
+    return count;
+}
+
+// Offsets relative to the current position or the end may be negative (wrapped around)
+aiReturn VFSIOStream::Seek(size_t pOffset, aiOrigin pOrigin) {
+    size_t target;
+    if (pOrigin == aiOrigin_SET)
+        target = pOffset;
+    else if (pOrigin == aiOrigin_CUR)
+        target = pos + pOffset;
+    else
+        target = buffer.size + pOffset;
+
+    if (target > buffer.size)
+        return aiReturn_FAILURE;
+
+    pos = target;
+    return aiReturn_SUCCESS;
+}
+
+bool VFSIOSystem::Exists(const char *pFile) const {
+    return VFS::instance().exists(pFile);
+}
+
+// Write access is not supported, Assimp treats a null stream as failure
+Assimp::IOStream* VFSIOSystem::Open(const char *pFile, const char *pMode) {
+    if (std::strchr(pMode, 'w') || std::strchr(pMode, 'a'))
+        return nullptr;
+
+    try {
+        return new VFSIOStream(VFS::instance().read(pFile));
+    }
+    catch (std::runtime_error&) {
+        return nullptr;
+    }
+}
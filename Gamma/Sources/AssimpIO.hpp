@@ -0,0 +1,34 @@
+#pragma once
+#include <assimp/IOSystem.hpp>
+#include <assimp/IOStream.hpp>
+#include "VirtualFS.hpp"
+
+/*
+    Assimp file access through the VFS, so that models and the files they
+    reference (e.g. .mtl for .obj) can be read from a packed archive.
+    Hand a new instance to Assimp::Importer::SetIOHandler, which owns it.
+*/
+
+class VFSIOStream : public Assimp::IOStream {
+public:
+    VFSIOStream(const FileBuffer &buffer) : buffer(buffer) {}
+
+    size_t Read(void *pvBuffer, size_t pSize, size_t pCount) override;
+    size_t Write(const void*, size_t, size_t) override { return 0; } // read-only
+    aiReturn Seek(size_t pOffset, aiOrigin pOrigin) override;
+    size_t Tell() const override { return pos; }
+    size_t FileSize() const override { return buffer.size; }
+    void Flush() override {}
+
+private:
+    FileBuffer buffer;
+    size_t pos = 0;
+};
+
+class VFSIOSystem : public Assimp::IOSystem {
+public:
+    bool Exists(const char *pFile) const override;
+    char getOsSeparator() const override { return '/'; }
+    Assimp::IOStream* Open(const char *pFile, const char *pMode = "rb") override;
+    void Close(Assimp::IOStream *pFile) override { delete pFile; }
+};
@@ -2,8 +2,18 @@
 #include "GLProgram.hpp"
 #include "imgui.h"
 #include "utils.hpp"
+#include "GLState.hpp"
 #include <cmath>
 
+static const UniformID U_SOURCE_TEXTURE("sourceTexture");
+static const UniformID U_THRESHOLD("threshold");
+static const UniformID U_USE_KARIS_AVG("useKarisAvg");
+static const UniformID U_INV_RES("invRes");
+static const UniformID U_RADIUS("radius");
+static const UniformID U_STRENGTH("strength");
+static const UniformID U_TEX1("tex1");
+static const UniformID U_TEX2("tex2");
+
 BloomPass::BloomPass(int width, int height) {
     resize(width, height);
 }
@@ -58,57 +68,56 @@ void BloomPass::apply(GLuint inputTex, GLuint dstFBO) {
     }
 
     bloomThreshold->use();
-    bloomThreshold->setUniform("sourceTexture", 0);
-    bloomThreshold->setUniform("threshold", threshold);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, inputTex);
+    bloomThreshold->setUniform(U_SOURCE_TEXTURE, 0);
+    bloomThreshold->setUniform(U_THRESHOLD, threshold);
+    GLState &gl = GLState::instance();
+    gl.bindTexture(0, GL_TEXTURE_2D, inputTex);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, FBOS[0]);
-    glViewport(0, 0, this->width, this->height);
+    gl.bindFramebuffer(FBOS[0]);
+    gl.viewport(0, 0, this->width, this->height);
     drawFullscreenQuad();
 
     /* Downsampling pass */
     bloomDownsample->use();
-    bloomDownsample->setUniform("sourceTexture", 0);
+    bloomDownsample->setUniform(U_SOURCE_TEXTURE, 0);
     for (int i = 1; i < mipChainDepth; i++) {
         unsigned int wSrc = width * std::pow(0.5, i - 1);
         unsigned int hSrc = height * std::pow(0.5, i - 1);
         unsigned int wDst = width * std::pow(0.5, i);
         unsigned int hDst = height * std::pow(0.5, i);
-        bloomDownsample->setUniform("useKarisAvg", useAA && (i == 1)); // AA applied on first downsample
-        bloomDownsample->setUniform("invRes", glm::vec2(1.0 / wSrc, 1.0 / hSrc));
-        glBindTexture(GL_TEXTURE_2D, textures[i - 1]); // previous level as input
-        glBindFramebuffer(GL_FRAMEBUFFER, FBOS[i]);
-        glViewport(0, 0, wDst, hDst);
+        bloomDownsample->setUniform(U_USE_KARIS_AVG, useAA && (i == 1)); // AA applied on first downsample
+        bloomDownsample->setUniform(U_INV_RES, glm::vec2(1.0 / wSrc, 1.0 / hSrc));
+        gl.bindTexture(0, GL_TEXTURE_2D, textures[i - 1]); // previous level as input
+        gl.bindFramebuffer(FBOS[i]);
+        gl.viewport(0, 0, wDst, hDst);
         drawFullscreenQuad();
     }
 
     /* Upsampling pass */
     bloomUpsample->use();
-    bloomUpsample->setUniform("sourceTexture", 0);
+    bloomUpsample->setUniform(U_SOURCE_TEXTURE, 0);
     for (int i = mipChainDepth - 2; i >= 0; i--) {
         unsigned int wSrc = width * std::pow(0.5, i + 1);
         unsigned int hSrc = height * std::pow(0.5, i + 1);
         unsigned int wDst = width * std::pow(0.5, i);
         unsigned int hDst = height * std::pow(0.5, i);
-        bloomUpsample->setUniform("invRes", glm::vec2(1.0 / wSrc, 1.0 / hSrc));
-        bloomUpsample->setUniform("radius", radius);
-        bloomUpsample->setUniform("strength", strength);
-        glBindTexture(GL_TEXTURE_2D, textures[i + 1]); // input = layer + 1
-        glBindFramebuffer(GL_FRAMEBUFFER, FBOS[i]);
-        glViewport(0, 0, wDst, hDst);
+        bloomUpsample->setUniform(U_INV_RES, glm::vec2(1.0 / wSrc, 1.0 / hSrc));
+        bloomUpsample->setUniform(U_RADIUS, radius);
+        bloomUpsample->setUniform(U_STRENGTH, strength);
+        gl.bindTexture(0, GL_TEXTURE_2D, textures[i + 1]); // input = layer + 1
+        gl.bindFramebuffer(FBOS[i]);
+        gl.viewport(0, 0, wDst, hDst);
         drawFullscreenQuad();
     }
 
     /* Add blur to input image */
     bloomAdd->use();
-    bloomAdd->setUniform("tex1", 0);
-    bloomAdd->setUniform("tex2", 1);
-    glBindTexture(GL_TEXTURE_2D, inputTex); // unit 0
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, textures[0]);
-    glViewport(0, 0, this->width, this->height);
-    glBindFramebuffer(GL_FRAMEBUFFER, dstFBO);
+    bloomAdd->setUniform(U_TEX1, 0);
+    bloomAdd->setUniform(U_TEX2, 1);
+    gl.bindTexture(0, GL_TEXTURE_2D, inputTex);
+    gl.bindTexture(1, GL_TEXTURE_2D, textures[0]);
+    gl.viewport(0, 0, this->width, this->height);
+    gl.bindFramebuffer(dstFBO);
     drawFullscreenQuad();
     glCheckError();
 }
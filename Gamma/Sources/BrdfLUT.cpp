@@ -0,0 +1,165 @@
+#include "BrdfLUT.hpp"
+#include "GLProgram.hpp"
+#include "KTXFile.hpp"
+#include "utils.hpp"
+#include "VirtualFS.hpp"
+#include <glm/glm.hpp>
+#include <vector>
+#include <cmath>
+
+GLuint BrdfLUT::texture = 0;
+int BrdfLUT::res = 512;
+bool BrdfLUT::useAnalytic = false;
+
+GLuint BrdfLUT::get() {
+    if (texture)
+        return texture;
+
+    if (useAnalytic) {
+        texture = computeAnalytic();
+        return texture;
+    }
+
+    // Shipped table first, then one rendered by an earlier run
+    const std::string shipped = "Gamma/Assets/IBL/brdf_lut_" + std::to_string(res) + ".ktx";
+    texture = load(shipped);
+    if (!texture)
+        texture = load(cachePath());
+    if (texture)
+        return texture;
+
+    try {
+        texture = render();
+    }
+    catch (std::runtime_error &e) {
+        std::cout << "BRDF LUT rendering failed, using analytic fit: " << e.what() << std::endl;
+        texture = computeAnalytic();
+        return texture;
+    }
+
+    writeFileAtomically(cachePath(), "BRDF LUT cache", [](std::ofstream &out) {
+        return writeKTX(out, GL_TEXTURE_2D, texture, GL_RG16F, GL_RG, GL_HALF_FLOAT, 1);
+    });
+
+    return texture;
+}
+
+void BrdfLUT::configure(int resolution, bool analytic) {
+    if (resolution == res && analytic == useAnalytic)
+        return;
+
+    res = resolution;
+    useAnalytic = analytic;
+    release();
+    get();
+}
+
+void BrdfLUT::release() {
+    glDeleteTextures(1, &texture);
+    texture = 0;
+}
+
+std::string BrdfLUT::cachePath() {
+    return "Gamma/Assets/IBL/cached/brdf_lut_" + std::to_string(res) + ".ktx";
+}
+
+// Returns 0 if the file is missing or unusable
+GLuint BrdfLUT::load(const std::string &path) {
+    if (!VFS::instance().exists(path))
+        return 0;
+
+    GLuint tex = 0;
+    try {
+        BufferStream f(VFS::instance().read(path));
+        GLenum target;
+        tex = readKTX(f, target);
+        GLint width;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+        if (target != GL_TEXTURE_2D || width != res)
+            throw std::runtime_error("unexpected layout");
+    }
+    catch (std::runtime_error &e) {
+        std::cout << "Ignoring BRDF LUT " << path << ": " << e.what() << std::endl;
+        glDeleteTextures(1, &tex);
+        return 0;
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return tex;
+}
+
+// Importance sampled integration on the GPU
+GLuint BrdfLUT::render() {
+    GLint viewport[4];
+    GLint prevFBO;
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFBO);
+
+    GLProgram *brdfProg = getProgram("IBL::BrdfLUT", "draw_tex_2d.vert", "ibl_calc_brdf_lut.frag");
+
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, res, res, 0, GL_RG, GL_FLOAT, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    GLuint FBO;
+    glGenFramebuffers(1, &FBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
+    const bool complete = (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+
+    if (complete) {
+        glViewport(0, 0, res, res);
+        brdfProg->use();
+        drawFullscreenQuad();
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, prevFBO);
+    glDeleteFramebuffers(1, &FBO);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glCheckError();
+
+    if (!complete) {
+        glDeleteTextures(1, &tex);
+        throw std::runtime_error("BRDF LUT framebuffer incomplete");
+    }
+
+    return tex;
+}
+
+// Karis' fit of the split-sum integral, evaluated at texel centers
+GLuint BrdfLUT::computeAnalytic() {
+    const glm::vec4 c0(-1.0f, -0.0275f, -0.572f, 0.022f);
+    const glm::vec4 c1(1.0f, 0.0425f, 1.04f, -0.04f);
+
+    std::vector<float> data(2 * res * res);
+    for (int y = 0; y < res; y++) {
+        float roughness = (y + 0.5f) / res;
+        glm::vec4 r = roughness * c0 + c1;
+        for (int x = 0; x < res; x++) {
+            float NdotV = (x + 0.5f) / res;
+            float a004 = glm::min(r.x * r.x, std::exp2(-9.28f * NdotV)) * r.x + r.y;
+            data[2 * (y * res + x) + 0] = -1.04f * a004 + r.z;
+            data[2 * (y * res + x) + 1] = 1.04f * a004 + r.w;
+        }
+    }
+
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, res, res, 0, GL_RG, GL_FLOAT, data.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glCheckError();
+
+    return tex;
+}
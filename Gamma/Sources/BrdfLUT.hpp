@@ -0,0 +1,38 @@
+#pragma once
+#include <glad/glad.h>
+#include <string>
+
+/*
+    Split-sum BRDF lookup table (scale, bias) indexed by (N.V, roughness).
+
+    The table does not depend on the environment, so a single texture is
+    shared by every IBLMaps instance. It is loaded from a shipped or cached
+    KTX file when available, otherwise rendered once and cached. The
+    analytic fit (Karis, "Physically Based Shading on Mobile") is used on
+    request, or when the table cannot be rendered.
+*/
+
+class BrdfLUT {
+public:
+    // Texture handle, created on first use. Creating it binds programs, textures and
+    // framebuffers directly, so it must not happen inside a render pass.
+    static GLuint get();
+
+    // Change resolution or source, the texture is rebuilt right away
+    static void configure(int resolution, bool analytic);
+    static int resolution() { return res; }
+    static bool analytic() { return useAnalytic; }
+
+    // Free texture before the context is destroyed
+    static void release();
+
+private:
+    static GLuint load(const std::string &path);
+    static GLuint render();
+    static GLuint computeAnalytic();
+    static std::string cachePath();
+
+    static GLuint texture;
+    static int res;
+    static bool useAnalytic;
+};
@@ -1,6 +1,295 @@
 #include "GLProgram.hpp"
+#include "GLState.hpp"
+#include "ShaderSource.hpp"
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 
 std::map<string, GLProgram*> GLProgram::s_programs; // static
+std::vector<std::pair<string, GLProgram*>> GLProgram::s_pending; // static
+std::map<string, ShaderFiles> GLProgram::s_failed; // static
+bool GLProgram::asyncCompile = true; // static
+
+// GL_KHR_parallel_shader_compile, same value in the ARB version
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// Linked program binaries are specific to the driver: they are read from
+// the disk directly and left out of packed archives (see packAssets)
+static const char *PROGRAM_BINARY_DIR = "Gamma/Assets/cached/";
+static const char PROGRAM_BINARY_MAGIC[4] = { 'G', 'P', 'R', 'B' };
+
+// Programs built from files in earlier runs, rebuilt by warmUp()
+static const char *PROGRAM_MANIFEST_PATH = "Gamma/Assets/cached/programs.txt";
+static const char *PROGRAM_MANIFEST_HEADER = "gamma-programs 2";
+static std::map<string, ShaderFiles> programManifest;
+static bool programManifestLoaded = false;
+static bool programManifestChanged = false;
+
+// GL_ARB_get_program_binary with at least one binary format
+static bool binaryCacheSupported()
+{
+	static int supported = -1;
+	if (supported < 0) {
+		GLint numFormats = 0;
+		if (glSupports(4, 1, "GL_ARB_get_program_binary"))
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+		supported = (numFormats > 0) ? 1 : 0;
+	}
+	return supported == 1;
+}
+
+// Binaries are only valid for the same sources on the same driver
+static size_t programKey(const string& vertexSource, const string& geometrySource, const string& fragmentSource)
+{
+	static size_t driver = 0;
+	if (!driver) {
+		string id;
+		for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+			const GLubyte *str = glGetString(name);
+			id.append(str ? (const char*)str : "").append("\n");
+		}
+		driver = computeHash(id.data(), id.size());
+	}
+
+	size_t parts[4] = { driver,
+						computeHash(vertexSource.data(), vertexSource.size()),
+						computeHash(geometrySource.data(), geometrySource.size()),
+						computeHash(fragmentSource.data(), fragmentSource.size()) };
+	return computeHash(parts, sizeof(parts));
+}
+
+static string programBinaryPath(size_t key)
+{
+	return PROGRAM_BINARY_DIR + std::to_string(key) + ".glbin";
+}
+
+// Format: magic, key, binary format, length, binary. Returns 0 if missing or rejected by the driver.
+static GLuint loadProgramBinary(size_t key)
+{
+	std::ifstream in(programBinaryPath(key), std::ios::binary);
+	if (!in.good())
+		return 0;
+
+	char magic[4];
+	uint64_t storedKey = 0;
+	uint32_t format = 0, length = 0;
+	in.read(magic, 4);
+	in.read((char*)&storedKey, sizeof(storedKey));
+	in.read((char*)&format, sizeof(format));
+	in.read((char*)&length, sizeof(length));
+	if (!in.good() || std::memcmp(magic, PROGRAM_BINARY_MAGIC, 4) != 0 || storedKey != (uint64_t)key)
+		return 0;
+
+	std::vector<char> binary(length);
+	in.read(binary.data(), length);
+	if (!in.good())
+		return 0;
+
+	// The driver may have changed formats, only offer binaries it lists
+	GLint numFormats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+	std::vector<GLint> formats(numFormats);
+	glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, formats.data());
+	if (std::find(formats.begin(), formats.end(), (GLint)format) == formats.end())
+		return 0;
+
+	GLuint prog = glCreateProgram();
+	glProgramBinary(prog, (GLenum)format, binary.data(), (GLsizei)length);
+	GLint status = 0;
+	glGetProgramiv(prog, GL_LINK_STATUS, &status);
+	if (!status) {
+		glDeleteProgram(prog);
+		return 0;
+	}
+
+	return prog;
+}
+
+static void saveProgramBinary(size_t key, GLuint prog)
+{
+	GLint length = 0;
+	glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(prog, length, &length, &format, binary.data());
+
+	writeFileAtomically(programBinaryPath(key), "program binary", [&](std::ofstream &out) {
+		uint64_t storedKey = key;
+		uint32_t storedFormat = format, storedLength = (uint32_t)length;
+		out.write(PROGRAM_BINARY_MAGIC, 4);
+		out.write((const char*)&storedKey, sizeof(storedKey));
+		out.write((const char*)&storedFormat, sizeof(storedFormat));
+		out.write((const char*)&storedLength, sizeof(storedLength));
+		out.write(binary.data(), length);
+		return true;
+	});
+}
+
+static bool sameFiles(const ShaderFiles &a, const ShaderFiles &b)
+{
+	return std::equal(a.stages, a.stages + 3, b.stages) && a.replacements == b.replacements;
+}
+
+// Backslash escapes, so that replacement values may hold tabs and newlines
+static string escapeField(const string &field)
+{
+	string out;
+	for (char c : field) {
+		if (c == '\\')
+			out += "\\\\";
+		else if (c == '\t')
+			out += "\\t";
+		else if (c == '\n')
+			out += "\\n";
+		else if (c == '\r')
+			out += "\\r";
+		else
+			out += c;
+	}
+	return out;
+}
+
+static string unescapeField(const string &field)
+{
+	string out;
+	for (size_t i = 0; i < field.size(); i++) {
+		if (field[i] != '\\' || i + 1 == field.size()) {
+			out += field[i];
+			continue;
+		}
+
+		const char c = field[++i];
+		out += (c == 't') ? '\t' : (c == 'n') ? '\n' : (c == 'r') ? '\r' : c;
+	}
+	return out;
+}
+
+// A header line, then one line per program: tag, three stage files, then replacement key/value
+// pairs, all escaped and tab separated. Files without the header are from older versions and ignored.
+static void loadProgramManifest()
+{
+	programManifestLoaded = true;
+	std::ifstream in(PROGRAM_MANIFEST_PATH);
+	string line;
+	if (!std::getline(in, line) || line != PROGRAM_MANIFEST_HEADER)
+		return;
+
+	while (std::getline(in, line)) {
+		std::vector<string> fields;
+		std::istringstream ss(line);
+		string field;
+		while (std::getline(ss, field, '\t')) {
+			fields.push_back(unescapeField(field));
+		}
+		if (fields.size() < 4 || fields.size() % 2 != 0)
+			continue;
+
+		ShaderFiles &files = programManifest[fields[0]];
+		files = ShaderFiles();
+		std::copy(fields.begin() + 1, fields.begin() + 4, files.stages);
+		for (size_t i = 4; i < fields.size(); i += 2) {
+			files.replacements[fields[i]] = fields[i + 1];
+		}
+	}
+}
+
+static void writeManifestLine(std::ostream &out, const string &tag, const ShaderFiles &files)
+{
+	out << escapeField(tag);
+	for (const string &stage : files.stages) {
+		out << "\t" << escapeField(stage);
+	}
+	for (auto &p : files.replacements) {
+		out << "\t" << escapeField(p.first) << "\t" << escapeField(p.second);
+	}
+	out << "\n";
+}
+
+// Remember how a program was built, written by saveManifest()
+static void recordProgram(const string &tag, const ShaderFiles &files)
+{
+	if (!programManifestLoaded)
+		loadProgramManifest();
+
+	auto known = programManifest.find(tag);
+	if (known != programManifest.end() && sameFiles(known->second, files))
+		return;
+
+	programManifest[tag] = files;
+	programManifestChanged = true;
+}
+
+// Expanded sources of the stages, and every file they were read from
+static void preprocess(const ShaderFiles &files, string sources[3], std::set<string> &sourceFiles)
+{
+	for (int i = 0; i < 3; i++) {
+		if (files.stages[i] != "")
+			sources[i] = ShaderSource::read("Gamma/Shaders/" + files.stages[i], files.replacements, &sourceFiles);
+	}
+}
+
+// Runs compile jobs one at a time with a second context current
+class CompileThread {
+public:
+	CompileThread(std::function<void()> makeCurrent) {
+		thread = std::thread([this, makeCurrent]() {
+			makeCurrent();
+			while (true) {
+				std::packaged_task<void()> task;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					condition.wait(lock, [this]() { return stop || !tasks.empty(); });
+					if (stop)
+						return;
+					task = std::move(tasks.front());
+					tasks.pop_front();
+				}
+				task();
+			}
+		});
+	}
+
+	// Jobs not yet started are dropped
+	~CompileThread() {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			stop = true;
+		}
+		condition.notify_one();
+		thread.join();
+	}
+
+	std::future<void> enqueue(std::function<void()> job) {
+		std::packaged_task<void()> task(job);
+		std::future<void> result = task.get_future();
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			tasks.push_back(std::move(task));
+		}
+		condition.notify_one();
+		return result;
+	}
+
+private:
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::deque<std::packaged_task<void()>> tasks;
+	bool stop = false;
+};
+
+static std::unique_ptr<CompileThread> compileThread;
 
 GLProgram::GLProgram(const string& vertexSource, const string& fragmentSource)
 {
@@ -20,7 +309,7 @@ GLProgram::~GLProgram(void)
 	glDeleteShader(m_glVertexShader);
 	glDeleteShader(m_glGeometryShader);
 	glDeleteShader(m_glFragmentShader);
-    glDeleteVertexArrays(vaos.size(), vaos.data());
+	glDeleteVertexArrays(vaos.size(), vaos.data());
 }
 
 
@@ -35,24 +324,132 @@ GLint GLProgram::getUniformLoc(const string& name) const
 	return glGetUniformLocation(m_glProgram, name.c_str());
 }
 
+// Names by ID, function statics so that IDs can be created during static initialization
+static std::map<string, unsigned int>& uniformIDs()
+{
+	static std::map<string, unsigned int> ids;
+	return ids;
+}
+
+static std::vector<string>& uniformNames()
+{
+	static std::vector<string> names;
+	return names;
+}
+
+UniformID::UniformID(const char *name) : index(GLProgram::uniformID(name)) {}
+
+// Static
+unsigned int GLProgram::uniformID(const string &name)
+{
+	auto found = uniformIDs().find(name);
+	if (found != uniformIDs().end())
+		return found->second;
+
+	const unsigned int id = (unsigned int)uniformNames().size();
+	uniformNames().push_back(name);
+	uniformIDs()[name] = id;
+	return id;
+}
+
+// Static
+std::vector<UniformID> GLProgram::uniformArray(const string &name, size_t count)
+{
+	std::vector<UniformID> ids;
+	for (size_t i = 0; i < count; i++) {
+		ids.push_back(UniformID((name + "[" + std::to_string(i) + "]").c_str()));
+	}
+	return ids;
+}
+
+static std::vector<std::pair<string, unsigned int>>& uniformBlockBindings()
+{
+	static std::vector<std::pair<string, unsigned int>> bindings;
+	return bindings;
+}
+
+// Static
+void GLProgram::bindUniformBlock(const string &block, unsigned int binding)
+{
+	uniformBlockBindings().push_back(std::make_pair(block, binding));
+}
+
+// Every active uniform by name, arrays by each element and by their bare name
+void GLProgram::reflectUniforms(void)
+{
+	m_reflected = true;
+	GLint count = 0, maxLength = 0;
+	glGetProgramiv(m_glProgram, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(m_glProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	std::vector<char> buffer(maxLength + 1, '\0');
+
+	for (GLint i = 0; i < count; i++) {
+		GLsizei length = 0;
+		GLint size = 0;
+		GLenum type = 0;
+		glGetActiveUniform(m_glProgram, (GLuint)i, (GLsizei)buffer.size(), &length, &size, &type, buffer.data());
+		string name(buffer.data(), length);
+
+		const bool isArray = endsWith(name, "[0]");
+		if (!isArray) {
+			m_activeUniforms[name] = glGetUniformLocation(m_glProgram, name.c_str());
+			continue;
+		}
+
+		name.resize(name.size() - 3);
+		for (GLint e = 0; e < size; e++) {
+			const string element = name + "[" + std::to_string(e) + "]";
+			m_activeUniforms[element] = glGetUniformLocation(m_glProgram, element.c_str());
+		}
+		m_activeUniforms[name] = m_activeUniforms[name + "[0]"];
+	}
+	glCheckError();
+}
+
+GLint GLProgram::uniformLoc(UniformID id)
+{
+	// -2: not looked up yet
+	if (id.index < m_uniformLocs.size() && m_uniformLocs[id.index] != -2)
+		return m_uniformLocs[id.index];
+
+	if (!m_reflected)
+		reflectUniforms();
+	if (id.index >= m_uniformLocs.size())
+		m_uniformLocs.resize(uniformNames().size(), -2);
+
+	auto active = m_activeUniforms.find(uniformNames()[id.index]);
+	m_uniformLocs[id.index] = (active == m_activeUniforms.end()) ? -1 : active->second;
+	if (m_uniformLocs[id.index] == -1 && reportUniformErrors)
+		std::cout << "Uniform name error: " << uniformNames()[id.index] << std::endl;
+	return m_uniformLocs[id.index];
+}
+
 
 void GLProgram::use(void)
 {
-	glUseProgram(m_glProgram);
+	GLState::instance().useProgram(m_glProgram);
+
+	// Blocks registered since the last use, unused ones are skipped
+	const auto &bindings = uniformBlockBindings();
+	for (; m_blocksBound < bindings.size(); m_blocksBound++) {
+		GLuint index = glGetUniformBlockIndex(m_glProgram, bindings[m_blocksBound].first.c_str());
+		if (index != GL_INVALID_INDEX)
+			glUniformBlockBinding(m_glProgram, index, bindings[m_blocksBound].second);
+	}
 }
 
 // Insert VAO handles into vector
 void GLProgram::addVAOs(GLuint * arr, int num)
 {
-    for (int i = 0; i < num; i++)
-    {
-        vaos.push_back(arr[i]);
-    }
+	for (int i = 0; i < num; i++)
+	{
+		vaos.push_back(arr[i]);
+	}
 }
 
 void GLProgram::bindVAO(int ind)
 {
-    glBindVertexArray(vaos[ind]);
+	glBindVertexArray(vaos[ind]);
 }
 
 // Static
@@ -74,99 +471,363 @@ void GLProgram::set(const string &name, GLProgram* prog)
 	if (old)
 		delete old;	
 
-	if (prog)
+	if (prog) {
 		s_programs[name] = prog;
+		if (!prog->m_files.stages[0].empty())
+			recordProgram(name, prog->m_files);
+	}
 }
 
 // Static
 void GLProgram::clearCache()
 {
-    s_programs.clear();
+	// Wait for the compile thread, it may be using pending programs
+	finishPending(true);
+	for (auto &entry : s_programs) {
+		delete entry.second;
+	}
+	s_programs.clear();
+	s_failed.clear();
 }
 
-GLuint GLProgram::createGLShader(GLenum type, const string& typeStr, const string& source)
+// Static
+GLProgram* GLProgram::fromFiles(const ShaderFiles &files)
 {
-	GLuint shader = glCreateShader(type);
-	const char* sourcePtr = source.c_str();
-	int sourceLen = source.length();
-	glShaderSource(shader, 1, &sourcePtr, &sourceLen);
-	glCompileShader(shader);
+	std::set<string> sourceFiles;
+	string sources[3];
+	preprocess(files, sources, sourceFiles);
+
+	GLProgram *prog = fromSources(sources[0], sources[1], sources[2]);
+	prog->m_files = files;
+	prog->m_sourceFiles.swap(sourceFiles);
+	return prog;
+}
 
-	GLint status = 0;
-	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
-	if (!status)
-	{
-		GLint infoLen = 0;
-		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &infoLen);
-		if (!infoLen)
-		{
-			printf("glCompileShader(%s) failed!", typeStr.c_str());
-            exit(1);
+// Static
+GLProgram* GLProgram::fromFiles(const string &vs, const string &gs, const string &fs, const map<string, string> &repl)
+{
+	ShaderFiles files;
+	files.stages[0] = vs;
+	files.stages[1] = gs;
+	files.stages[2] = fs;
+	files.replacements = repl;
+	return fromFiles(files);
+}
+
+// Static
+GLProgram* GLProgram::fromSources(const string &vertexSource, const string &geometrySource, const string &fragmentSource)
+{
+	if (!binaryCacheSupported())
+		return new GLProgram(vertexSource, geometrySource, fragmentSource);
+
+	const size_t key = programKey(vertexSource, geometrySource, fragmentSource);
+	GLuint handle = loadProgramBinary(key);
+	if (handle) {
+		GLProgram *prog = new GLProgram();
+		prog->m_glProgram = handle;
+		return prog;
+	}
+
+	GLProgram *prog = new GLProgram(vertexSource, geometrySource, fragmentSource);
+	saveProgramBinary(key, prog->m_glProgram);
+	return prog;
+}
+
+// Static
+void GLProgram::reloadChanged()
+{
+	std::set<string> changed = ShaderSource::invalidateChanged();
+	if (changed.empty())
+		return;
+
+	// Programs that failed to build are retried after any edit
+	std::map<string, ShaderFiles> rebuild;
+	rebuild.swap(s_failed);
+	for (auto &entry : s_programs) {
+		GLProgram *prog = entry.second;
+		for (const string &file : prog->m_sourceFiles) {
+			if (changed.count(file)) {
+				rebuild[entry.first] = prog->m_files;
+				break;
+			}
 		}
+	}
 
-		std::vector<char> info(infoLen);
-		info[0] = '\0';
-		glGetShaderInfoLog(shader, infoLen, &infoLen, info.data());
-		printf("glCompileShader(%s) failed!\n\n%s", typeStr.c_str(), info.data());
-        throw std::runtime_error("Shader compilation failed!");
+	for (auto &entry : rebuild) {
+		std::cout << "Rebuilding program " << entry.first << std::endl;
+		buildAsync(entry.first, entry.second);
 	}
+}
 
-    glCheckError();
-	return shader;
+// Static
+void GLProgram::warmUp()
+{
+	if (!programManifestLoaded)
+		loadProgramManifest();
+
+	typedef std::chrono::high_resolution_clock Clock;
+	Clock::time_point start = Clock::now();
+
+	// Everything is submitted before waiting, so that the driver can compile in parallel
+	for (auto &entry : programManifest) {
+		if (!get(entry.first) && !isBuilding(entry.first))
+			buildAsync(entry.first, entry.second);
+	}
+	finishPending(true);
+
+	// Broken entries are left out when the manifest is saved
+	for (auto it = programManifest.begin(); it != programManifest.end();) {
+		if (s_failed.count(it->first)) {
+			std::cout << "Dropping program " << it->first << " from warm-up" << std::endl;
+			it = programManifest.erase(it);
+			programManifestChanged = true;
+		}
+		else {
+			++it;
+		}
+	}
+
+	std::cout << "Warmed up " << programManifest.size() << " programs in " << (int)std::chrono::duration<float, std::milli>(Clock::now() - start).count() << " ms" << std::endl;
 }
 
+// Static
+void GLProgram::saveManifest()
+{
+	if (!programManifestChanged)
+		return;
+
+	programManifestChanged = false;
+	writeFileAtomically(PROGRAM_MANIFEST_PATH, "program manifest", [](std::ofstream &out) {
+		out << PROGRAM_MANIFEST_HEADER << "\n";
+		for (auto &entry : programManifest) {
+			writeManifestLine(out, entry.first, entry.second);
+		}
+		return true;
+	});
+}
 
-void GLProgram::linkGLProgram(GLuint prog)
+// Static
+void GLProgram::buildAsync(const string &name, const ShaderFiles &files)
 {
-	glLinkProgram(prog);
-	GLint status = 0;
-	glGetProgramiv(prog, GL_LINK_STATUS, &status);
-	if (!status)
-	{
-		GLint infoLen = 0;
-		glGetProgramiv(prog, GL_INFO_LOG_LENGTH, &infoLen);
-		if (!infoLen)
-		{
-			printf("glLinkGLProgram() failed!");
-            exit(1);
+	s_failed.erase(name);
+	if (!asyncCompile || !(driverCompilesInParallel() || compileThread)) {
+		try {
+			set(name, fromFiles(files));
 		}
+		catch (std::runtime_error &e) {
+			std::cout << "Failed to build program " << name << ": " << e.what() << std::endl;
+			if (!get(name))
+				s_failed[name] = files;
+		}
+		return;
+	}
 
-		std::vector<char> info(infoLen);
-		info[0] = '\0';
-		glGetProgramInfoLog(prog, infoLen, &infoLen, info.data());
-		printf("glLinkGLProgram() failed!\n\n%s", info.data());
-        exit(1);
+	GLProgram *prog = new GLProgram();
+	string sources[3];
+	try {
+		preprocess(files, sources, prog->m_sourceFiles);
+	}
+	catch (std::runtime_error &e) {
+		std::cout << "Failed to build program " << name << ": " << e.what() << std::endl;
+		if (!get(name))
+			s_failed[name] = files;
+		delete prog;
+		return;
+	}
+	prog->m_files = files;
+
+	// Loading a cached binary does not compile anything
+	if (binaryCacheSupported()) {
+		prog->m_binaryKey = programKey(sources[0], sources[1], sources[2]);
+		prog->m_glProgram = loadProgramBinary(prog->m_binaryKey);
+		if (prog->m_glProgram) {
+			set(name, prog);
+			return;
+		}
+	}
+
+	if (compileThread) {
+		prog->m_compiled = compileThread->enqueue([prog, sources]() {
+			prog->submit(sources[0], sources[1], sources[2]);
+			prog->checkLinked();
+			glFinish(); // visible to the main context once the future is ready
+		});
+	}
+	else {
+		prog->submit(sources[0], sources[1], sources[2]);
+	}
+	s_pending.push_back(std::make_pair(name, prog));
+}
+
+// Static
+bool GLProgram::isBuilding(const string &name)
+{
+	for (auto &entry : s_pending) {
+		if (entry.first == name)
+			return true;
 	}
+	return s_failed.count(name) > 0;
+}
+
+// Static
+void GLProgram::finishPending(bool wait)
+{
+	for (size_t i = 0; i < s_pending.size();) {
+		const string name = s_pending[i].first;
+		GLProgram *prog = s_pending[i].second;
+		if (!wait && !prog->completed()) {
+			i++;
+			continue;
+		}
+		s_pending.erase(s_pending.begin() + i);
 
-    glCheckError();
+		// Superseded by a later build of the same program
+		bool superseded = false;
+		for (auto &entry : s_pending) {
+			superseded |= entry.first == name;
+		}
+
+		try {
+			if (prog->m_compiled.valid())
+				prog->m_compiled.get();
+			else
+				prog->checkLinked();
+		}
+		catch (std::exception &e) {
+			std::cout << "Failed to build program " << name << ": " << e.what() << std::endl;
+			if (!get(name) && !superseded)
+				s_failed[name] = prog->m_files;
+			delete prog;
+			continue;
+		}
+
+		if (superseded) {
+			delete prog;
+			continue;
+		}
+
+		if (prog->m_binaryKey)
+			saveProgramBinary(prog->m_binaryKey, prog->m_glProgram);
+		set(name, prog);
+	}
 }
 
+// Static
+bool GLProgram::driverCompilesInParallel()
+{
+	static int supported = -1;
+	if (supported < 0)
+		supported = (glHasExtension("GL_KHR_parallel_shader_compile") || glHasExtension("GL_ARB_parallel_shader_compile")) ? 1 : 0;
+	return supported == 1;
+}
+
+// Static
+void GLProgram::startCompileThread(std::function<void()> makeCurrent)
+{
+	// Queried here, the compile thread must not be the first to ask
+	binaryCacheSupported();
+	driverCompilesInParallel();
+	compileThread.reset(new CompileThread(makeCurrent));
+}
+
+// Static
+void GLProgram::stopCompileThread()
+{
+	compileThread.reset();
+	finishPending(true);
+}
 
 void GLProgram::init(const string& vertexSource, const string& geometrySource, const string& fragmentSource)
+{
+	submit(vertexSource, geometrySource, fragmentSource);
+
+	// Delete what was created if a stage fails
+	try {
+		checkLinked();
+	}
+	catch (std::runtime_error&) {
+		glDeleteProgram(m_glProgram);
+		glDeleteShader(m_glVertexShader);
+		glDeleteShader(m_glGeometryShader);
+		glDeleteShader(m_glFragmentShader);
+		m_glProgram = m_glVertexShader = m_glGeometryShader = m_glFragmentShader = 0;
+		throw;
+	}
+}
+
+
+static GLuint submitShader(GLenum type, const string& source)
+{
+	GLuint shader = glCreateShader(type);
+	const char* sourcePtr = source.c_str();
+	int sourceLen = source.length();
+	glShaderSource(shader, 1, &sourcePtr, &sourceLen);
+	glCompileShader(shader);
+	return shader;
+}
+
+
+// Compile and link without querying the results, which would wait for the driver
+void GLProgram::submit(const string& vertexSource, const string& geometrySource, const string& fragmentSource)
 {
 	m_glProgram = glCreateProgram();
+	m_glVertexShader = submitShader(GL_VERTEX_SHADER, vertexSource);
+	m_glGeometryShader = geometrySource.empty() ? 0 : submitShader(GL_GEOMETRY_SHADER, geometrySource); // GL_ARB_geometry_shader4
+	m_glFragmentShader = submitShader(GL_FRAGMENT_SHADER, fragmentSource);
 
-	// Setup vertex shader
-	m_glVertexShader = createGLShader(GL_VERTEX_SHADER, "GL_VERTEX_SHADER", vertexSource);
-	glAttachShader(m_glProgram, m_glVertexShader);
+	for (GLuint shader : { m_glVertexShader, m_glGeometryShader, m_glFragmentShader }) {
+		if (shader)
+			glAttachShader(m_glProgram, shader);
+	}
+
+	if (binaryCacheSupported())
+		glProgramParameteri(m_glProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(m_glProgram);
+	glCheckError();
+}
 
-    glCheckError();
 
-	// Setup geometry shader (GL_ARB_geometry_shader4)
-	if (geometrySource.length() == 0)
-	{
-		m_glGeometryShader = 0;
+// Throws with the log of the first stage that failed
+void GLProgram::checkLinked(void)
+{
+	const char *stageNames[3] = { "GL_VERTEX_SHADER", "GL_GEOMETRY_SHADER", "GL_FRAGMENT_SHADER" };
+	const GLuint shaders[3] = { m_glVertexShader, m_glGeometryShader, m_glFragmentShader };
+	GLint status = 0, infoLen = 0;
+
+	for (int i = 0; i < 3; i++) {
+		if (!shaders[i])
+			continue;
+
+		glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &status);
+		if (!status) {
+			glGetShaderiv(shaders[i], GL_INFO_LOG_LENGTH, &infoLen);
+			std::vector<char> info(infoLen + 1, '\0');
+			glGetShaderInfoLog(shaders[i], infoLen, &infoLen, info.data());
+			printf("glCompileShader(%s) failed!\n\n%s", stageNames[i], info.data());
+			throw std::runtime_error("Shader compilation failed!");
+		}
 	}
-	else
-	{
-		m_glGeometryShader = createGLShader(GL_GEOMETRY_SHADER, "GL_GEOMETRY_SHADER", geometrySource);
-		glAttachShader(m_glProgram, m_glGeometryShader);
+
+	glGetProgramiv(m_glProgram, GL_LINK_STATUS, &status);
+	if (!status) {
+		glGetProgramiv(m_glProgram, GL_INFO_LOG_LENGTH, &infoLen);
+		std::vector<char> info(infoLen + 1, '\0');
+		glGetProgramInfoLog(m_glProgram, infoLen, &infoLen, info.data());
+		printf("glLinkGLProgram() failed!\n\n%s", info.data());
+		throw std::runtime_error("Program linking failed!");
 	}
 
-	// Setup fragment shader
-	m_glFragmentShader = createGLShader(GL_FRAGMENT_SHADER, "GL_FRAGMENT_SHADER", fragmentSource);
-	glAttachShader(m_glProgram, m_glFragmentShader);
+	glCheckError();
+}
+
 
-	// Link
-	linkGLProgram(m_glProgram);
-}
\ No newline at end of file
+bool GLProgram::completed(void)
+{
+	if (m_compiled.valid())
+		return m_compiled.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+
+	GLint done = GL_TRUE;
+	if (driverCompilesInParallel())
+		glGetProgramiv(m_glProgram, GL_COMPLETION_STATUS_KHR, &done);
+	return done == GL_TRUE;
+}
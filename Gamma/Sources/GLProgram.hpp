@@ -4,8 +4,11 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
 #include <algorithm>
 #include <cstdlib>
+#include <future>
+#include <functional>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -14,6 +17,21 @@
 
 using std::string;
 
+// Shader files in Gamma/Shaders a program is built from
+struct ShaderFiles {
+	string stages[3]; // vertex, geometry (may be empty), fragment
+	map<string, string> replacements;
+};
+
+// Interned uniform name, the same in every program. Create once and keep, e.g.
+// static const UniformID U_KD("Kd"). Array elements are named like "lights[2]".
+// Each program resolves an ID to its location the first time it is set and
+// indexes a table afterwards, so per-frame uniforms never hash strings.
+struct UniformID {
+	explicit UniformID(const char *name);
+	unsigned int index;
+};
+
 class GLProgram
 {
 public:
@@ -27,38 +45,97 @@ public:
 	GLint           getUniformLoc(const string& name) const;
 
 	void            use(void);
-    void            addVAOs(GLuint *arr, int num);
-    void            bindVAO(int ind);
-
-	static GLuint   createGLShader(GLenum type, const string& typeStr, const string& source);
-	static void     linkGLProgram(GLuint prog);
+	void            addVAOs(GLuint *arr, int num);
+	void            bindVAO(int ind);
 
 	// Static collection of all compiled programs
 	static GLProgram* get(const string &name);
 	static void		  set(const string &name, GLProgram *prog);
-    static void       clearCache();
+	static void       clearCache();
+
+	// Build from shader files, throws on errors.
+	// The files and their includes are remembered for reloadChanged().
+	static GLProgram* fromFiles(const ShaderFiles &files);
+	static GLProgram* fromFiles(const string &vs, const string &gs, const string &fs,
+								const map<string, string> &repl = map<string, string>());
+
+	// Link from preprocessed sources, or load the binary cached by an earlier run
+	static GLProgram* fromSources(const string &vertexSource, const string &geometrySource, const string &fragmentSource);
+
+	// Rebuild the cached programs built from shader files edited since they were read.
+	// A program that fails to compile keeps its previous version.
+	static void       reloadChanged();
+
+	// Build every program used in earlier runs, so that none is compiled mid-frame
+	static void       warmUp();
+	// Write the programs known to warmUp() if any were added or dropped, once at exit
+	static void       saveManifest();
+
+	// Start building a program without waiting for the driver. It replaces the cached
+	// program once finishPending() finds it done, until then get() returns the previous one.
+	// Falls back to building in place if background compilation is unavailable or disabled.
+	static void       buildAsync(const string &name, const ShaderFiles &files);
+
+	// Pending, or failed to build and no files changed since
+	static bool       isBuilding(const string &name);
+
+	// Swap in the programs that are done building, once per frame
+	static void       finishPending(bool wait = false);
 
-    void             setUniform(int loc, unsigned int v) { if (loc >= 0) glUniform1ui(loc, v); }
-    void             setUniform(int loc, int v) { if (loc >= 0) glUniform1i(loc, v); }
+	// Without GL_KHR_parallel_shader_compile, compile on a thread with a context
+	// sharing objects with the main one. makeCurrent is called on that thread.
+	static bool       driverCompilesInParallel();
+	static void       startCompileThread(std::function<void()> makeCurrent);
+	static void       stopCompileThread();
+
+	// Use background compilation where available
+	static bool       asyncCompile;
+
+	// Stand-in programs leave out most uniforms of the program they replace
+	bool             reportUniformErrors = true;
+
+	// Interned names, IDs are indices into each program's location table
+	static unsigned int   uniformID(const string &name);
+	static std::vector<UniformID> uniformArray(const string &name, size_t count);
+
+	// Uniform blocks of this name use binding in every program, applied at use().
+	// GLSL 330 cannot declare binding points itself.
+	static void      bindUniformBlock(const string &block, unsigned int binding);
+
+	// Location from the table reflected at first use, -1 if the uniform is not active.
+	// Missing uniforms are reported once per program.
+	GLint            uniformLoc(UniformID id);
+
+	void             setUniform(int loc, unsigned int v) { if (loc >= 0) glUniform1ui(loc, v); }
+	void             setUniform(int loc, int v) { if (loc >= 0) glUniform1i(loc, v); }
 	void             setUniform(int loc, float v) { if (loc >= 0) glUniform1f(loc, v); }
 	void             setUniform(int loc, const glm::vec2& v) { if (loc >= 0) glUniform2f(loc, v.x, v.y); }
 	void             setUniform(int loc, const glm::vec3& v) { if (loc >= 0) glUniform3f(loc, v.x, v.y, v.z); }
-    void             setUniform(int loc, const glm::vec4& v) { if (loc >= 0) glUniform4f(loc, v.x, v.y, v.z, v.w); }
+	void             setUniform(int loc, const glm::vec4& v) { if (loc >= 0) glUniform4f(loc, v.x, v.y, v.z, v.w); }
 	void             setUniform(int loc, const glm::mat4& m) { if (loc >= 0) glUniformMatrix4fv(loc, 1, false, glm::value_ptr(m)); }
 
-    template <typename T>
-    void setUniform(const string& name, T v) { 
-        GLint loc = getUniformLoc(name);
-        if (loc == -1) std::cout << "Uniform name error: " << name << std::endl;
-        setUniform(loc, v);
-    }
+	template <typename T>
+	void setUniform(UniformID id, T v) {
+		setUniform(uniformLoc(id), v);
+	}
+
+	// Interns the name on every call, prefer a UniformID outside of one-off passes
+	template <typename T>
+	void setUniform(const string& name, T v) { 
+		setUniform(UniformID(name.c_str()), v);
+	}
 
 	void			 setAttrib(int loc, int size, GLenum type, int stride, GLuint buffer, const void* pointer);
 	void             setAttrib(int loc, int size, GLenum type, int stride, const void* pointer) { setAttrib(loc, size, type, stride, (GLuint)NULL, pointer); }
 	void			 resetAttribs(void);
 
 private:
+	GLProgram(void) = default; // used for cached binaries
 	void            init(const string& vertexSource, const string& geometrySource, const string& fragmentSource);
+	void            submit(const string& vertexSource, const string& geometrySource, const string& fragmentSource);
+	void            checkLinked(void);
+	bool            completed(void);
+	void            reflectUniforms(void);
 
 private:
 	GLProgram(const GLProgram&) = delete;
@@ -67,11 +144,29 @@ private:
 private:
 	// Map that contains all compiled GLPrograms
 	static std::map<string, GLProgram*> s_programs;
+
+	// Programs being built in the background, in submission order
+	static std::vector<std::pair<string, GLProgram*>> s_pending;
+	static std::map<string, ShaderFiles> s_failed;
 	
-    std::vector<GLuint> vaos;
+	std::vector<GLuint> vaos;
 	int				m_numAttribs = 0;
-	GLuint          m_glVertexShader;
-	GLuint          m_glGeometryShader;
-	GLuint          m_glFragmentShader;
-	GLuint          m_glProgram;
+	GLuint          m_glVertexShader = 0;
+	GLuint          m_glGeometryShader = 0;
+	GLuint          m_glFragmentShader = 0;
+	GLuint          m_glProgram = 0;
+
+	// Set by fromFiles()
+	ShaderFiles     m_files;
+	std::set<string> m_sourceFiles; // including headers
+
+	// Uniform locations by UniformID index, filled on demand from the active uniforms
+	std::vector<GLint> m_uniformLocs;
+	std::map<string, GLint> m_activeUniforms;
+	bool            m_reflected = false;
+	size_t          m_blocksBound = 0; // entries of the block binding list applied so far
+
+	// Set while building in the background
+	std::future<void> m_compiled; // on the compile thread
+	size_t          m_binaryKey = 0; // binary to save when done
 };
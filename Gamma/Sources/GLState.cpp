@@ -0,0 +1,154 @@
+#include "GLState.hpp"
+#include "utils.hpp"
+
+const unsigned int GLState::MAX_TEXTURE_UNITS;
+const GLuint GLState::UNKNOWN;
+
+GLState& GLState::instance() {
+    static GLState state;
+    return state;
+}
+
+void GLState::beginFrame() {
+    invalidate();
+    for (int p = 0; p < NUM_PASSES; p++) {
+        last[p] = current[p];
+        current[p] = Counters();
+    }
+    pass = PASS_OTHER;
+}
+
+void GLState::invalidate() {
+    program = vertexArray = activeUnit = framebuffer = UNKNOWN;
+    for (unsigned int unit = 0; unit < MAX_TEXTURE_UNITS; unit++) {
+        textures[unit][0] = textures[unit][1] = UNKNOWN;
+    }
+    attachments.clear();
+    viewportRect[0] = viewportRect[1] = viewportRect[2] = viewportRect[3] = UNKNOWN;
+    capabilities.clear();
+    depthFuncMode = cullFaceMode = UNKNOWN;
+}
+
+bool GLState::update(GLuint &cached, GLuint value) {
+    if (cached == value) {
+        current[pass].elided++;
+        return false;
+    }
+
+    cached = value;
+    current[pass].submitted++;
+    return true;
+}
+
+void GLState::useProgram(GLuint p) {
+    if (update(program, p))
+        glUseProgram(p);
+}
+
+void GLState::bindVertexArray(GLuint vao) {
+    if (update(vertexArray, vao))
+        glBindVertexArray(vao);
+}
+
+void GLState::activeTexture(unsigned int unit) {
+    if (update(activeUnit, unit))
+        glActiveTexture(GL_TEXTURE0 + unit);
+}
+
+void GLState::bindTexture(unsigned int unit, GLenum target, GLuint texture) {
+    const bool cached = unit < MAX_TEXTURE_UNITS && (target == GL_TEXTURE_2D || target == GL_TEXTURE_CUBE_MAP);
+    if (!cached) {
+        activeTexture(unit);
+        glBindTexture(target, texture);
+        current[pass].submitted++;
+        return;
+    }
+
+    GLuint &bound = textures[unit][target == GL_TEXTURE_CUBE_MAP ? 1 : 0];
+    if (bound == texture) {
+        current[pass].elided++;
+        return;
+    }
+
+    activeTexture(unit);
+    update(bound, texture);
+    glBindTexture(target, texture);
+}
+
+void GLState::bindFramebuffer(GLuint fbo) {
+    if (update(framebuffer, fbo))
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+}
+
+void GLState::framebufferTexture(GLuint texture) {
+    // Attachments of a framebuffer bound behind our back are not known
+    if (framebuffer == UNKNOWN) {
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0);
+        current[pass].submitted++;
+        return;
+    }
+
+    auto found = attachments.find(framebuffer);
+    GLuint attached = (found != attachments.end()) ? found->second : UNKNOWN;
+    if (update(attached, texture)) {
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0);
+        attachments[framebuffer] = texture;
+    }
+}
+
+void GLState::viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+    if (viewportRect[0] == (GLuint)x && viewportRect[1] == (GLuint)y &&
+        viewportRect[2] == (GLuint)width && viewportRect[3] == (GLuint)height) {
+        current[pass].elided++;
+        return;
+    }
+
+    viewportRect[0] = (GLuint)x;
+    viewportRect[1] = (GLuint)y;
+    viewportRect[2] = (GLuint)width;
+    viewportRect[3] = (GLuint)height;
+    current[pass].submitted++;
+    glViewport(x, y, width, height);
+}
+
+void GLState::setEnabled(GLenum capability, bool enabled) {
+    auto found = capabilities.find(capability);
+    GLuint state = (found != capabilities.end()) ? found->second : UNKNOWN;
+    if (!update(state, enabled ? 1 : 0))
+        return;
+
+    capabilities[capability] = state;
+    if (enabled)
+        glEnable(capability);
+    else
+        glDisable(capability);
+}
+
+bool GLState::isEnabled(GLenum capability) {
+    auto found = capabilities.find(capability);
+    if (found != capabilities.end())
+        return found->second != 0;
+
+    const bool enabled = glIsEnabled(capability) == GL_TRUE;
+    capabilities[capability] = enabled ? 1 : 0;
+    return enabled;
+}
+
+GLenum GLState::getCullFace() {
+    if (cullFaceMode == UNKNOWN) {
+        GLint mode = GL_BACK;
+        glGetIntegerv(GL_CULL_FACE_MODE, &mode);
+        cullFaceMode = (GLuint)mode;
+    }
+    return cullFaceMode;
+}
+
+void GLState::depthFunc(GLenum func) {
+    if (update(depthFuncMode, func))
+        glDepthFunc(func);
+}
+
+void GLState::cullFace(GLenum mode) {
+    if (update(cullFaceMode, mode))
+        glCullFace(mode);
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <glad/glad.h>
+#include <map>
+#include <cstddef>
+
+/*
+    Shadow copy of the GL state changed while rendering a frame.
+
+    Binding the program, vertex array, texture, framebuffer or attachment
+    that is already bound, or setting the viewport, capabilities, depth
+    function or cull face to their current values, is dropped before it
+    reaches the driver.
+
+    The copy only holds while every change goes through it. Code that sets
+    state directly (resource creation, uploads, ImGui) runs outside of the
+    renderer's passes, and beginFrame() forgets everything before the first
+    pass. Code inside a pass that must use GL directly calls invalidate().
+
+    Calls are counted per pass as submitted (reached GL) or elided.
+*/
+
+class GLState {
+public:
+    // Process-wide state of the one GL context
+    static GLState& instance();
+
+    enum Pass { PASS_SHADOW, PASS_SHADING, PASS_POST, PASS_OTHER, NUM_PASSES };
+
+    struct Counters {
+        size_t submitted = 0; // calls that reached GL
+        size_t elided = 0;    // calls dropped as redundant
+    };
+
+    // Forget the state and start counting a new frame, the last one stays readable
+    void beginFrame();
+    void setPass(Pass p) { pass = p; }
+    const Counters& lastFrame(Pass p) const { return last[p]; }
+
+    // Forget the state, the next call of each kind goes to GL
+    void invalidate();
+
+    void useProgram(GLuint program);
+    void bindVertexArray(GLuint vao);
+    // GL_TEXTURE_2D and GL_TEXTURE_CUBE_MAP are cached, other targets are passed through
+    void bindTexture(unsigned int unit, GLenum target, GLuint texture);
+    void bindFramebuffer(GLuint fbo);
+    // Color attachment 0 of the bound framebuffer, level 0 and every face of cube maps
+    void framebufferTexture(GLuint texture);
+    void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+    void setEnabled(GLenum capability, bool enabled);
+    void depthFunc(GLenum func);
+    void cullFace(GLenum mode);
+
+    // Current state, read back from GL while unknown
+    bool isEnabled(GLenum capability);
+    GLenum getCullFace();
+
+    static const unsigned int MAX_TEXTURE_UNITS = 32;
+
+    GLState(const GLState&) = delete;
+    GLState& operator=(const GLState&) = delete;
+
+private:
+    GLState(void) { invalidate(); }
+    ~GLState() = default;
+
+    // Updates cached and counts the call, true if it has to be submitted
+    bool update(GLuint &cached, GLuint value);
+    void activeTexture(unsigned int unit);
+
+    static const GLuint UNKNOWN = ~0u;
+
+    GLuint program;
+    GLuint vertexArray;
+    GLuint activeUnit;
+    GLuint textures[MAX_TEXTURE_UNITS][2]; // 2D, cube map
+    GLuint framebuffer;
+    std::map<GLuint, GLuint> attachments; // color attachment 0 by framebuffer
+    GLuint viewportRect[4];
+    std::map<GLenum, GLuint> capabilities;
+    GLuint depthFuncMode;
+    GLuint cullFaceMode;
+
+    Pass pass = PASS_OTHER;
+    Counters current[NUM_PASSES];
+    Counters last[NUM_PASSES];
+};
@@ -1,5 +1,7 @@
 #pragma once
 #include <glad/glad.h>
+#include <iostream>
+#include "GLState.hpp"
 
 class VertexArray {
 public:
@@ -12,8 +14,8 @@ public:
         glDeleteVertexArrays(1, &id);
     }
 
-    void bind() { glBindVertexArray(id); }
-    void unbind() { glBindVertexArray(0); }
+    void bind() { GLState::instance().bindVertexArray(id); }
+    void unbind() { GLState::instance().bindVertexArray(0); }
 
     VertexArray(const VertexArray&) = delete;
     VertexArray& operator=(const VertexArray&) = delete;
@@ -3,9 +3,14 @@
 #include "GammaPhysics.hpp"
 #include "gamma.hpp"
 #include "utils.hpp"
+#include "GLProgram.hpp"
 #include "Model.hpp"
 #include "OrbitCamera.hpp"
 #include "FlightCamera.hpp"
+#include "ThreadPool.hpp"
+#include "UploadQueue.hpp"
+#include "UniformRing.hpp"
+#include "BrdfLUT.hpp"
 #include <tinyfiledialogs.h>
 #include <imgui.h>
 #include "imgui_impl_glfw_gl3.h"
@@ -29,14 +34,26 @@ GammaCore::GammaCore(void) {
     //camera.reset(new OrbitCamera(CameraType::PERSP, mWindow));
     camera.reset(new FlightCamera(CameraType::PERSP, mWindow));
     renderer->linkCamera(camera);
+
+    // Compile or load every program up front
+    GLProgram::warmUp();
 }
 
 GammaCore::~GammaCore(void) {
     // Indirectly force release of GL objects before glfwTerminate()
+    if (pendingModel.valid())
+        pendingModel.wait();
+
     renderer.reset();
     physics.reset();
     scene.reset();
     camera.reset();
+    UploadQueue::instance().release();
+    UniformRing::instance().release();
+    BrdfLUT::release();
+    GLProgram::stopCompileThread();
+    GLProgram::saveManifest();
+    GLProgram::clearCache();
     glfwTerminate();
     std::cout << "Core engine shutdown" << std::endl;
 }
@@ -46,6 +63,7 @@ GammaCore::~GammaCore(void) {
 void GammaCore::mainLoop() {
     double lastTime = glfwGetTime();
     double lagMs = 0.0; // how much simulation lags behind world clock
+    double lastShaderCheck = lastTime;
     while (!glfwWindowShouldClose(mWindow)) {
         ImGui_ImplGlfwGL3_NewFrame();
         double current = glfwGetTime();
@@ -62,6 +80,17 @@ void GammaCore::mainLoop() {
             lagMs -= MS_PER_UPDATE;
         }
 
+        // Pick up edited shaders, swap in the ones done compiling
+        if (current - lastShaderCheck >= SHADER_CHECK_INTERVAL) {
+            GLProgram::reloadChanged();
+            lastShaderCheck = current;
+        }
+        GLProgram::finishPending();
+
+        // Stream in loaded resources within the frame's upload budget
+        finishPendingLoads();
+        UploadQueue::instance().processFrame();
+
         // Render
         renderer->render();
         drawUI();
@@ -272,7 +301,7 @@ void GammaCore::handleKey(int key, int action, int mods) {
     #define match(key, expr) case key: expr; break;
     switch (key) {
         match(GLFW_KEY_SPACE, placeLight());
-        match(GLFW_KEY_F5, GLProgram::clearCache()); // force recompile of shaders
+        match(GLFW_KEY_F5, GLProgram::reloadChanged()); // recompile edited shaders now
         match(GLFW_KEY_ESCAPE, glfwSetWindowShouldClose(mWindow, true));
         match(GLFW_KEY_L, openFileSelector());
     }
@@ -312,10 +341,9 @@ void GammaCore::openFileSelector() {
                 scene->initFromFile(path.c_str());
             }
             else {
-                Model m(path);
-                m.normalizeScale();
-                scene->clearModels();
-                scene->addModel(m);
+                // Geometry is read on a worker, the scene is updated once it is ready
+                pendingModelPath = path;
+                pendingModel = ThreadPool::shared().enqueue([path]() { return Model::readSource(path); });
             }
         }
         catch (std::runtime_error e) {
@@ -324,6 +352,22 @@ void GammaCore::openFileSelector() {
     }
 }
 
+// Add model to scene once its geometry has been read
+void GammaCore::finishPendingLoads() {
+    if (!pendingModel.valid() || pendingModel.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return;
+
+    try {
+        Model m(pendingModel.get());
+        m.normalizeScale();
+        scene->clearModels();
+        scene->addModel(m);
+    }
+    catch (std::runtime_error e) {
+        std::cout << "Could not load model '" << pendingModelPath << "':" << e.what() << std::endl;
+    }
+}
+
 inline GammaCore *corePointer(GLFWwindow* window) {
     return static_cast<GammaCore*>(glfwGetWindowUserPointer(window));
 }
@@ -378,6 +422,17 @@ void GammaCore::initGL() {
     fprintf(stdout, "OpenGL %s\n", glGetString(GL_VERSION));
     fprintf(stdout, "Vendor: %s\n", glGetString(GL_VENDOR));
 
+    // Hidden context for compiling shaders in the background, if the driver won't
+    if (!GLProgram::driverCompilesInParallel()) {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE); // same context hints as mWindow otherwise
+        compileWindow = glfwCreateWindow(1, 1, "Gamma shader compiler", nullptr, mWindow);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+        if (compileWindow) {
+            GLFWwindow *window = compileWindow;
+            GLProgram::startCompileThread([window]() { glfwMakeContextCurrent(window); });
+        }
+    }
+
     glfwSetWindowUserPointer(mWindow, this);
     glfwSetWindowSizeCallback(mWindow, windowSizeCallback);
     glfwSetCursorPosCallback(mWindow, cursorPositionCallback);
@@ -3,6 +3,7 @@
 #include <GLFW/glfw3.h>
 #include <memory>
 #include <vector>
+#include <future>
 #include "Scene.hpp"
 #include "Camera.hpp"
 
@@ -43,17 +44,26 @@ private:
 
     void placeLight();
     void drawUI();
+    void finishPendingLoads();
 
     std::unique_ptr<GammaRenderer> renderer;
     std::unique_ptr<GammaPhysics> physics;
     GLFWwindow *mWindow;
+    GLFWwindow *compileWindow = nullptr; // shares objects with mWindow
 
     // Data shared between renderer and physics engine
     std::shared_ptr<Scene> scene;
     std::shared_ptr<CameraBase> camera;
 
+    // Model being read in the background after openFileSelector()
+    std::future<std::shared_ptr<ModelSource>> pendingModel;
+    std::string pendingModelPath;
+
     // Rendering and physics parameters
     const int PHYSICS_FPS = 75; // typically 60+
     const double MS_PER_UPDATE = 1000.0 / PHYSICS_FPS;
 
+    // Seconds between checks for edited shader files
+    const double SHADER_CHECK_INTERVAL = 0.5;
+
 };
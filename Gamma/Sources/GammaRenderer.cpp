@@ -1,25 +1,82 @@
 #include "GammaRenderer.hpp"
 #include "GLProgram.hpp"
 #include "utils.hpp"
+#include "UploadQueue.hpp"
+#include "UniformRing.hpp"
+#include "GLState.hpp"
+#include "ResourceRegistry.hpp"
+#include "BrdfLUT.hpp"
+#include "TextureCompression.hpp"
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <map>
 
+static const UniformID U_V("V");
+static const UniformID U_P("P");
+static const UniformID U_ALBEDO_MAP("albedoMap");
+static const UniformID U_NORMAL_MAP("normalMap");
+static const UniformID U_SHININESS_MAP("shininessMap");
+static const UniformID U_METALLIC_MAP("metallicMap");
+static const UniformID U_IRRADIANCE_MAP("irradianceMap");
+static const UniformID U_RADIANCE_MAP("radianceMap");
+static const UniformID U_BRDF_LUT("brdfLUT");
+static const UniformID U_USE_VSM("useVSM");
+static const UniformID U_SVM_BLEED_FIX("svmBleedFix");
+static const UniformID U_USE_UC2("useUC2");
+static const UniformID U_EXPOSURE("exposure");
+static const UniformID U_INV_TEX_SIZE("invTexSize");
+static const UniformID U_FXAA_SPAN_MAX("fxaaSpanMax");
+static const UniformID U_FXAA_REDUCE_MUL("fxaaReduceMul");
+static const UniformID U_FXAA_REDUCE_MIN("fxaaReduceMin");
+static const UniformID U_ENV_MAP("envMap");
+static const std::vector<UniformID> U_SHADOW_MAPS = GLProgram::uniformArray("shadowMaps", GammaRenderer::MAX_LIGHTS);
+static const std::vector<UniformID> U_SHADOW_CUBE_MAPS = GLProgram::uniformArray("shadowCubeMaps", GammaRenderer::MAX_LIGHTS);
+
+// std140 layout of LightData in uniform_blocks.glh
+struct LightData {
+    glm::vec4 lightVectors[GammaRenderer::MAX_LIGHTS];
+    glm::vec4 emissions[GammaRenderer::MAX_LIGHTS];
+    glm::mat4 lightTransforms[GammaRenderer::MAX_LIGHTS];
+    GLuint nLights;
+};
+
 void GammaRenderer::linkScene(std::shared_ptr<Scene> scene) {
     this->scene = scene;
     scene->setMaxLights(MAX_LIGHTS);
 }
 
 void GammaRenderer::render() {
+    // Uniform blocks written from here on go to this frame's part of the ring
+    UniformRing::instance().beginFrame();
+
+    // Built before the first pass, the state cache only holds within them
+    BrdfLUT::get();
+
+    // Uploads and the UI have changed state since the last frame
+    GLState &gl = GLState::instance();
+    gl.beginFrame();
+
+    // Levels of detail follow the camera in all passes, meshlets are culled in the shading pass
+    const bool backfacesCulled = gl.isEnabled(GL_CULL_FACE) && gl.getCullFace() == GL_BACK;
+    Mesh::meshletsDrawn = Mesh::meshletsCulled = 0;
+    for (Model &m : scene->models()) {
+        m.updateView(camera->getV(), camera->getP(), (float)fbHeight, backfacesCulled);
+    }
+
     // Draw (and filter) shadow maps
+    gl.setPass(GLState::PASS_SHADOW);
     shadowPass();
 
     // Perform shading
+    gl.setPass(GLState::PASS_SHADING);
     shadingPass();
 
     // Postprocessing
+    gl.setPass(GLState::PASS_POST);
     postProcessPass();
+    gl.setPass(GLState::PASS_OTHER);
 
+    UniformRing::instance().endFrame();
     glCheckError();
 }
 
@@ -48,11 +105,19 @@ void GammaRenderer::reshape() {
 }
 
 void GammaRenderer::shadowPass() {
+    // Casters grouped by geometry, uploaded once for all lights
+    shadowQueue.clear();
+    for (Model &m : scene->models()) {
+        m.enqueueShadowCasters(shadowQueue);
+    }
+    shadowQueue.sort();
+    shadowQueue.upload(false);
+
     glBeginQuery(GL_TIME_ELAPSED, queryID[queryBackBuffer][0]);
     
     // Render shadow maps
     for (Light *l : scene->lights()) {
-        l->renderShadowMap(scene);
+        l->renderShadowMap(shadowQueue);
     }
 
     // Blur SVM shadows
@@ -70,20 +135,27 @@ void GammaRenderer::shadingPass() {
     std::string progId = "Render::shadeGGX";
     GLProgram* prog = GLProgram::get(progId);
     if (!prog) {
-        std::cout << "Compiling GGX program" << std::endl;
         std::map<std::string, std::string> repl;
         repl["$MAX_LIGHTS"] = "#define MAX_LIGHTS " + std::to_string(MAX_LIGHTS);
-        prog = new GLProgram(readShader("Gamma/Shaders/ggx.vert", repl),
-                             readShader("Gamma/Shaders/ggx.frag", repl));
-        GLProgram::set(progId, prog);
+
+        // Diffuse-only shading while the GGX program compiles
+        GLProgram *fallback = getProgram("Render::shadeFallback", "ggx.vert", "ggx_fallback.frag", repl);
+        fallback->reportUniformErrors = false;
+        prog = getProgramAsync(progId, "ggx.vert", "ggx.frag", repl, fallback);
+    }
+
+    // New program, either first use or reloaded
+    if (prog != shadeProg) {
         createDefaultCubemap(prog);
+        shadeProg = prog;
     }
 
     // Draw into framebuffer for later post-processing
     // Viewport uses FB size, not window size
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTex[0], 0);
-    glViewport(0, 0, fbWidth, fbHeight);
+    GLState &gl = GLState::instance();
+    gl.bindFramebuffer(fbo);
+    gl.framebufferTexture(colorTex[0]);
+    gl.viewport(0, 0, fbWidth, fbHeight);
     glClearColor(0.125f, 0.125f, 0.125f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -91,63 +163,70 @@ void GammaRenderer::shadingPass() {
     glm::mat4 P = camera->getP();
     glm::mat4 V = camera->getV();
 
-    prog->use();
-    prog->setUniform("V", V);
-    prog->setUniform("P", P);
-    prog->setUniform("cameraPos", camera->getPosition());
-    glCheckError();
+    UniformRing &ring = UniformRing::instance();
+    FrameData frame;
+    frame.P = P;
+    frame.V = V;
+    frame.cameraPos = camera->getPosition();
+    frame.pad = 0.0f;
+    ring.bind(FRAME_BLOCK, frame);
 
     // Set lights
     std::vector<Light*> &lights = scene->lights();
-    prog->setUniform("nLights", (unsigned int)lights.size());
+    LightData lightData = {};
+    lightData.nLights = (GLuint)lights.size();
     for (size_t i = 0; i < lights.size(); i++) {
-        Light *l = lights[i];
-        prog->setUniform("lightVectors[" + std::to_string(i) + "]", l->vector);
-        prog->setUniform("emissions[" + std::to_string(i) + "]", l->emission);
-        prog->setUniform("lightTransforms[" + std::to_string(i) + "]", l->getLightTransform());
+        lightData.lightVectors[i] = lights[i]->vector;
+        lightData.emissions[i] = glm::vec4(lights[i]->emission, 0.0f);
+        lightData.lightTransforms[i] = lights[i]->getLightTransform();
+    }
+    ring.bind(LIGHT_BLOCK, lightData);
 
+    prog->use();
+    for (size_t i = 0; i < lights.size(); i++) {
+        Light *l = lights[i];
         if (l->getVector().w == 0.0) {
-            glActiveTexture(GL_TEXTURE8 + i);
-            prog->setUniform("shadowMaps[" + std::to_string(i) + "]", (int)(8 + i));
-            glBindTexture(GL_TEXTURE_2D, l->getTexHandle());
+            prog->setUniform(U_SHADOW_MAPS[i], (int)(8 + i));
+            gl.bindTexture((unsigned int)(8 + i), GL_TEXTURE_2D, l->getTexHandle());
         }
         else {
-            glActiveTexture(GL_TEXTURE8 + MAX_LIGHTS + i);
-            prog->setUniform("shadowCubeMaps[" + std::to_string(i) + "]", (int)(8 + MAX_LIGHTS + i));
-            glBindTexture(GL_TEXTURE_CUBE_MAP, l->getTexHandle());
+            prog->setUniform(U_SHADOW_CUBE_MAPS[i], (int)(8 + MAX_LIGHTS + i));
+            gl.bindTexture((unsigned int)(8 + MAX_LIGHTS + i), GL_TEXTURE_CUBE_MAP, l->getTexHandle());
         }
         glCheckError();
     }
     glCheckError();
 
     // Setup texture locations (these are static)
-    prog->setUniform("albedoMap", 0);
-    prog->setUniform("normalMap", 1);
-    prog->setUniform("shininessMap", 2);
-    prog->setUniform("metallicMap", 3);
+    prog->setUniform(U_ALBEDO_MAP, 0);
+    prog->setUniform(U_NORMAL_MAP, 1);
+    prog->setUniform(U_SHININESS_MAP, 2);
+    prog->setUniform(U_METALLIC_MAP, 3);
 
     // Setup IBL maps
     auto maps = scene->getIBLMaps();
-    prog->setUniform("irradianceMap", 4);
-    prog->setUniform("radianceMap", 5);
-    prog->setUniform("brdfLUT", 6);
-    glActiveTexture(GL_TEXTURE4);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, maps->getIrradianceMap());
-    glActiveTexture(GL_TEXTURE5);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, maps->getRadianceMap());
-    glActiveTexture(GL_TEXTURE6);
-    glBindTexture(GL_TEXTURE_2D, maps->getBrdfLUT());
+    prog->setUniform(U_IRRADIANCE_MAP, 4);
+    prog->setUniform(U_RADIANCE_MAP, 5);
+    prog->setUniform(U_BRDF_LUT, 6);
+    gl.bindTexture(4, GL_TEXTURE_CUBE_MAP, maps->getIrradianceMap());
+    gl.bindTexture(5, GL_TEXTURE_CUBE_MAP, maps->getRadianceMap());
+    gl.bindTexture(6, GL_TEXTURE_2D, maps->getBrdfLUT());
 
     // Setup other parameters
-    prog->setUniform("useVSM", Light::useVSM);
-    prog->setUniform("svmBleedFix", Light::svmBleedFix);
+    prog->setUniform(U_USE_VSM, Light::useVSM);
+    prog->setUniform(U_SVM_BLEED_FIX, Light::svmBleedFix);
+
+    // Visible meshes grouped by textures and geometry, front to back within each group
+    shadeQueue.clear();
+    for (Model &m : scene->models()) {
+        m.enqueue(shadeQueue, camera->getPosition());
+    }
+    shadeQueue.sort();
+    shadeQueue.upload();
 
-    // M set by each model before drawing
     glBeginQuery(GL_TIME_ELAPSED, queryID[queryBackBuffer][1]);
     {
-        for (Model &m : scene->models()) {
-            m.render(prog);
-        }
+        shadeQueue.submit(prog);
 
         drawSkybox();
     }
@@ -155,7 +234,7 @@ void GammaRenderer::shadingPass() {
     glCheckError();
 
     // Reset viewport to window size for later passes
-    glViewport(0, 0, windowWidth, windowHeight);
+    gl.viewport(0, 0, windowWidth, windowHeight);
 }
 
 void GammaRenderer::postProcessPass() {
@@ -166,21 +245,22 @@ void GammaRenderer::postProcessPass() {
     std::vector<GLProgram*> passes;
 
     progTonemap->use();
-    progTonemap->setUniform("useUC2", tonemapOp == 0);
-    progTonemap->setUniform("exposure", tonemapExposure);
+    progTonemap->setUniform(U_USE_UC2, tonemapOp == 0);
+    progTonemap->setUniform(U_EXPOSURE, tonemapExposure);
     passes.push_back(progTonemap);
     
     // FXAA after tone mapping!
     if (useFXAA) {
         progFXAA->use();
-        progFXAA->setUniform("invTexSize", glm::vec2(1.0f / fbWidth, 1.0f / fbHeight));
-        progFXAA->setUniform("fxaaSpanMax", 8.0f);
-        progFXAA->setUniform("fxaaReduceMul", 1.0f / 8.0f);
-        progFXAA->setUniform("fxaaReduceMin", 1.0f / 128.0f);
+        progFXAA->setUniform(U_INV_TEX_SIZE, glm::vec2(1.0f / fbWidth, 1.0f / fbHeight));
+        progFXAA->setUniform(U_FXAA_SPAN_MAX, 8.0f);
+        progFXAA->setUniform(U_FXAA_REDUCE_MUL, 1.0f / 8.0f);
+        progFXAA->setUniform(U_FXAA_REDUCE_MIN, 1.0f / 128.0f);
         passes.push_back(progFXAA);
     }
 
-    glViewport(0, 0, fbWidth, fbHeight);
+    GLState &gl = GLState::instance();
+    gl.viewport(0, 0, fbWidth, fbHeight);
     glBeginQuery(GL_TIME_ELAPSED, queryID[queryBackBuffer][2]);
 
     if (useBloom) {
@@ -190,7 +270,7 @@ void GammaRenderer::postProcessPass() {
     size_t nPasses = passes.size();
     for (int i = 0; i < nPasses; i++) {
         if (i == nPasses - 1) {
-            glViewport(0, 0, windowWidth, windowHeight);
+            gl.viewport(0, 0, windowWidth, windowHeight);
             applyFilter(passes[i], colorTex[colorDst], 0, 0); // to screen
         }
         else {
@@ -211,16 +291,16 @@ void GammaRenderer::drawSkybox() {
     if (skybox > 0) {
         GLProgram *bgProg = getProgram("Render::skybox", "draw_skybox_hdr.vert", "draw_skybox_hdr.frag");
         bgProg->use();
-        bgProg->setUniform("V", camera->getV());
-        bgProg->setUniform("P", camera->getP());
-        bgProg->setUniform("envMap", 0);
+        bgProg->setUniform(U_V, camera->getV());
+        bgProg->setUniform(U_P, camera->getP());
+        bgProg->setUniform(U_ENV_MAP, 0);
         
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, skybox);
-        glDepthFunc(GL_LEQUAL);
+        GLState &gl = GLState::instance();
+        gl.bindTexture(0, GL_TEXTURE_CUBE_MAP, skybox);
+        gl.depthFunc(GL_LEQUAL);
         drawUnitCube();
         
-        glDepthFunc(GL_LESS);
+        gl.depthFunc(GL_LESS);
     }
 }
 
@@ -230,13 +310,14 @@ void GammaRenderer::createDefaultCubemap(GLProgram *prog) {
     static GLuint shadowMap = 0;
     glDeleteTextures(1, &shadowMap);
     glGenTextures(1, &shadowMap);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, shadowMap);
     prog->use();
 
+    // Deleting unbound the old texture wherever it was bound, and the name may be reused
+    GLState &gl = GLState::instance();
+    gl.invalidate();
     for (size_t i = 0; i < MAX_LIGHTS; i++) {
-        glActiveTexture(GL_TEXTURE8 + MAX_LIGHTS + i);
-        prog->setUniform("shadowCubeMaps[" + std::to_string(i) + "]", (int)(8 + MAX_LIGHTS + i));
-        glBindTexture(GL_TEXTURE_CUBE_MAP, shadowMap);
+        prog->setUniform(U_SHADOW_CUBE_MAPS[i], (int)(8 + MAX_LIGHTS + i));
+        gl.bindTexture((unsigned int)(8 + MAX_LIGHTS + i), GL_TEXTURE_CUBE_MAP, shadowMap);
         glCheckError();
     }
 }
@@ -347,6 +428,15 @@ void GammaRenderer::drawStats(bool *show) {
     sprintf(labelPostproc, "Avg: %.2fms", smooth(postprocTimes));
     ImGui::PlotLines(labelPostproc, postprocTimes, LEN, offs, "Postprocessing (ms)", 0.0f, 10.0f, ImVec2(0, 80));
 
+    // State changes of the last complete frame, and how many the state cache dropped
+    const char *passNames[] = { "Shadows", "Shading", "Postprocessing" };
+    for (int p = GLState::PASS_SHADOW; p <= GLState::PASS_POST; p++) {
+        const GLState::Counters &calls = GLState::instance().lastFrame((GLState::Pass)p);
+        std::string text = std::string(passNames[p]) + ": " + std::to_string(calls.submitted) +
+            " state calls, " + std::to_string(calls.elided) + " elided";
+        ImGui::Text(text.c_str());
+    }
+
     firstFrame = false;
     ImGui::End();
 }
@@ -369,6 +459,47 @@ void GammaRenderer::drawSettings(bool * show) {
         ImGui::Text(fbdims.c_str());
 
         ImGui::Checkbox("Use FXAA", &useFXAA);
+
+        ImGui::Checkbox("Compress textures", &TextureCompression::enabled);
+        ImGui::Checkbox("Compile shaders in background", &GLProgram::asyncCompile);
+        ImGui::Checkbox("Compact vertices (new loads)", &Mesh::compactVertices);
+        ImGui::SliderFloat("LOD error", &Model::lodErrorPixels, 0.0f, 8.0f, "%.1f px");
+        ImGui::SliderFloat("Shadow LOD bias", &Model::shadowLODBias, 1.0f, 16.0f, "%.1fx");
+        ImGui::Checkbox("Cull meshlets", &Mesh::clusterCulling);
+        std::string meshlets = "Meshlets: " + std::to_string(Mesh::meshletsDrawn) + " drawn, " +
+            std::to_string(Mesh::meshletsCulled) + " culled";
+        ImGui::Text(meshlets.c_str());
+
+        ImGui::Checkbox("Multi-draw indirect", &RenderQueue::useIndirect);
+        if (!RenderQueue::indirectSupported()) {
+            ImGui::SameLine();
+            ImGui::Text("(not supported)");
+        }
+        std::string draws = "Draws: " + std::to_string(shadeQueue.size()) + " shaded in " +
+            std::to_string(shadeQueue.drawCalls()) + " calls, " + std::to_string(shadowQueue.size()) + " casters in " +
+            std::to_string(shadowQueue.drawCalls()) + " calls";
+        ImGui::Text(draws.c_str());
+
+        UploadQueue &uploads = UploadQueue::instance();
+        static int uploadMB = (int)(uploads.maxBytesPerFrame >> 20);
+        if (ImGui::SliderInt("Upload budget", &uploadMB, 1, 64, "%.0f MB/frame")) {
+            uploads.maxBytesPerFrame = (size_t)uploadMB << 20;
+        }
+        ImGui::SliderFloat("Upload time", &uploads.maxMsPerFrame, 0.5f, 16.0f, "%.1f ms/frame");
+
+        std::string pending = "Pending uploads: " + std::to_string(uploads.pendingJobs()) +
+            " (" + std::to_string(uploads.lastFrameBytes() >> 10) + " KB last frame)";
+        ImGui::Text(pending.c_str());
+
+        UniformRing &ring = UniformRing::instance();
+        std::string uniforms = "Uniform ring: " + std::to_string(ring.lastFrameBytes() >> 10) + " / " +
+            std::to_string(ring.capacity() >> 10) + " KB, " + std::to_string(ring.stalls()) + " stalls";
+        ImGui::Text(uniforms.c_str());
+
+        ResourceRegistry &registry = ResourceRegistry::instance();
+        std::string shared = "Shared resources: " + std::to_string(registry.numTextures()) + " textures, " +
+            std::to_string(registry.numMeshBuffers()) + " meshes (" + std::to_string(registry.bytesSaved() >> 20) + " MB saved)";
+        ImGui::Text(shared.c_str());
     }
     
 
@@ -393,6 +524,17 @@ void GammaRenderer::drawSettings(bool * show) {
     }
 
 
+    if (ImGui::CollapsingHeader("IBL")) {
+        const char* items[] = { "128", "256", "512", "1024" };
+        static int lutSizeIdx = 2;
+        static bool lutAnalytic = BrdfLUT::analytic();
+        bool changed = ImGui::Combo("BRDF LUT size", &lutSizeIdx, items, IM_ARRAYSIZE(items));
+        changed |= ImGui::Checkbox("Analytic BRDF fit", &lutAnalytic);
+        if (changed) {
+            BrdfLUT::configure(128 << lutSizeIdx, lutAnalytic);
+        }
+    }
+
     if (ImGui::CollapsingHeader("Tonemapping")) {
         ImGui::SliderFloat("Exposure", &tonemapExposure, 0.0f, 16.0f, "%.3f", 3.0f); // non-linear slider
         ImGui::RadioButton("Uncharted 2", &tonemapOp, 0); ImGui::SameLine();
@@ -7,6 +7,7 @@
 #include "Camera.hpp"
 #include "IBLMaps.hpp"
 #include "BloomPass.hpp"
+#include "RenderQueue.hpp"
 
 class GammaRenderer
 {
@@ -38,6 +39,13 @@ private:
     void createDefaultCubemap(GLProgram *prog);
     void setupFBO();
 
+    // Shading program the default cubemap was bound for
+    GLProgram *shadeProg = nullptr;
+
+    // Draws of the shading and shadow passes, storage reused between frames
+    RenderQueue shadeQueue;
+    RenderQueue shadowQueue;
+
     // Rendering statistics
     // Double buffered to avoid waiting for results
     #define NUM_STATS 3 // shadows, shading, post-processing
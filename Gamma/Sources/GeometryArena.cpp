@@ -0,0 +1,144 @@
+#include "GeometryArena.hpp"
+#include "Mesh.hpp"
+#include "RenderQueue.hpp"
+#include "utils.hpp"
+#include <algorithm>
+
+const size_t GeometryArena::MIN_CAPACITY;
+
+GeometryRange::~GeometryRange() {
+    arena->vertices.release(firstVertex, numVertices);
+    arena->indices.release(firstIndex, numIndices);
+}
+
+bool GeometryArena::Allocator::allocate(size_t count, size_t &offset) {
+    if (count == 0) {
+        offset = 0;
+        return true;
+    }
+
+    for (auto it = free.begin(); it != free.end(); ++it) {
+        if (it->second < count)
+            continue;
+
+        offset = it->first;
+        if (it->second > count)
+            free[offset + count] = it->second - count;
+        free.erase(it);
+        return true;
+    }
+    return false;
+}
+
+void GeometryArena::Allocator::release(size_t offset, size_t count) {
+    if (count == 0)
+        return;
+
+    // Merge with the free blocks on either side
+    auto next = free.lower_bound(offset);
+    if (next != free.end() && offset + count == next->first) {
+        count += next->second;
+        next = free.erase(next);
+    }
+    if (next != free.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == offset) {
+            prev->second += count;
+            return;
+        }
+    }
+    free[offset] = count;
+}
+
+GeometryArena& GeometryArena::get(bool packed, GLenum indexType) {
+    static GeometryArena *arenas[2][2] = {};
+    GeometryArena *&arena = arenas[packed ? 1 : 0][indexType == GL_UNSIGNED_SHORT ? 1 : 0];
+    if (!arena)
+        arena = new GeometryArena(packed, indexType);
+    return *arena;
+}
+
+GeometryArena::GeometryArena(bool packed, GLenum indexType) : packed(packed) {
+    vertexBytes = packed ? sizeof(PackedVertex) : sizeof(Vertex);
+    indexBytes = (indexType == GL_UNSIGNED_SHORT) ? sizeof(uint16_t) : sizeof(unsigned int);
+    setupVertexArray();
+}
+
+std::shared_ptr<GeometryRange> GeometryArena::allocate(size_t numVertices, size_t numIndices) {
+    std::shared_ptr<GeometryRange> range = std::make_shared<GeometryRange>();
+    range->arena = this;
+    range->numVertices = numVertices;
+    range->numIndices = numIndices;
+
+    if (!vertices.allocate(numVertices, range->firstVertex)) {
+        grow(VBO, vertices, vertexBytes, numVertices);
+        vertices.allocate(numVertices, range->firstVertex);
+    }
+    if (!indices.allocate(numIndices, range->firstIndex)) {
+        grow(EBO, indices, indexBytes, numIndices);
+        indices.allocate(numIndices, range->firstIndex);
+    }
+    return range;
+}
+
+void GeometryArena::write(const GeometryRange &range, const void *vertexData, const void *indexData) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, VBO.id);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, range.firstVertex * vertexBytes, range.numVertices * vertexBytes, vertexData);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, EBO.id);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, range.firstIndex * indexBytes, range.numIndices * indexBytes, indexData);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glCheckError();
+}
+
+void GeometryArena::grow(VertexBuffer &buffer, Allocator &alloc, size_t elementBytes, size_t count) {
+    // The free block at the end, if any, becomes part of the new space
+    size_t tailFree = 0;
+    if (!alloc.free.empty()) {
+        auto last = std::prev(alloc.free.end());
+        if (last->first + last->second == alloc.capacity)
+            tailFree = last->second;
+    }
+
+    const size_t capacity = std::max(std::max(alloc.capacity * 2, alloc.capacity + count - tailFree), MIN_CAPACITY);
+    GLuint grown = 0;
+    glGenBuffers(1, &grown);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+    glBufferData(GL_COPY_WRITE_BUFFER, capacity * elementBytes, nullptr, GL_STATIC_DRAW);
+    if (alloc.capacity > 0) {
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer.id);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, alloc.capacity * elementBytes);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glDeleteBuffers(1, &buffer.id);
+    buffer.id = grown;
+    glCheckError();
+
+    alloc.release(alloc.capacity, capacity - alloc.capacity);
+    alloc.capacity = capacity;
+    setupVertexArray();
+}
+
+void GeometryArena::setupVertexArray() {
+    VAO.bind();
+    glBindBuffer(GL_ARRAY_BUFFER, VBO.id);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO.id);
+
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+    if (packed) {
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, position));
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, normal));
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, texCoords));
+    }
+    else {
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texCoords));
+    }
+    RenderQueue::setupDrawIndex();
+    glCheckError();
+
+    VAO.unbind();
+}
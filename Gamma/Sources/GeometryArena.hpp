@@ -0,0 +1,91 @@
+#pragma once
+#include <glad/glad.h>
+#include <map>
+#include <memory>
+#include <cstddef>
+#include "GLWrappers.hpp"
+
+/*
+    Shared vertex and index buffers that meshes sub-allocate from.
+
+    There is one arena per vertex layout (Vertex or PackedVertex) and index
+    type. Its meshes share one vertex array and are drawn with baseVertex and
+    firstIndex offsets, so the render queue can put draws of different meshes
+    into the same indirect batch. Indices stay relative to the mesh, which
+    keeps 16-bit indices usable.
+
+    Free space is handed out first fit and merged with its neighbours when a
+    range is returned. A full arena doubles its buffers: the contents are
+    copied on the GPU and the vertex array is pointed at the new buffers.
+    Arenas live until exit, the driver frees their buffers with the context.
+
+    Must only be used on the thread that owns the GL context.
+*/
+
+class GeometryArena;
+
+// Vertices and indices of one mesh, given back to the arena when the last mesh using them goes away
+class GeometryRange {
+public:
+    ~GeometryRange();
+
+    GeometryArena *arena;
+    size_t firstVertex;
+    size_t numVertices;
+    size_t firstIndex;
+    size_t numIndices;
+    unsigned int pendingUploads = 0; // streamed parts not uploaded yet
+
+    bool resident() const { return pendingUploads == 0; }
+};
+
+class GeometryArena {
+public:
+    // Arena for a vertex layout and index type, created on first use
+    static GeometryArena& get(bool packed, GLenum indexType);
+
+    // Storage for a mesh, contents are undefined until written or streamed in
+    std::shared_ptr<GeometryRange> allocate(size_t numVertices, size_t numIndices);
+    void write(const GeometryRange &range, const void *vertices, const void *indices);
+
+    void bind() { VAO.bind(); }
+    GLuint vertexArray() const { return VAO.id; }
+    GLuint vertexBuffer() const { return VBO.id; }
+    GLuint indexBuffer() const { return EBO.id; }
+    size_t vertexSize() const { return vertexBytes; }
+    size_t indexSize() const { return indexBytes; }
+
+    GeometryArena(const GeometryArena&) = delete;
+    GeometryArena& operator=(const GeometryArena&) = delete;
+
+private:
+    friend class GeometryRange;
+
+    // First fit over [0, capacity), in elements
+    struct Allocator {
+        std::map<size_t, size_t> free; // size by offset
+        size_t capacity = 0;
+
+        bool allocate(size_t count, size_t &offset);
+        void release(size_t offset, size_t count);
+    };
+
+    GeometryArena(bool packed, GLenum indexType);
+    ~GeometryArena() = default;
+
+    // Grow the buffer behind alloc to hold at least count more elements
+    void grow(VertexBuffer &buffer, Allocator &alloc, size_t elementBytes, size_t count);
+    // Attribute pointers of the vertex array follow the current buffers
+    void setupVertexArray();
+
+    static const size_t MIN_CAPACITY = 1 << 16; // elements
+
+    bool packed;
+    size_t vertexBytes;
+    size_t indexBytes;
+    VertexArray VAO;
+    VertexBuffer VBO;
+    VertexBuffer EBO;
+    Allocator vertices;
+    Allocator indices;
+};
@@ -3,26 +3,44 @@
 #include "xxhash.h"
 #include "stb_image.h"
 #include "utils.hpp"
+#include "KTXFile.hpp"
+#include "VirtualFS.hpp"
 #include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+
+// Radiance roughness levels, rendered by createRadianceMap
+static const unsigned int RADIANCE_MIPS = 5;
 
 IBLMaps::IBLMaps(std::string mapName) {
     size_t hash = fileHash(mapName);
+    std::string cachePath = "Gamma/Assets/IBL/cached/" + std::to_string(hash) + ".ktx";
 
     // Try to load pre-processed environment
-    std::ifstream f("Gamma/Assets/IBL/cached/" + std::to_string(hash) + ".ktx");
-    if (f.good()) {
-        loadCached(f);
-    }
-    else {
-        process(mapName);
+    if (VFS::instance().exists(cachePath)) {
+        try {
+            BufferStream f(VFS::instance().read(cachePath));
+            loadCached(f);
+            return;
+        }
+        catch (std::runtime_error &e) {
+            std::cout << "Ignoring IBL cache: " << e.what() << std::endl;
+            release();
+        }
     }
+
+    process(mapName);
+    writeCache(cachePath);
 }
 
 IBLMaps::~IBLMaps() {
-    glDeleteTextures(1, &brdfMap);
+    release();
+}
+
+void IBLMaps::release() {
     glDeleteTextures(1, &radianceMap);
     glDeleteTextures(1, &irradianceMap);
     glDeleteTextures(1, &backgroundMap);
+    radianceMap = irradianceMap = backgroundMap = 0;
 }
 
 void IBLMaps::process(std::string path) {    
@@ -31,14 +49,20 @@ void IBLMaps::process(std::string path) {
     glGetIntegerv(GL_VIEWPORT, viweport);
     
     // Load HDR environment texture
-    stbi_set_flip_vertically_on_load(true);
+    // Flipped here instead of through stbi_set_flip_vertically_on_load,
+    // which is global state shared with the texture decoding threads
     int width, height, nrComponents;
-    float *data = stbi_loadf(path.c_str(), &width, &height, &nrComponents, 0);
-    stbi_set_flip_vertically_on_load(false);
+    FileBuffer file = VFS::instance().read(path);
+    float *data = stbi_loadf_from_memory(file.data, (int)file.size, &width, &height, &nrComponents, 0);
     if (!data) {
         throw std::runtime_error("Failed to load " + path);
     }
 
+    const size_t rowLen = (size_t)width * nrComponents;
+    for (int y = 0; y < height / 2; y++) {
+        std::swap_ranges(data + y * rowLen, data + (y + 1) * rowLen, data + (height - 1 - y) * rowLen);
+    }
+
     GLuint hdrTexture = 0;
     glGenTextures(1, &hdrTexture);
     glBindTexture(GL_TEXTURE_2D, hdrTexture);
@@ -70,9 +94,6 @@ void IBLMaps::process(std::string path) {
     // Convolve => radiance texture (specular)
     createRadianceMap();
 
-    // Create BRDF lookup texture (specular)
-    createBrdfLUT();
-
     // Reset state
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glDeleteFramebuffers(1, &FBO);
@@ -80,8 +101,48 @@ void IBLMaps::process(std::string path) {
     glViewport(viweport[0], viweport[1], viweport[2], viweport[3]);
 }
 
-void IBLMaps::loadCached(std::ifstream &stream) {
-    throw std::runtime_error("IBL cache loading not implemented");
+// Cache file: background, irradiance and radiance maps as consecutive KTX images
+void IBLMaps::loadCached(std::istream &stream) {
+    GLenum target;
+    auto setParams = [&target](GLenum minFilter) {
+        glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, minFilter);
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    };
+
+    // Only the base level is stored, mips are cheap to regenerate
+    backgroundMap = readKTX(stream, target);
+    if (target != GL_TEXTURE_CUBE_MAP)
+        throw std::runtime_error("Unexpected background map type");
+    glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, 1000);
+    setParams(GL_LINEAR_MIPMAP_LINEAR);
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+
+    irradianceMap = readKTX(stream, target);
+    if (target != GL_TEXTURE_CUBE_MAP)
+        throw std::runtime_error("Unexpected irradiance map type");
+    setParams(GL_LINEAR);
+
+    radianceMap = readKTX(stream, target);
+    GLint maxLevel;
+    glGetTexParameteriv(target, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+    if (target != GL_TEXTURE_CUBE_MAP || maxLevel != RADIANCE_MIPS - 1)
+        throw std::runtime_error("Unexpected radiance map layout");
+    setParams(GL_LINEAR_MIPMAP_LINEAR);
+
+    // Interpolation over cubemap edges, as in process()
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+    glCheckError();
+}
+
+void IBLMaps::writeCache(const std::string &path) {
+    writeFileAtomically(path, "IBL cache", [this](std::ofstream &out) {
+        return writeKTX(out, GL_TEXTURE_CUBE_MAP, backgroundMap, GL_RGB16F, GL_RGB, GL_HALF_FLOAT, 1) &&
+               writeKTX(out, GL_TEXTURE_CUBE_MAP, irradianceMap, GL_RGB16F, GL_RGB, GL_HALF_FLOAT, 1) &&
+               writeKTX(out, GL_TEXTURE_CUBE_MAP, radianceMap, GL_RGB16F, GL_RGB, GL_HALF_FLOAT, RADIANCE_MIPS);
+    });
 }
 
 // Get view matrix for looking at cubemap face i
@@ -210,7 +271,7 @@ void IBLMaps::createRadianceMap() {
     glCheckError();
 
     glBindFramebuffer(GL_FRAMEBUFFER, FBO);
-    unsigned int maxMipLevels = 5;
+    unsigned int maxMipLevels = RADIANCE_MIPS;
     for (unsigned int mip = 0; mip < maxMipLevels; mip++) {
         unsigned int mipWidth = 128 * std::pow(0.5, mip);
         unsigned int mipHeight = 128 * std::pow(0.5, mip);
@@ -230,25 +291,3 @@ void IBLMaps::createRadianceMap() {
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glCheckError();
 }
-
-void IBLMaps::createBrdfLUT() {
-    glGenTextures(1, &brdfMap);
-    glBindTexture(GL_TEXTURE_2D, brdfMap);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, 512, 512, 0, GL_RG, GL_FLOAT, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, RBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, brdfMap, 0);
-
-    glViewport(0, 0, 512, 512);
-    GLProgram *brdfProg = getProgram("IBL::BrdfLUT", "draw_tex_2d.vert", "ibl_calc_brdf_lut.frag");
-    brdfProg->use();
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    drawFullscreenQuad();
-    glCheckError();
-}
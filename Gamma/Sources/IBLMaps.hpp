@@ -2,6 +2,7 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <string>
+#include "BrdfLUT.hpp"
 
 class IBLMaps {
 public:
@@ -9,14 +10,16 @@ public:
     IBLMaps(std::string mapName);
     ~IBLMaps();
 
-    GLuint getBrdfLUT() { return brdfMap; }
+    GLuint getBrdfLUT() { return BrdfLUT::get(); } // shared by all environments
     GLuint getRadianceMap() { return radianceMap; }
     GLuint getIrradianceMap() { return irradianceMap; }
     GLuint getBackgroundMap() { return backgroundMap; }
 
 private:
     void process(std::string path);
-    void loadCached(std::ifstream &stream);
+    void loadCached(std::istream &stream);
+    void writeCache(const std::string &path);
+    void release();
 
     glm::mat4 lookAtFace(unsigned int i);
 
@@ -24,9 +27,7 @@ private:
     GLuint equirecToCubemap(GLuint srcTex);
     void createIrradianceMap();
     void createRadianceMap();
-    void createBrdfLUT();
 
-    GLuint brdfMap = 0;
     GLuint radianceMap = 0;
     GLuint irradianceMap = 0;
     GLuint backgroundMap = 0;
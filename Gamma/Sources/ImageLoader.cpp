@@ -0,0 +1,255 @@
+#include "ImageLoader.hpp"
+#include "VirtualFS.hpp"
+#include "ThreadPool.hpp"
+#include "utils.hpp"
+#include "KTXFile.hpp"
+#include "TextureCompression.hpp"
+#include <stb_image.h>
+#include <map>
+#include <mutex>
+#include <algorithm>
+#include <cstdint>
+
+// Decodes started ahead of time, consumed by decodeImageAsync
+static std::map<std::string, std::shared_future<ImageData>> prefetched;
+static std::mutex prefetchMutex;
+
+ImageData decodeImage(const std::string &path) {
+    ImageData image;
+    unsigned char *data = nullptr;
+
+    try {
+        FileBuffer file = VFS::instance().read(path);
+        data = stbi_load_from_memory(file.data, (int)file.size,
+            &image.width, &image.height, &image.channels, 0);
+    }
+    catch (std::runtime_error&) {
+        data = nullptr; // missing or unreadable file
+    }
+
+    if (!data) {
+        std::cout << "Image loading failed for: " << path << std::endl;
+        throw std::runtime_error("Failed to load image " + path);
+    }
+
+    image.pixels.reset(data, stbi_image_free);
+    return image;
+}
+
+// Pending prefetch of the path, invalid future if there is none
+static std::shared_future<ImageData> takePrefetched(const std::string &path) {
+    std::unique_lock<std::mutex> lock(prefetchMutex);
+    std::shared_future<ImageData> f;
+    auto match = prefetched.find(path);
+    if (match != prefetched.end()) {
+        f = match->second;
+        prefetched.erase(match);
+    }
+    return f;
+}
+
+std::shared_future<ImageData> decodeImageAsync(const std::string &path) {
+    std::shared_future<ImageData> f = takePrefetched(path);
+    if (f.valid())
+        return f;
+
+    return ThreadPool::shared().enqueue([path]() { return decodeImage(path); }).share();
+}
+
+// Bump whenever the encoders or the mip filter change
+static const uint32_t COMPRESSION_VERSION = 2;
+
+// Expand 1-4 channel image to RGBA (gray replicated, alpha opaque)
+static std::vector<unsigned char> toRGBA(const ImageData &image) {
+    const size_t numPixels = (size_t)image.width * image.height;
+    const int n = image.channels;
+    const unsigned char *src = image.pixels.get();
+    std::vector<unsigned char> out(4 * numPixels);
+    for (size_t i = 0; i < numPixels; i++) {
+        const unsigned char *p = src + i * n;
+        unsigned char *q = &out[4 * i];
+        q[0] = p[0];
+        q[1] = (n >= 3) ? p[1] : p[0];
+        q[2] = (n >= 3) ? p[2] : p[0];
+        q[3] = (n == 4) ? p[3] : (n == 2) ? p[1] : 255;
+    }
+    return out;
+}
+
+static ImageData loadMipmapped(const std::string &path, MipMode mode, std::shared_future<ImageData> decoded) {
+    ImageData src = decoded.valid() ? decoded.get() : decodeImage(path);
+
+    ImageData image;
+    image.width = src.width;
+    image.height = src.height;
+    image.channels = 4;
+    std::vector<unsigned char> rgba = toRGBA(src);
+    src.pixels.reset();
+    image.levels = std::make_shared<std::vector<std::vector<unsigned char>>>(generateMipChain(rgba.data(), image.width, image.height, mode));
+    return image;
+}
+
+ImageData loadMipmapped(const std::string &path, MipMode mode) {
+    return loadMipmapped(path, mode, std::shared_future<ImageData>());
+}
+
+std::shared_future<ImageData> loadMipmappedAsync(const std::string &path, MipMode mode) {
+    std::shared_future<ImageData> decoded = takePrefetched(path);
+    return ThreadPool::shared().enqueue([path, mode, decoded]() { return loadMipmapped(path, mode, decoded); }).share();
+}
+
+static std::string compressedCachePath(const std::string &path, GLenum format, MipMode mode) {
+    size_t parts[4] = { fileHash(path), (size_t)format, (size_t)mode, (size_t)COMPRESSION_VERSION };
+    return "Gamma/Assets/cached/" + std::to_string(computeHash(parts, sizeof(parts))) + ".ktx";
+}
+
+bool hasCompressedCache(const std::string &path, GLenum format, MipMode mode) {
+    try {
+        return VFS::instance().exists(compressedCachePath(path, format, mode));
+    }
+    catch (std::runtime_error&) {
+        return false;
+    }
+}
+
+// Every level as large as the format needs for its dimensions
+static bool validCompressedLevels(const ImageData &image) {
+    for (size_t level = 0; level < image.levels->size(); level++) {
+        const int w = std::max(1, image.width >> level), h = std::max(1, image.height >> level);
+        if ((*image.levels)[level].size() != TextureCompression::compressedSize(w, h, image.compressedFormat))
+            return false;
+    }
+    return true;
+}
+
+static ImageData loadCompressed(const std::string &path, GLenum format, MipMode mode, std::shared_future<ImageData> decoded) {
+    const std::string cachePath = compressedCachePath(path, format, mode);
+
+    ImageData image;
+    image.compressedFormat = format;
+    image.levels = std::make_shared<std::vector<std::vector<unsigned char>>>();
+
+    if (VFS::instance().exists(cachePath)) {
+        BufferStream in(VFS::instance().read(cachePath));
+        GLenum stored;
+        if (readCompressedKTX(in, stored, image.width, image.height, *image.levels) && stored == format && validCompressedLevels(image))
+            return image;
+
+        std::cout << "Ignoring compressed texture cache " << cachePath << std::endl;
+        image.levels->clear();
+    }
+
+    // Each RGBA8 level is dropped once compressed
+    ImageData mips = loadMipmapped(path, mode, decoded);
+    image.width = mips.width;
+    image.height = mips.height;
+    for (size_t level = 0; level < mips.levels->size(); level++) {
+        std::vector<unsigned char> &rgba = (*mips.levels)[level];
+        image.levels->push_back(TextureCompression::compress(rgba.data(),
+            std::max(1, image.width >> level), std::max(1, image.height >> level), format));
+        std::vector<unsigned char>().swap(rgba);
+    }
+
+    writeFileAtomically(cachePath, "compressed texture cache", [&image, format](std::ofstream &out) {
+        return writeCompressedKTX(out, format, TextureCompression::baseFormat(format), image.width, image.height, *image.levels);
+    });
+
+    return image;
+}
+
+std::shared_future<ImageData> loadCompressedAsync(const std::string &path, GLenum format, MipMode mode) {
+    // Reuse a pending prefetch, otherwise decode inline on the worker
+    std::shared_future<ImageData> decoded = takePrefetched(path);
+    return ThreadPool::shared().enqueue([path, format, mode, decoded]() { return loadCompressed(path, format, mode, decoded); }).share();
+}
+
+void prefetchImages(const std::vector<std::string> &paths) {
+    std::unique_lock<std::mutex> lock(prefetchMutex);
+    for (const std::string &path : paths) {
+        if (prefetched.find(path) == prefetched.end()) {
+            prefetched[path] = ThreadPool::shared().enqueue([path]() { return decodeImage(path); }).share();
+        }
+    }
+}
+
+void cancelPrefetch(const std::string &path) {
+    takePrefetched(path);
+}
+
+GLenum imageFormat(const ImageData &image) {
+    if (image.channels == 1)
+        return GL_RED;
+    else if (image.channels == 3)
+        return GL_RGB;
+    else if (image.channels == 4)
+        return GL_RGBA;
+    else
+        throw std::runtime_error("Unknown image format");
+}
+
+static GLenum sizedFormat(const ImageData &image) {
+    if (image.compressedFormat)
+        return image.compressedFormat;
+    else if (image.channels == 1)
+        return GL_R8;
+    else if (image.channels == 3)
+        return GL_RGB8;
+    else if (image.channels == 4)
+        return GL_RGBA8;
+    else
+        throw std::runtime_error("Unknown image format");
+}
+
+void allocateTextureStorage(const ImageData &image) {
+    const int numLevels = image.levels ? (int)image.levels->size() : 1;
+    const GLenum internalFormat = sizedFormat(image);
+
+    if (glSupports(4, 2, "GL_ARB_texture_storage")) {
+        glTexStorage2D(GL_TEXTURE_2D, numLevels, internalFormat, image.width, image.height);
+    }
+    else {
+        for (int level = 0; level < numLevels; level++) {
+            const int w = std::max(1, image.width >> level);
+            const int h = std::max(1, image.height >> level);
+            if (image.compressedFormat)
+                glCompressedTexImage2D(GL_TEXTURE_2D, level, internalFormat, w, h, 0, (GLsizei)(*image.levels)[level].size(), nullptr);
+            else
+                glTexImage2D(GL_TEXTURE_2D, level, internalFormat, w, h, 0, imageFormat(image), GL_UNSIGNED_BYTE, nullptr);
+        }
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+    glCheckError();
+}
+
+// Images without a precomputed chain get a single level
+unsigned int uploadTexture(const ImageData &image) {
+    const int numLevels = image.levels ? (int)image.levels->size() : 1;
+
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    allocateTextureStorage(image);
+
+    // Rows of 1- and 3-channel images are not 4-byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int level = 0; level < numLevels; level++) {
+        const int w = std::max(1, image.width >> level);
+        const int h = std::max(1, image.height >> level);
+        const unsigned char *data = image.levels ? (*image.levels)[level].data() : image.pixels.get();
+        if (image.compressedFormat)
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, w, h, image.compressedFormat, (GLsizei)(*image.levels)[level].size(), data);
+        else
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, w, h, imageFormat(image), GL_UNSIGNED_BYTE, data);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glCheckError();
+
+    return textureID;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <glad/glad.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include "MipGenerator.hpp"
+
+/*
+    Image decoding on the shared thread pool.
+
+    Files are memory mapped and decoded with stbi_load_from_memory on worker
+    threads. Only the GL upload happens on the thread that owns the context.
+*/
+
+// Decoded 8-bit image, or a full mip chain (RGBA8 or block compressed)
+struct ImageData {
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    std::shared_ptr<unsigned char> pixels; // freed with stbi_image_free
+
+    GLenum compressedFormat = 0;
+    std::shared_ptr<std::vector<std::vector<unsigned char>>> levels; // used instead of pixels when set
+};
+
+// Decode synchronously on the calling thread, throws on failure
+ImageData decodeImage(const std::string &path);
+
+// Decode on a worker thread, reuses a pending prefetch of the same path
+std::shared_future<ImageData> decodeImageAsync(const std::string &path);
+
+// Decode and build the RGBA8 mip chain, throws on failure
+ImageData loadMipmapped(const std::string &path, MipMode mode);
+std::shared_future<ImageData> loadMipmappedAsync(const std::string &path, MipMode mode);
+
+// Decode, build mips and block compress on a worker thread.
+// Results are cached on disk, keyed by file contents, format and mip mode.
+std::shared_future<ImageData> loadCompressedAsync(const std::string &path, GLenum format, MipMode mode);
+// A cached result exists, loading it needs no decode
+bool hasCompressedCache(const std::string &path, GLenum format, MipMode mode);
+
+// Start decoding images that will be requested later
+void prefetchImages(const std::vector<std::string> &paths);
+// Forget the prefetch of a path that will not be requested, its image is freed once decoded
+void cancelPrefetch(const std::string &path);
+
+// Matching GL pixel format, throws for unsupported channel counts
+GLenum imageFormat(const ImageData &image);
+
+// Storage for every level of the image on the bound GL_TEXTURE_2D, immutable where supported.
+// Contents are uploaded separately. Must be called on the context thread.
+void allocateTextureStorage(const ImageData &image);
+
+// Create GL texture from decoded image, must be called on the context thread
+unsigned int uploadTexture(const ImageData &image);
@@ -0,0 +1,220 @@
+#include "KTXFile.hpp"
+#include "utils.hpp"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+static const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+static const uint32_t KTX_ENDIANNESS = 0x04030201;
+
+struct KTXHeader {
+    unsigned char identifier[12];
+    uint32_t endianness;
+    uint32_t glType;
+    uint32_t glTypeSize;
+    uint32_t glFormat;
+    uint32_t glInternalFormat;
+    uint32_t glBaseInternalFormat;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t numberOfArrayElements;
+    uint32_t numberOfFaces;
+    uint32_t numberOfMipmapLevels;
+    uint32_t bytesOfKeyValueData;
+};
+
+static_assert(sizeof(KTXHeader) == 64, "Unexpected KTX header size");
+
+static size_t typeSize(GLenum type) {
+    switch (type) {
+    case GL_UNSIGNED_BYTE: return 1;
+    case GL_HALF_FLOAT: return 2;
+    case GL_FLOAT: return 4;
+    default: throw std::runtime_error("Unsupported KTX pixel type");
+    }
+}
+
+static size_t numComponents(GLenum format) {
+    switch (format) {
+    case GL_RED: return 1;
+    case GL_RG: return 2;
+    case GL_RGB: return 3;
+    case GL_RGBA: return 4;
+    default: throw std::runtime_error("Unsupported KTX pixel format");
+    }
+}
+
+static size_t imageSize(uint32_t width, uint32_t height, GLenum format, GLenum type) {
+    size_t rowBytes = width * numComponents(format) * typeSize(type);
+    return ((rowBytes + 3) & ~(size_t)3) * height;
+}
+
+bool writeKTX(std::ostream &out, GLenum target, GLuint texture, GLenum internalFormat, GLenum format, GLenum type, unsigned int numLevels) {
+    const bool cube = (target == GL_TEXTURE_CUBE_MAP);
+    const GLenum faceTarget = cube ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : target;
+
+    GLint width, height;
+    glBindTexture(target, texture);
+    glGetTexLevelParameteriv(faceTarget, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(faceTarget, 0, GL_TEXTURE_HEIGHT, &height);
+
+    KTXHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER));
+    h.endianness = KTX_ENDIANNESS;
+    h.glType = type;
+    h.glTypeSize = (uint32_t)typeSize(type);
+    h.glFormat = format;
+    h.glInternalFormat = internalFormat;
+    h.glBaseInternalFormat = format;
+    h.pixelWidth = width;
+    h.pixelHeight = height;
+    h.numberOfFaces = cube ? 6 : 1;
+    h.numberOfMipmapLevels = numLevels;
+    out.write((const char*)&h, sizeof(h));
+
+    // Face sizes are multiples of four, so no cube or mip padding is needed
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    std::vector<char> data;
+    for (unsigned int level = 0; level < numLevels; level++) {
+        uint32_t w = std::max(1, width >> level);
+        uint32_t hgt = std::max(1, height >> level);
+        uint32_t bytes = (uint32_t)imageSize(w, hgt, format, type);
+        out.write((const char*)&bytes, sizeof(bytes));
+
+        data.resize(bytes);
+        for (unsigned int face = 0; face < h.numberOfFaces; face++) {
+            glGetTexImage(faceTarget + face, level, format, type, data.data());
+            out.write(data.data(), bytes);
+        }
+    }
+    glCheckError();
+
+    return out.good();
+}
+
+GLuint readKTX(std::istream &in, GLenum &target) {
+    KTXHeader h;
+    in.read((char*)&h, sizeof(h));
+    if (!in || std::memcmp(h.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) || h.endianness != KTX_ENDIANNESS)
+        throw std::runtime_error("Not a KTX file");
+
+    if (h.pixelDepth > 1 || h.numberOfArrayElements > 0 || (h.numberOfFaces != 1 && h.numberOfFaces != 6) ||
+        h.glTypeSize != typeSize(h.glType) || h.pixelWidth == 0 || h.pixelHeight == 0)
+        throw std::runtime_error("Unsupported KTX layout");
+
+    in.seekg(h.bytesOfKeyValueData, std::ios::cur);
+
+    target = (h.numberOfFaces == 6) ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+    const GLenum faceTarget = (h.numberOfFaces == 6) ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : GL_TEXTURE_2D;
+    const uint32_t numLevels = std::max(1U, h.numberOfMipmapLevels);
+
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(target, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    std::vector<char> data;
+    for (uint32_t level = 0; level < numLevels; level++) {
+        uint32_t w = std::max(1U, h.pixelWidth >> level);
+        uint32_t hgt = std::max(1U, h.pixelHeight >> level);
+
+        uint32_t bytes;
+        in.read((char*)&bytes, sizeof(bytes));
+        if (!in || bytes != imageSize(w, hgt, h.glFormat, h.glType)) {
+            glDeleteTextures(1, &texture);
+            throw std::runtime_error("Corrupt KTX file");
+        }
+
+        data.resize(bytes);
+        for (uint32_t face = 0; face < h.numberOfFaces; face++) {
+            in.read(data.data(), bytes);
+            if (!in) {
+                glDeleteTextures(1, &texture);
+                throw std::runtime_error("Truncated KTX file");
+            }
+            glTexImage2D(faceTarget + face, level, h.glInternalFormat, w, hgt, 0, h.glFormat, h.glType, data.data());
+        }
+    }
+
+    glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+    glCheckError();
+
+    return texture;
+}
+
+bool writeCompressedKTX(std::ostream &out, GLenum internalFormat, GLenum baseFormat, int width, int height,
+                        const std::vector<std::vector<unsigned char>> &levels) {
+    KTXHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER));
+    h.endianness = KTX_ENDIANNESS;
+    h.glTypeSize = 1;
+    h.glInternalFormat = internalFormat;
+    h.glBaseInternalFormat = baseFormat;
+    h.pixelWidth = width;
+    h.pixelHeight = height;
+    h.numberOfFaces = 1;
+    h.numberOfMipmapLevels = (uint32_t)levels.size();
+    out.write((const char*)&h, sizeof(h));
+
+    // Compressed blocks are 8 or 16 bytes, no padding needed
+    for (const std::vector<unsigned char> &level : levels) {
+        uint32_t bytes = (uint32_t)level.size();
+        out.write((const char*)&bytes, sizeof(bytes));
+        out.write((const char*)level.data(), bytes);
+    }
+
+    return out.good();
+}
+
+bool readCompressedKTX(std::istream &in, GLenum &internalFormat, int &width, int &height,
+                       std::vector<std::vector<unsigned char>> &levels) {
+    KTXHeader h;
+    in.read((char*)&h, sizeof(h));
+    if (!in || std::memcmp(h.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) || h.endianness != KTX_ENDIANNESS)
+        return false;
+
+    if (h.glType != 0 || h.glFormat != 0 || h.numberOfFaces != 1 || h.pixelDepth > 1 || h.numberOfArrayElements > 0)
+        return false;
+
+    // No more levels than a full chain down to 1x1
+    uint32_t maxLevels = 1;
+    for (uint32_t size = std::max(h.pixelWidth, h.pixelHeight); size > 1; size >>= 1) {
+        maxLevels++;
+    }
+    if (h.pixelWidth == 0 || h.pixelHeight == 0 || h.numberOfMipmapLevels > maxLevels)
+        return false;
+
+    // Level sizes are checked against what is left before anything is allocated
+    in.seekg(h.bytesOfKeyValueData, std::ios::cur);
+    const std::streamoff start = in.tellg();
+    in.seekg(0, std::ios::end);
+    const std::streamoff end = in.tellg();
+    in.seekg(start);
+    if (!in || start < 0 || end < start)
+        return false;
+    uint64_t remaining = (uint64_t)(end - start);
+
+    internalFormat = h.glInternalFormat;
+    width = (int)h.pixelWidth;
+    height = (int)h.pixelHeight;
+    levels.resize(std::max(1U, h.numberOfMipmapLevels));
+    for (std::vector<unsigned char> &level : levels) {
+        uint32_t bytes;
+        in.read((char*)&bytes, sizeof(bytes));
+        if (!in || remaining < sizeof(bytes) + (uint64_t)bytes)
+            return false;
+        remaining -= sizeof(bytes) + bytes;
+
+        level.resize(bytes);
+        in.read((char*)level.data(), bytes);
+        if (!in)
+            return false;
+    }
+
+    return true;
+}
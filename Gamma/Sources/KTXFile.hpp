@@ -0,0 +1,28 @@
+#pragma once
+#include <glad/glad.h>
+#include <iostream>
+#include <vector>
+
+/*
+    Minimal KTX 1.1 reader and writer for uncompressed 2D textures and cube maps.
+
+    Rows are padded to four bytes (GL_PACK_ALIGNMENT / GL_UNPACK_ALIGNMENT 4)
+    as required by the format. Images are self-delimiting, so several of them
+    can be stored back to back in one stream.
+*/
+
+// Read back levels [0, numLevels) of a GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP and append them as one KTX image
+bool writeKTX(std::ostream &out, GLenum target, GLuint texture, GLenum internalFormat, GLenum format, GLenum type, unsigned int numLevels);
+
+// Create a texture from the next KTX image in the stream, throws if it is malformed.
+// Filtering and wrapping are left to the caller, GL_TEXTURE_MAX_LEVEL matches the stored levels.
+GLuint readKTX(std::istream &in, GLenum &target);
+
+// Block compressed mip chain kept on the CPU (e.g. for disk caches)
+bool writeCompressedKTX(std::ostream &out, GLenum internalFormat, GLenum baseFormat, int width, int height,
+                        const std::vector<std::vector<unsigned char>> &levels);
+
+// Returns false if the stream does not hold a compressed 2D KTX image, or if it is truncated.
+// Level sizes are as stored, the caller checks them against the format.
+bool readCompressedKTX(std::istream &in, GLenum &internalFormat, int &width, int &height,
+                       std::vector<std::vector<unsigned char>> &levels);
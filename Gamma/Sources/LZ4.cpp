@@ -0,0 +1,143 @@
+#include "LZ4.hpp"
+#include <cstdint>
+#include <cstring>
+
+namespace lz4 {
+
+static const size_t MIN_MATCH = 4;
+static const size_t LAST_LITERALS = 5;  // block always ends in at least this many literals
+static const size_t MATCH_LIMIT = 12;   // no match may start in the last 12 bytes
+static const size_t MAX_OFFSET = 65535;
+static const int HASH_BITS = 16;
+
+static uint32_t read32(const unsigned char *p) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+static uint32_t hash4(uint32_t v) {
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Lengths of 15 and up continue in extra bytes of 255
+static void writeLength(std::vector<unsigned char> &out, size_t len) {
+    while (len >= 255) {
+        out.push_back(255);
+        len -= 255;
+    }
+    out.push_back((unsigned char)len);
+}
+
+static void writeSequence(std::vector<unsigned char> &out, const unsigned char *literals, size_t numLiterals,
+                          size_t offset, size_t matchLength) {
+    const size_t ml = matchLength ? matchLength - MIN_MATCH : 0;
+    out.push_back((unsigned char)(((numLiterals < 15 ? numLiterals : 15) << 4) | (ml < 15 ? ml : 15)));
+    if (numLiterals >= 15)
+        writeLength(out, numLiterals - 15);
+    out.insert(out.end(), literals, literals + numLiterals);
+
+    if (matchLength) {
+        out.push_back((unsigned char)(offset & 0xFF));
+        out.push_back((unsigned char)(offset >> 8));
+        if (ml >= 15)
+            writeLength(out, ml - 15);
+    }
+}
+
+size_t compressBound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+std::vector<unsigned char> compress(const unsigned char *src, size_t n) {
+    std::vector<unsigned char> out;
+    out.reserve(compressBound(n));
+
+    size_t anchor = 0;
+    if (n > MATCH_LIMIT) {
+        std::vector<int64_t> table((size_t)1 << HASH_BITS, -1);
+        size_t i = 0;
+        while (i < n - MATCH_LIMIT) {
+            const uint32_t seq = read32(src + i);
+            const uint32_t h = hash4(seq);
+            const int64_t candidate = table[h];
+            table[h] = (int64_t)i;
+
+            if (candidate < 0 || i - (size_t)candidate > MAX_OFFSET || read32(src + candidate) != seq) {
+                i++;
+                continue;
+            }
+
+            size_t length = MIN_MATCH;
+            while (i + length < n - LAST_LITERALS && src[candidate + length] == src[i + length])
+                length++;
+
+            writeSequence(out, src + anchor, i - anchor, i - (size_t)candidate, length);
+            i += length;
+            anchor = i;
+        }
+    }
+
+    writeSequence(out, src + anchor, n - anchor, 0, 0);
+    return out;
+}
+
+bool decompress(const unsigned char *src, size_t n, unsigned char *dst, size_t dstSize) {
+    const unsigned char *ip = src;
+    const unsigned char *const iend = src + n;
+    unsigned char *op = dst;
+    unsigned char *const oend = dst + dstSize;
+
+    auto readLength = [&ip, iend](size_t &len) {
+        unsigned char b;
+        do {
+            if (ip >= iend)
+                return false;
+            b = *ip++;
+            len += b;
+        } while (b == 255);
+        return true;
+    };
+
+    while (ip < iend) {
+        const unsigned char token = *ip++;
+
+        size_t numLiterals = token >> 4;
+        if (numLiterals == 15 && !readLength(numLiterals))
+            return false;
+        if (numLiterals > (size_t)(iend - ip) || numLiterals > (size_t)(oend - op))
+            return false;
+        std::memcpy(op, ip, numLiterals);
+        ip += numLiterals;
+        op += numLiterals;
+
+        // The last sequence has no match
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return false;
+        const size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst))
+            return false;
+
+        size_t length = token & 15;
+        if (length == 15 && !readLength(length))
+            return false;
+        length += MIN_MATCH;
+        if (length > (size_t)(oend - op))
+            return false;
+
+        // Byte by byte, the match may overlap the output being written
+        const unsigned char *match = op - offset;
+        for (size_t k = 0; k < length; k++) {
+            op[k] = match[k];
+        }
+        op += length;
+    }
+
+    return op == oend;
+}
+
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+/*
+    LZ4 block format codec for packed archive entries.
+
+    Compatible with the reference block format (no frame header). The
+    compressor is a single-pass greedy matcher, good enough for offline
+    packing. Decompression checks every offset and length against the
+    buffers, so corrupt input fails instead of reading out of bounds.
+*/
+
+namespace lz4 {
+
+// Worst case compressed size for n input bytes
+size_t compressBound(size_t n);
+
+std::vector<unsigned char> compress(const unsigned char *src, size_t n);
+
+// Decompress into dst, which must be exactly the original size. Returns false on corrupt input.
+bool decompress(const unsigned char *src, size_t n, unsigned char *dst, size_t dstSize);
+
+}
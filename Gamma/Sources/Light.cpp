@@ -1,6 +1,8 @@
 #include "Light.hpp"
 #include "utils.hpp"
-#include "Scene.hpp"
+#include "RenderQueue.hpp"
+#include "UniformRing.hpp"
+#include "GLState.hpp"
 #include <glm/gtc/matrix_transform.hpp>
 
 bool Light::useVSM = true;
@@ -8,6 +10,10 @@ int Light::defaultRes = 1024;
 float Light::svmBleedFix = 0.2f;
 float Light::svmBlur = 1.0f;
 
+static const UniformID U_USE_VSM("useVSM");
+static const UniformID U_SOURCE_TEXTURE("sourceTexture");
+static const UniformID U_BLUR_SCALE("blurScale");
+
 PointLight::PointLight(glm::vec3 pos, glm::vec3 e) {
     this->vector = glm::vec4(pos, 1.0f);
     this->emission = e;
@@ -70,44 +76,39 @@ void PointLight::initShadowMap(glm::uvec2 dims) {
 }
 
 // Uses geometry shader to generate 6 cube faces in one render pass
-void PointLight::renderShadowMap(std::shared_ptr<Scene> scene) {
+void PointLight::renderShadowMap(RenderQueue &casters) {
     GLProgram* prog = getProgram("Render::shadowPoint", "shadowmap_point.vert",
                                  "shadowmap_point.geom", "shadowmap_point.frag");
 
     if (shadowMapDims.x == 0 || shadowMapDims.y == 0)
         return;
 
-    glViewport(0, 0, shadowMapDims.x, shadowMapDims.y);
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
+    GLState &gl = GLState::instance();
+    gl.viewport(0, 0, shadowMapDims.x, shadowMapDims.y);
+    gl.bindFramebuffer(shadowMapFBO);
     glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
 
     // Enable frontface culling to combat 'Peter Panning'
-    GLint cullingMode;
-    glGetIntegerv(GL_CULL_FACE_MODE, &cullingMode);
-    glCullFace(GL_FRONT);
+    const GLenum cullMode = gl.getCullFace();
+    gl.cullFace(GL_FRONT);
     prog->use();
 
-    // Geometry shader
-    prog->setUniform("shadowMatrices[0]", getLightTransform(0));
-    prog->setUniform("shadowMatrices[1]", getLightTransform(1));
-    prog->setUniform("shadowMatrices[2]", getLightTransform(2));
-    prog->setUniform("shadowMatrices[3]", getLightTransform(3));
-    prog->setUniform("shadowMatrices[4]", getLightTransform(4));
-    prog->setUniform("shadowMatrices[5]", getLightTransform(5));
-    glCheckError();
+    // Face transforms for the geometry shader, distance range for the fragment shader
+    ShadowData shadow = {};
+    for (int face = 0; face < 6; face++) {
+        shadow.shadowMatrices[face] = getLightTransform(face);
+    }
+    shadow.lightPos = glm::vec3(this->vector);
+    shadow.farPlane = 25.0f;
+    UniformRing::instance().bind(SHADOW_BLOCK, shadow);
 
-    // Fragment shader
-    prog->setUniform("lightPos", glm::vec3(this->vector));
-    prog->setUniform("farPlane", 25.0f);
-    prog->setUniform("useVSM", useVSM);
+    prog->setUniform(U_USE_VSM, useVSM);
     glCheckError();
 
-    for (Model &m : scene->models()) {
-        m.renderUnshaded(prog); // sets M in vertex shader
-    }
+    casters.submit(prog);
 
-    glCullFace(cullingMode);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    gl.cullFace(cullMode);
+    gl.bindFramebuffer(0);
     glCheckError();
 }
 
@@ -129,48 +130,47 @@ void PointLight::processShadowMap() {
     if (!useVSM) return;
 
     // Setup program
-    GLProgram* prog = getProgram("SVM::CubeBlur7x1", "shadowmap_point.vert", "cube_blur_gauss_7x1.geom", "cube_blur_gauss_7x1.frag");
+    GLProgram* prog = getProgram("SVM::CubeBlur7x1", "cube_blur_gauss_7x1.vert", "cube_blur_gauss_7x1.geom", "cube_blur_gauss_7x1.frag");
     prog->use();
-    prog->setUniform("M", glm::mat4(1.0f)); // identity (unit cube at origin)
 
     float aspect = (float)shadowMapDims.x / (float)shadowMapDims.y;
     float znear = 0.1f;
     float zfar = 25.0f;
     glm::mat4 P = glm::perspective(glm::radians(90.0f), aspect, znear, zfar);
 
-    prog->setUniform("shadowMatrices[0]", P * lookAtFace(0));
-    prog->setUniform("shadowMatrices[1]", P * lookAtFace(1));
-    prog->setUniform("shadowMatrices[2]", P * lookAtFace(2));
-    prog->setUniform("shadowMatrices[3]", P * lookAtFace(3));
-    prog->setUniform("shadowMatrices[4]", P * lookAtFace(4));
-    prog->setUniform("shadowMatrices[5]", P * lookAtFace(5));
+    // Unit cube at the origin, drawn without a model transform
+    ShadowData shadow = {};
+    for (int face = 0; face < 6; face++) {
+        shadow.shadowMatrices[face] = P * lookAtFace(face);
+    }
+    UniformRing::instance().bind(SHADOW_BLOCK, shadow);
 
-    prog->setUniform("sourceTexture", 0);
-    glActiveTexture(GL_TEXTURE0);
+    prog->setUniform(U_SOURCE_TEXTURE, 0);
     glCheckError();
 
     //glViewport(0, 0, shadowMapDims.x, shadowMapDims.y);
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+    GLState &gl = GLState::instance();
+    gl.bindFramebuffer(shadowMapFBO);
+    gl.setEnabled(GL_TEXTURE_CUBE_MAP_SEAMLESS, true);
 
     // Horizontal
-    glBindTexture(GL_TEXTURE_CUBE_MAP, momentMap); // src
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, momentMapTmp, 0); // dst
-    prog->setUniform("blurScale", glm::vec3(svmBlur / shadowMapDims.x, 0.0f, 0.0f));
+    gl.bindTexture(0, GL_TEXTURE_CUBE_MAP, momentMap); // src
+    gl.framebufferTexture(momentMapTmp); // dst
+    prog->setUniform(U_BLUR_SCALE, glm::vec3(svmBlur / shadowMapDims.x, 0.0f, 0.0f));
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     drawUnitCube();
     glCheckError();
 
     // Vertical
-    glBindTexture(GL_TEXTURE_CUBE_MAP, momentMapTmp); // src
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, momentMap, 0); // dst
-    prog->setUniform("blurScale", glm::vec3(0.0f, svmBlur / shadowMapDims.y, 0.0f));
+    gl.bindTexture(0, GL_TEXTURE_CUBE_MAP, momentMapTmp); // src
+    gl.framebufferTexture(momentMap); // dst
+    prog->setUniform(U_BLUR_SCALE, glm::vec3(0.0f, svmBlur / shadowMapDims.y, 0.0f));
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     drawUnitCube();
     glCheckError();
 
     // Restore state
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    gl.bindFramebuffer(0);
 }
 
 glm::mat4 PointLight::getLightTransform(int face) {
@@ -264,31 +264,31 @@ void DirectionalLight::initShadowMap(glm::uvec2 dims) {
     }
 }
 
-void DirectionalLight::renderShadowMap(std::shared_ptr<Scene> scene) {
+void DirectionalLight::renderShadowMap(RenderQueue &casters) {
     GLProgram* prog = getProgram("Render::shadowDir", "shadowmap_dir.vert", "shadowmap_dir.frag");
     
     if (shadowMapDims.x == 0 || shadowMapDims.y == 0)
         return;
 
-    glViewport(0, 0, shadowMapDims.x, shadowMapDims.y);
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
+    GLState &gl = GLState::instance();
+    gl.viewport(0, 0, shadowMapDims.x, shadowMapDims.y);
+    gl.bindFramebuffer(shadowMapFBO);
     glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
     
     // Enable frontface culling to combat 'Peter Panning'
-    GLint cullingMode;
-    glGetIntegerv(GL_CULL_FACE_MODE, &cullingMode);
-    glCullFace(GL_FRONT);
+    const GLenum cullMode = gl.getCullFace();
+    gl.cullFace(GL_FRONT);
 
+    ShadowData shadow = {};
+    shadow.lightSpaceMatrix = getLightTransform();
+    UniformRing::instance().bind(SHADOW_BLOCK, shadow);
     prog->use();
-    prog->setUniform("lightSpaceMatrix", getLightTransform());
     glCheckError();
 
-    for (Model &m : scene->models()) {
-        m.renderUnshaded(prog); // sets uniform named M in shader
-    }
+    casters.submit(prog);
 
-    glCullFace(cullingMode);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    gl.cullFace(cullMode);
+    gl.bindFramebuffer(0);
     glCheckError();
 }
 
@@ -299,12 +299,12 @@ void DirectionalLight::processShadowMap() {
     prog->use();
 
     // Horizontal
-    prog->setUniform("blurScale", glm::vec2(svmBlur / shadowMapDims.x, 0.0f));
+    prog->setUniform(U_BLUR_SCALE, glm::vec2(svmBlur / shadowMapDims.x, 0.0f));
     applyFilter(prog, momentMap, momentMapTmp, shadowMapFBO);
     glCheckError();
 
     // Vertical
-    prog->setUniform("blurScale", glm::vec2(0.0f, svmBlur / shadowMapDims.y));
+    prog->setUniform(U_BLUR_SCALE, glm::vec2(0.0f, svmBlur / shadowMapDims.y));
     applyFilter(prog, momentMapTmp, momentMap, shadowMapFBO);
     glCheckError();
 }
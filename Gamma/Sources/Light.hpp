@@ -4,7 +4,7 @@
 #include <glad/glad.h>
 #include "utils.hpp"
 
-class Scene;
+class RenderQueue;
 class Light {
 public:
 
@@ -19,7 +19,8 @@ public:
     bool isDir() { return vector.w == 0.0f; }
 
     virtual void initShadowMap(glm::uvec2 dims = glm::uvec2(defaultRes)) = 0;
-    virtual void renderShadowMap(std::shared_ptr<Scene> scene) = 0;
+    // Casters are uploaded once per frame and drawn into every shadow map
+    virtual void renderShadowMap(RenderQueue &casters) = 0;
     virtual void processShadowMap() = 0;
     virtual glm::mat4 getLightTransform(int face = 0) = 0; // TODO: cache result!
 
@@ -52,7 +53,7 @@ public:
     PointLight(void) : Light() {}
     PointLight(glm::vec3 pos, glm::vec3 e);
     void initShadowMap(glm::uvec2 dims = glm::uvec2(defaultRes)) override;
-    void renderShadowMap(std::shared_ptr<Scene> scene) override;
+    void renderShadowMap(RenderQueue &casters) override;
     void processShadowMap() override;
     glm::mat4 getLightTransform(int face = 0) override;
 };
@@ -62,7 +63,7 @@ public:
     DirectionalLight(void) : Light() {}
     DirectionalLight(glm::vec3 dir, glm::vec3 e);
     void initShadowMap(glm::uvec2 dims = glm::uvec2(defaultRes)) override;
-    void renderShadowMap(std::shared_ptr<Scene> scene) override;
+    void renderShadowMap(RenderQueue &casters) override;
     void processShadowMap() override;
     glm::mat4 getLightTransform(int face = 0) override;
 };
\ No newline at end of file
@@ -0,0 +1,87 @@
+#include "MappedFile.hpp"
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string &path) {
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Failed to open file " + path);
+    }
+
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file, &fileSize);
+    fileHandle = file;
+    length = (size_t)fileSize.QuadPart;
+
+    // Zero-length files cannot be mapped
+    if (length == 0)
+        return;
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) {
+        CloseHandle(file);
+        throw std::runtime_error("Failed to map file " + path);
+    }
+
+    mappingHandle = mapping;
+    ptr = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!ptr) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        throw std::runtime_error("Failed to map file " + path);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (ptr) UnmapViewOfFile(ptr);
+    if (mappingHandle) CloseHandle((HANDLE)mappingHandle);
+    if (fileHandle) CloseHandle((HANDLE)fileHandle);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string &path) {
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open file " + path);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("Failed to stat file " + path);
+    }
+
+    // Zero-length files cannot be mapped
+    length = (size_t)st.st_size;
+    if (length == 0)
+        return;
+
+    void *addr = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("Failed to map file " + path);
+    }
+
+    ptr = (const unsigned char*)addr;
+}
+
+MappedFile::~MappedFile() {
+    if (ptr) munmap((void*)ptr, length);
+    if (fd >= 0) close(fd);
+}
+
+#endif
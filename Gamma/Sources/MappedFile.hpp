@@ -0,0 +1,28 @@
+#pragma once
+#include <string>
+#include <cstddef>
+
+/* Read-only memory mapping of a file on the disk */
+
+class MappedFile {
+public:
+    MappedFile(const std::string &path);
+    ~MappedFile();
+
+    const unsigned char* data() const { return ptr; }
+    size_t size() const { return length; }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+private:
+    const unsigned char *ptr = nullptr;
+    size_t length = 0;
+
+#ifdef _WIN32
+    void *fileHandle = nullptr;
+    void *mappingHandle = nullptr;
+#else
+    int fd = -1;
+#endif
+};
@@ -1,13 +1,24 @@
 #include "Mesh.hpp"
 #include "utils.hpp"
+#include "ResourceRegistry.hpp"
+#include "UploadQueue.hpp"
+#include "GLState.hpp"
 #include <glad/glad.h>
+#include <glm/gtc/packing.hpp>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
 
-Mesh::Mesh(vector<Vertex>& vertices, vector<unsigned int>& indices) {
-    this->vertices = vertices;
-    this->indices = indices;
-    this->material = Material();
-    init();
-}
+bool Mesh::compactVertices = true; // static
+bool Mesh::clusterCulling = true; // static
+size_t Mesh::meshletsDrawn = 0; // static
+size_t Mesh::meshletsCulled = 0; // static
+
+static const UniformID U_PACKED_NORMALS("packedNormals");
+
+Mesh::Mesh(vector<Vertex>& vertices, vector<unsigned int>& indices) :
+    Mesh(vertices.data(), vertices.size(), indices.data(), indices.size(), GL_UNSIGNED_INT, calculateAABB(vertices), Material(), nullptr) {}
 
 Mesh::Mesh(vector<Vertex>& vertices, vector<unsigned int>& indices, Material mat) : Mesh(vertices, indices) {
     this->material = mat;
@@ -24,6 +35,32 @@ Mesh::Mesh(vector<Vertex> &vertices, vector<unsigned int> &indices,
     setTextures(textures);
 }
 
+// Without an owner the data is uploaded immediately and can be released (or unmapped) once the constructor returns.
+// With an owner it is streamed in by the upload queue, which keeps the owner alive until then.
+Mesh::Mesh(const Vertex *vertices, size_t numVertices, const void *indices, size_t numIndices, GLenum indexType, AABB bounds, Material mat,
+           std::shared_ptr<const void> owner) {
+    this->aabb = bounds;
+    this->material = mat;
+
+    // Streamed data is packed ahead of time, if at all (see Model::readSource)
+    if (compactVertices && !owner && numVertices > 0) {
+        vector<PackedVertex> compact = pack(vertices, numVertices, bounds);
+        this->packed = true;
+        init(compact.data(), numVertices, numVertices * sizeof(PackedVertex), indices, numIndices, indexType, owner);
+        return;
+    }
+
+    init(vertices, numVertices, numVertices * sizeof(Vertex), indices, numIndices, indexType, owner);
+}
+
+Mesh::Mesh(const PackedVertex *vertices, size_t numVertices, const void *indices, size_t numIndices, GLenum indexType, AABB bounds, Material mat,
+           std::shared_ptr<const void> owner) {
+    this->aabb = bounds;
+    this->material = mat;
+    this->packed = true;
+    init(vertices, numVertices, numVertices * sizeof(PackedVertex), indices, numIndices, indexType, owner);
+}
+
 Mesh Mesh::Plane(float w, float h) {
     const float x = w / 2.0f;
     const float y = h / 2.0f;
@@ -39,71 +76,185 @@ Mesh Mesh::Plane(float w, float h) {
     return Mesh(verts, inds);
 }
 
-void Mesh::init() {
-    calculateAABB();
+// Positions map the unit cube onto the AABB, flat dimensions stay at the minimum
+vector<PackedVertex> Mesh::pack(const Vertex *vertices, size_t numVertices, const AABB &bounds) {
+    const glm::vec3 extent = bounds.maxs - bounds.mins;
+    glm::vec3 scale;
+    for (int c = 0; c < 3; c++) {
+        scale[c] = (extent[c] > 0.0f) ? 65535.0f / extent[c] : 0.0f;
+    }
 
-    VAO.reset(new VertexArray());
-    VBO.reset(new VertexBuffer());
-    EBO.reset(new VertexBuffer());
+    vector<PackedVertex> out(numVertices);
+    for (size_t i = 0; i < numVertices; i++) {
+        const Vertex &v = vertices[i];
+        PackedVertex &p = out[i];
 
-    VAO->bind();
-    glBindBuffer(GL_ARRAY_BUFFER, VBO->id);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
-    glCheckError();
+        const glm::vec3 q = glm::clamp((v.position - bounds.mins) * scale, 0.0f, 65535.0f) + 0.5f;
+        p.position[0] = (uint16_t)q.x;
+        p.position[1] = (uint16_t)q.y;
+        p.position[2] = (uint16_t)q.z;
+        p.position[3] = 0;
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO->id);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
-    glCheckError();
+        // Project onto the octahedron, fold the lower half over the diagonals
+        glm::vec3 n = v.normal / glm::max(std::abs(v.normal.x) + std::abs(v.normal.y) + std::abs(v.normal.z), 1e-20f);
+        glm::vec2 oct(n.x, n.y);
+        if (n.z < 0.0f) {
+            oct.x = (1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+            oct.y = (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+        }
 
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
-    glCheckError();
+        const uint32_t normal = glm::packSnorm2x16(oct);
+        const uint32_t texCoords = glm::packHalf2x16(v.texCoords);
+        std::memcpy(p.normal, &normal, sizeof(p.normal));
+        std::memcpy(p.texCoords, &texCoords, sizeof(p.texCoords));
+    }
 
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
-    glCheckError();
+    return out;
+}
+
+void Mesh::init(const void *vertices, size_t numVertices, size_t vertexBytes, const void *indices, size_t numIndices, GLenum indexType,
+                std::shared_ptr<const void> owner) {
+    this->numIndices = (GLsizei)numIndices;
+
+    // Narrow 32-bit indices when the vertices allow it, streamed ones stay alive with the upload
+    shared_ptr<vector<uint16_t>> narrowed;
+    if (indexType == GL_UNSIGNED_INT && numVertices <= MAX_SHORT_VERTICES) {
+        const unsigned int *wide = static_cast<const unsigned int*>(indices);
+        narrowed = std::make_shared<vector<uint16_t>>(wide, wide + numIndices);
+        indices = narrowed->data();
+        indexType = GL_UNSIGNED_SHORT;
+    }
+    this->indexType = indexType;
 
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texCoords));
-    glCheckError();
+    const size_t indexBytes = numIndices * (indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int));
 
-    VAO->unbind();
+    // Reuse the arena range of identical geometry
+    ResourceRegistry &registry = ResourceRegistry::instance();
+    const size_t key = ResourceRegistry::geometryKey(vertices, vertexBytes, indices, indexBytes);
+    if (registry.findGeometry(key, geometry))
+        return;
+
+    geometry = GeometryArena::get(packed, indexType).allocate(numVertices, numIndices);
+    registry.addGeometry(key, geometry, vertexBytes + indexBytes);
+
+    // Streamed ranges are filled by the upload queue
+    if (owner) {
+        UploadQueue::instance().enqueueGeometry(geometry, false, owner, vertices);
+        UploadQueue::instance().enqueueGeometry(geometry, true, narrowed ? narrowed : owner, indices);
+    }
+    else {
+        geometry->arena->write(*geometry, vertices, indices);
+    }
 }
 
-void Mesh::setupGGXParams(GLProgram *prog) {
-    // Set uniforms
-    prog->setUniform("Kd", material.Kd);
-    prog->setUniform("metallic", material.metallic);
-    prog->setUniform("shininess", material.alpha);
-    prog->setUniform("texMask", material.texMask);
-    glCheckError();
+unsigned int Mesh::residentTextures() const {
+    unsigned int texMask = material.texMask;
+    for (const std::shared_ptr<Texture> &t : textures) {
+        if (!t->resident) texMask &= ~(unsigned int)t->type;
+    }
+    return texMask;
+}
+
+void Mesh::bindTextures() {
+    // Set textures, meshes sharing them skip the binds
+    GLState &gl = GLState::instance();
+    for (const std::shared_ptr<Texture> &t : textures) {
+        if (!t->resident)
+            continue;
 
-    // Set textures
-    for (std::shared_ptr<Texture> t : textures) {
+        unsigned int unit = 31; // don't overwrite anything!
         if (t->type == TextureMask::DIFFUSE)
-            glActiveTexture(GL_TEXTURE0);
+            unit = 0;
         else if (t->type == TextureMask::NORMAL)
-            glActiveTexture(GL_TEXTURE1);
+            unit = 1;
         else if (t->type == TextureMask::SHININESS)
-            glActiveTexture(GL_TEXTURE2);
+            unit = 2;
         else if (t->type == TextureMask::ROUGHNESS)
-            glActiveTexture(GL_TEXTURE2); // same as shininess
+            unit = 2; // same as shininess
         else if (t->type == TextureMask::METALLIC)
-            glActiveTexture(GL_TEXTURE3);
-        else
-            glActiveTexture(GL_TEXTURE31); // don't overwrite anything!
+            unit = 3;
+
+        gl.bindTexture(unit, GL_TEXTURE_2D, t->id);
+    }
+}
+
+// Outside the frustum, or every triangle facing away from the camera
+bool Mesh::isVisible(const Meshlet &m, const ClusterView &view) {
+    for (const glm::vec4 &p : view.planes) {
+        const glm::vec3 n(p);
+        if (glm::dot(n, m.center) + p.w < -m.radius * glm::length(n))
+            return false;
+    }
 
-        glBindTexture(GL_TEXTURE_2D, t->id);
+    if (view.cullBackfaces) {
+        const glm::vec3 d = m.center - view.position;
+        if (glm::dot(d, m.coneAxis) >= m.coneCutoff * glm::length(d) + m.radius)
+            return false;
     }
-    
-    glActiveTexture(GL_TEXTURE0);
+
+    return true;
+}
+
+size_t Mesh::selectLOD(float maxError) const {
+    size_t lod = 0;
+    while (lod + 1 < lods.size() && lods[lod + 1].error <= maxError)
+        lod++;
+    return lod;
+}
+
+void Mesh::bindGeometry(GLProgram *prog) {
+    // Programs without normals skip packedNormals
+    prog->setUniform(U_PACKED_NORMALS, (int)packed);
+
+    // Left bound after drawing, meshes in the same arena skip the bind
+    geometry->arena->bind();
 }
 
-void Mesh::render(GLProgram * prog) {
-    VAO->bind();
-    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-    glCheckError();
-    VAO->unbind();
+void Mesh::positionDecode(glm::vec3 &scale, glm::vec3 &offset) const {
+    scale = packed ? aabb.maxs - aabb.mins : glm::vec3(1.0f);
+    offset = packed ? aabb.mins : glm::vec3(0.0f);
+}
+
+void Mesh::appendDraws(vector<DrawCommand> &commands, size_t lod, const ClusterView *view, GLuint drawIndex) const {
+    // Geometry still streaming in
+    if (!geometry || !geometry->resident())
+        return;
+
+    // Offsets within the arena, indices stay relative to the first vertex
+    const GLuint base = (GLuint)geometry->firstIndex;
+    const GLint baseVertex = (GLint)geometry->firstVertex;
+
+    GLuint count = (GLuint)numIndices;
+    GLuint first = 0;
+    if (!lods.empty()) {
+        lod = std::min(lod, lods.size() - 1);
+        count = lods[lod].numIndices;
+        first = lods[lod].firstIndex;
+    }
+
+    if (view && clusterCulling && lod == 0 && !meshlets.empty()) {
+        size_t end = SIZE_MAX; // end of the last range, to merge neighbours
+        for (const Meshlet &m : meshlets) {
+            if (!isVisible(m, *view)) {
+                meshletsCulled++;
+                continue;
+            }
+
+            meshletsDrawn++;
+            if (m.firstIndex == end) {
+                commands.back().count += m.numIndices;
+            }
+            else {
+                DrawCommand c = { m.numIndices, 1, base + m.firstIndex, baseVertex, drawIndex };
+                commands.push_back(c);
+            }
+            end = m.firstIndex + m.numIndices;
+        }
+    }
+    else {
+        DrawCommand c = { count, 1, base + first, baseVertex, drawIndex };
+        commands.push_back(c);
+    }
 }
 
 // Set textures, update mask
@@ -111,47 +262,102 @@ void Mesh::setTextures(vector<shared_ptr<Texture>> v) {
     this->textures = v;
     material.texMask = (TextureMask)0;
     std::for_each(v.begin(), v.end(), [&](shared_ptr<Texture> &t) { material.texMask |= t->type; });
+
+    // Texture sets are numbered by identity of the textures. Sets with a freed texture give their
+    // number back before any lookup, so an address reused by a new texture never finds an old set.
+    struct TextureSet {
+        vector<std::weak_ptr<Texture>> textures;
+        unsigned int id;
+    };
+    static std::map<vector<const Texture*>, TextureSet> textureSets;
+    static vector<unsigned int> freeIDs;
+    for (auto it = textureSets.begin(); it != textureSets.end();) {
+        bool freed = false;
+        for (const std::weak_ptr<Texture> &t : it->second.textures) {
+            freed = freed || t.expired();
+        }
+        if (freed) {
+            freeIDs.push_back(it->second.id);
+            it = textureSets.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    vector<const Texture*> set;
+    for (const shared_ptr<Texture> &t : v) {
+        set.push_back(t.get());
+    }
+    std::sort(set.begin(), set.end());
+    if (set.empty()) {
+        textureSetID = 0;
+        return;
+    }
+    auto found = textureSets.find(set);
+    if (found == textureSets.end()) {
+        TextureSet entry;
+        entry.textures.assign(v.begin(), v.end());
+        if (freeIDs.empty()) {
+            entry.id = (unsigned int)textureSets.size() + 1;
+        }
+        else {
+            entry.id = freeIDs.back();
+            freeIDs.pop_back();
+        }
+        found = textureSets.insert(std::make_pair(set, entry)).first;
+    }
+    textureSetID = found->second.id;
 }
 
 // Load Unreal Engine style PBR textures, available e.g. at freepbr.com
 void Mesh::loadPBRTextures(std::map<std::string, std::string> &paths) {
-    std::vector<shared_ptr<Texture>> textures;
+    setTextures(createPBRTextures(paths));
+}
 
-    auto add = [&](std::string path, TextureMask mask) {
-        try {
-            shared_ptr<Texture> tex = std::make_shared<Texture>();
-            tex->path = path;
-            tex->type = mask;
-            tex->id = textureFromFile(tex->path);
-            textures.push_back(tex);
-        }
-        catch (std::runtime_error e) {
-            std::cout << "PBR rexture missing: '" + path << "'" << std::endl;
-        }
+// Maps are decoded concurrently and uploaded over the following frames, files already in use are shared
+vector<shared_ptr<Texture>> Mesh::createPBRTextures(std::map<std::string, std::string> &paths) {
+    const std::pair<std::string, TextureMask> maps[] = {
+        { "albedo", TextureMask::DIFFUSE },
+        { "roughness", TextureMask::ROUGHNESS },
+        { "normal", TextureMask::NORMAL },
+        { "metallic", TextureMask::METALLIC }
     };
 
-    add(paths["albedo"], TextureMask::DIFFUSE);
-    add(paths["roughness"], TextureMask::ROUGHNESS);
-    add(paths["normal"], TextureMask::NORMAL);
-    add(paths["metallic"], TextureMask::METALLIC);
+    std::vector<shared_ptr<Texture>> textures;
+    for (auto &m : maps) {
+        if (paths.find(m.first) == paths.end())
+            continue;
 
-    setTextures(textures);
+        shared_ptr<Texture> tex = ResourceRegistry::instance().getTexture(paths[m.first], m.second);
+        if (tex)
+            textures.push_back(tex);
+    }
+
+    return textures;
 }
 
 // Load PBR textures with default naming
 void Mesh::loadPBRTextures(std::string path) {
+    std::map<std::string, std::string> paths = defaultPBRPaths(path);
+    loadPBRTextures(paths);
+}
+
+std::map<std::string, std::string> Mesh::defaultPBRPaths(std::string path) {
     std::map<std::string, std::string> paths;
     paths["albedo"] = path + "/albedo.png";
     paths["roughness"] = path + "/roughness.png";
     paths["normal"] = path + "/normal.png";
     paths["metallic"] = path + "/metallic.png";
-    loadPBRTextures(paths);
+    return paths;
 }
 
-void Mesh::calculateAABB() {
-    for (Vertex &v : vertices) {
-        aabb.expand(v.position);
+AABB Mesh::calculateAABB(const vector<Vertex> &vertices) {
+    AABB box;
+    for (const Vertex &v : vertices) {
+        box.expand(v.position);
     }
+    return box;
 }
 
 
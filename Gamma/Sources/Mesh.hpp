@@ -3,11 +3,12 @@
 #include <string>
 #include <memory>
 #include <map>
+#include <cstdint>
 #include <glm/glm.hpp>
 #include "Material.hpp"
 #include "GLProgram.hpp"
 #include "AABB.hpp"
-#include "GLWrappers.hpp"
+#include "GeometryArena.hpp"
 
 using std::vector;
 using std::shared_ptr;
@@ -18,12 +19,54 @@ typedef struct {
     glm::vec2 texCoords;
 } Vertex;
 
+// Compact vertex layout, half the size of Vertex. Decoded in vertex_decode.glh and draw_data.glh.
+typedef struct {
+    uint16_t position[4];  // xyz as fractions of the mesh AABB, w unused
+    int16_t normal[2];     // octahedral encoding
+    uint16_t texCoords[2]; // half floats
+} PackedVertex;
+
+// Range of the index buffer drawn at one level of detail
+typedef struct {
+    uint32_t firstIndex;
+    uint32_t numIndices;
+    float error; // largest distance from the full mesh, in object space
+} MeshLOD;
+
+// Cluster of triangles in the full detail level, culled on its own
+typedef struct {
+    uint32_t firstIndex;
+    uint32_t numIndices;
+    glm::vec3 center;    // bounding sphere, object space
+    float radius;
+    glm::vec3 coneAxis;  // average facing direction
+    float coneCutoff;    // sine of the normal spread, > 1 if it cannot be culled as backfacing
+} Meshlet;
+
+// Arguments of one indirect draw, in the layout GL reads from GL_DRAW_INDIRECT_BUFFER
+typedef struct {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance; // selects the per draw data (RenderQueue.hpp)
+} DrawCommand;
+
+// Camera in the object space of the model being drawn
+typedef struct {
+    glm::vec4 planes[6];  // frustum planes facing inwards, not normalized
+    glm::vec3 position;
+    bool cullBackfaces;   // back faces culled by GL, perspective camera and a transform that keeps the winding
+} ClusterView;
+
 class Texture {
 public:
     Texture(void) :
         id(0),
         type((TextureMask)0),
-        path("")
+        path(""),
+        resident(true),
+        bytes(0)
     {};
     ~Texture() {
         std::cout << "Freeing GL texture for " << path << std::endl;
@@ -36,6 +79,8 @@ public:
     unsigned int id;
     TextureMask type;
     std::string path; // for detecting duplicates
+    bool resident; // false until the mip tail has been uploaded, finer levels may still be streaming
+    size_t bytes;  // GPU size including mips, 0 until the image has been decoded
 };
 
 class Mesh
@@ -45,33 +90,80 @@ public:
     Mesh(vector<Vertex> &vertices, vector<unsigned int> &indices, Material mat);
     Mesh(vector<Vertex> &vertices, vector<unsigned int> &indices, vector<shared_ptr<Texture>> &textures);
     Mesh(vector<Vertex> &vertices, vector<unsigned int> &indices, vector<shared_ptr<Texture>> &textures, Material mat);
+    // indexType is GL_UNSIGNED_INT or GL_UNSIGNED_SHORT
+    Mesh(const Vertex *vertices, size_t numVertices, const void *indices, size_t numIndices, GLenum indexType, AABB bounds, Material mat,
+         std::shared_ptr<const void> owner = nullptr);
+    Mesh(const PackedVertex *vertices, size_t numVertices, const void *indices, size_t numIndices, GLenum indexType, AABB bounds, Material mat,
+         std::shared_ptr<const void> owner = nullptr);
     ~Mesh() = default;
     
-    void setupGGXParams(GLProgram *prog);
-    void render(GLProgram *prog);
+    // Material texture mask without the textures still being uploaded, the constants stand in for them
+    unsigned int residentTextures() const;
+    void bindTextures();
+    // Normal decoding and vertex array, the same for all meshes in the arena
+    void bindGeometry(GLProgram *prog);
+    // Maps stored positions to object space, identity for float vertices. Per mesh rather than
+    // per buffer: packed copies of a moved or scaled mesh have the same bytes and share buffers.
+    void positionDecode(glm::vec3 &scale, glm::vec3 &offset) const;
+    // Commands drawing one level of detail with the data at drawIndex, none while the geometry is streaming.
+    // Meshlets are culled against view, if given, when drawing the full level.
+    void appendDraws(vector<DrawCommand> &commands, size_t lod, const ClusterView *view, GLuint drawIndex) const;
+    GLenum getIndexType() const { return indexType; }
 
     void setMaterial(Material m) { material = m; };
     Material& getMaterial() { return material; };
     void setTextures(vector<shared_ptr<Texture>> v);
     void loadPBRTextures(std::map<std::string, std::string> &paths);
     void loadPBRTextures(std::string path);
+    static vector<shared_ptr<Texture>> createPBRTextures(std::map<std::string, std::string> &paths);
+    static std::map<std::string, std::string> defaultPBRPaths(std::string path);
     AABB getAABB() { return aabb; }
 
+    // Levels of detail within the index buffer, finest first. Without any the whole buffer is drawn.
+    void setLODs(const vector<MeshLOD> &l) { lods = l; }
+    size_t numLODs() const { return lods.empty() ? 1 : lods.size(); }
+    // Coarsest level whose error is within maxError
+    size_t selectLOD(float maxError) const;
+
+    void setMeshlets(const vector<Meshlet> &m) { meshlets = m; }
+
+    // Small IDs for sorting draws, equal for meshes with the same textures or geometry arena
+    unsigned int textureSet() const { return textureSetID; }
+    GLuint vertexArray() const { return geometry ? geometry->arena->vertexArray() : 0; }
+
+    // Per frame culling statistics, reset by the renderer
+    static bool clusterCulling;
+    static size_t meshletsDrawn;
+    static size_t meshletsCulled;
+
     // Mesh generators
     static Mesh Plane(float w, float h);
 
+    // Quantize vertices against bounds, which must contain them
+    static vector<PackedVertex> pack(const Vertex *vertices, size_t numVertices, const AABB &bounds);
+
+    // Meshes loaded from now on use PackedVertex
+    static bool compactVertices;
+
+    // Largest vertex count addressable with 16-bit indices
+    static const size_t MAX_SHORT_VERTICES = 65536;
+
 private:
-    void init();
-    void calculateAABB();
+    void init(const void *vertices, size_t numVertices, size_t vertexBytes, const void *indices, size_t numIndices, GLenum indexType,
+              std::shared_ptr<const void> owner);
+    static AABB calculateAABB(const vector<Vertex> &vertices);
+    static bool isVisible(const Meshlet &m, const ClusterView &view);
     
-    vector<Vertex> vertices;
-    vector<unsigned int> indices;
+    GLsizei numIndices = 0;
+    GLenum indexType = GL_UNSIGNED_INT;
+    vector<MeshLOD> lods;
+    vector<Meshlet> meshlets;
+    bool packed = false; // PackedVertex layout
     vector<shared_ptr<Texture>> textures; // shared among meshes
+    unsigned int textureSetID = 0; // 0 without textures
 
     AABB aabb;
     Material material;
-    shared_ptr<VertexArray> VAO;
-    shared_ptr<VertexBuffer> VBO;
-    shared_ptr<VertexBuffer> EBO;
+    shared_ptr<GeometryRange> geometry; // shared with identical meshes
     
 };
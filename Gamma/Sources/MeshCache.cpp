@@ -0,0 +1,250 @@
+#include "MeshCache.hpp"
+#include "utils.hpp"
+#include <cstdint>
+#include <cstring>
+
+// Bump whenever the layout or the import pipeline changes
+static const uint32_t MESH_CACHE_VERSION = 7;
+static const char MESH_CACHE_MAGIC[4] = { 'G', 'M', 'S', 'H' };
+static const size_t BLOB_ALIGNMENT = 16;
+
+struct CacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t numMeshes;
+    uint32_t reserved;
+};
+
+struct CacheEntry {
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint64_t textureOffset;
+    uint64_t lodOffset;
+    uint64_t meshletOffset;
+    uint32_t numVertices;
+    uint32_t numIndices;
+    uint32_t numTextures;
+    float Kd[3];
+    float metallic;
+    float alpha;
+    uint32_t texMask;
+    float aabbMin[3];
+    float aabbMax[3];
+    uint32_t packed; // PackedVertex instead of Vertex
+    uint32_t shortIndices; // uint16_t instead of unsigned int
+    uint32_t numLods;
+    uint32_t numMeshlets;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(MeshLOD) == 12, "Unexpected LOD record size");
+static_assert(sizeof(Meshlet) == 40, "Unexpected meshlet record size");
+static_assert(sizeof(CacheHeader) == 24, "Unexpected mesh cache header size");
+static_assert(sizeof(CacheEntry) == 120, "Unexpected mesh cache entry size");
+
+MeshView::MeshView(const MeshData &d) {
+    if (d.packed.empty()) {
+        vertices = d.vertices.data();
+        numVertices = d.vertices.size();
+    }
+    else {
+        packed = d.packed.data();
+        numVertices = d.packed.size();
+    }
+    if (d.shortIndices.empty()) {
+        indices = d.indices.data();
+        numIndices = d.indices.size();
+    }
+    else {
+        shortIndices = d.shortIndices.data();
+        numIndices = d.shortIndices.size();
+    }
+    material = d.material;
+    aabb = d.aabb;
+    textures = d.textures;
+    lods = d.lods;
+    meshlets = d.meshlets;
+}
+
+MeshCache::MeshCache(const std::string &path, size_t key) {
+    file = VFS::instance().read(path);
+    const unsigned char *base = file.data;
+    const size_t size = file.size;
+
+    CacheHeader header;
+    if (size < sizeof(header))
+        throw std::runtime_error("Truncated mesh cache " + path);
+
+    std::memcpy(&header, base, sizeof(header));
+    if (std::memcmp(header.magic, MESH_CACHE_MAGIC, 4) || header.version != MESH_CACHE_VERSION || header.key != (uint64_t)key)
+        throw std::runtime_error("Stale mesh cache " + path);
+
+    // Everything referenced by the table must lie within the file
+    auto inBounds = [size](uint64_t offset, uint64_t bytes) {
+        return offset <= size && bytes <= size - offset;
+    };
+
+    const uint64_t tableBytes = (uint64_t)header.numMeshes * sizeof(CacheEntry);
+    if (!inBounds(sizeof(header), tableBytes))
+        throw std::runtime_error("Truncated mesh cache " + path);
+
+    for (uint32_t i = 0; i < header.numMeshes; i++) {
+        CacheEntry e;
+        std::memcpy(&e, base + sizeof(header) + i * sizeof(CacheEntry), sizeof(e));
+
+        const size_t vertexSize = e.packed ? sizeof(PackedVertex) : sizeof(Vertex);
+        const size_t indexSize = e.shortIndices ? sizeof(uint16_t) : sizeof(unsigned int);
+        if (!inBounds(e.vertexOffset, (uint64_t)e.numVertices * vertexSize) ||
+            !inBounds(e.indexOffset, (uint64_t)e.numIndices * indexSize) ||
+            !inBounds(e.textureOffset, 0) ||
+            !inBounds(e.lodOffset, (uint64_t)e.numLods * sizeof(MeshLOD)) ||
+            !inBounds(e.meshletOffset, (uint64_t)e.numMeshlets * sizeof(Meshlet)))
+            throw std::runtime_error("Corrupt mesh cache " + path);
+
+        MeshView v;
+        if (e.packed)
+            v.packed = reinterpret_cast<const PackedVertex*>(base + e.vertexOffset);
+        else
+            v.vertices = reinterpret_cast<const Vertex*>(base + e.vertexOffset);
+        v.numVertices = e.numVertices;
+        if (e.shortIndices)
+            v.shortIndices = reinterpret_cast<const uint16_t*>(base + e.indexOffset);
+        else
+            v.indices = reinterpret_cast<const unsigned int*>(base + e.indexOffset);
+        v.numIndices = e.numIndices;
+        v.material.Kd = glm::vec3(e.Kd[0], e.Kd[1], e.Kd[2]);
+        v.material.metallic = e.metallic;
+        v.material.alpha = e.alpha;
+        v.material.texMask = e.texMask;
+        v.aabb = AABB(glm::vec3(e.aabbMin[0], e.aabbMin[1], e.aabbMin[2]),
+                      glm::vec3(e.aabbMax[0], e.aabbMax[1], e.aabbMax[2]));
+
+        // Texture records: type, path length, path characters
+        uint64_t offset = e.textureOffset;
+        for (uint32_t t = 0; t < e.numTextures; t++) {
+            uint32_t record[2];
+            if (!inBounds(offset, sizeof(record)))
+                throw std::runtime_error("Corrupt mesh cache " + path);
+            std::memcpy(record, base + offset, sizeof(record));
+            offset += sizeof(record);
+
+            if (!inBounds(offset, record[1]))
+                throw std::runtime_error("Corrupt mesh cache " + path);
+            std::string texPath((const char*)(base + offset), record[1]);
+            offset += record[1];
+
+            v.textures.push_back(std::make_pair((TextureMask)record[0], texPath));
+        }
+
+        v.lods.resize(e.numLods);
+        if (e.numLods)
+            std::memcpy(v.lods.data(), base + e.lodOffset, e.numLods * sizeof(MeshLOD));
+        for (const MeshLOD &l : v.lods) {
+            if (l.firstIndex > e.numIndices || l.numIndices > e.numIndices - l.firstIndex)
+                throw std::runtime_error("Corrupt mesh cache " + path);
+        }
+
+        v.meshlets.resize(e.numMeshlets);
+        if (e.numMeshlets)
+            std::memcpy(v.meshlets.data(), base + e.meshletOffset, e.numMeshlets * sizeof(Meshlet));
+        for (const Meshlet &m : v.meshlets) {
+            if (m.firstIndex > e.numIndices || m.numIndices > e.numIndices - m.firstIndex)
+                throw std::runtime_error("Corrupt mesh cache " + path);
+        }
+
+        views.push_back(v);
+    }
+}
+
+size_t MeshCache::cacheKey(const std::string &sourcePath, unsigned int importFlags, bool packed) {
+    size_t parts[4] = { fileHash(sourcePath), (size_t)importFlags, (size_t)packed, (size_t)MESH_CACHE_VERSION };
+    return computeHash(parts, sizeof(parts));
+}
+
+std::string MeshCache::cachePath(size_t key) {
+    return "Gamma/Assets/Models/cached/" + std::to_string(key) + ".mesh";
+}
+
+bool MeshCache::write(const std::string &path, size_t key, const vector<MeshData> &meshes) {
+    auto align = [](uint64_t offset) {
+        return (offset + BLOB_ALIGNMENT - 1) & ~(uint64_t)(BLOB_ALIGNMENT - 1);
+    };
+
+    CacheHeader header;
+    std::memcpy(header.magic, MESH_CACHE_MAGIC, 4);
+    header.version = MESH_CACHE_VERSION;
+    header.key = key;
+    header.numMeshes = (uint32_t)meshes.size();
+    header.reserved = 0;
+
+    // Lay out blobs after the table
+    vector<CacheEntry> entries(meshes.size());
+    uint64_t offset = sizeof(CacheHeader) + meshes.size() * sizeof(CacheEntry);
+    for (size_t i = 0; i < meshes.size(); i++) {
+        const MeshData &m = meshes[i];
+        CacheEntry &e = entries[i];
+        std::memset(&e, 0, sizeof(e));
+
+        e.packed = m.packed.empty() ? 0 : 1;
+        e.numVertices = (uint32_t)(e.packed ? m.packed.size() : m.vertices.size());
+        e.shortIndices = m.shortIndices.empty() ? 0 : 1;
+        e.numIndices = (uint32_t)(e.shortIndices ? m.shortIndices.size() : m.indices.size());
+        e.numTextures = (uint32_t)m.textures.size();
+        e.numLods = (uint32_t)m.lods.size();
+        e.numMeshlets = (uint32_t)m.meshlets.size();
+        for (int c = 0; c < 3; c++) {
+            e.Kd[c] = m.material.Kd[c];
+            e.aabbMin[c] = m.aabb.mins[c];
+            e.aabbMax[c] = m.aabb.maxs[c];
+        }
+        e.metallic = m.material.metallic;
+        e.alpha = m.material.alpha;
+        e.texMask = m.material.texMask;
+
+        e.vertexOffset = align(offset);
+        offset = e.vertexOffset + (e.packed ? m.packed.size() * sizeof(PackedVertex) : m.vertices.size() * sizeof(Vertex));
+        e.indexOffset = align(offset);
+        offset = e.indexOffset + (e.shortIndices ? m.shortIndices.size() * sizeof(uint16_t) : m.indices.size() * sizeof(unsigned int));
+        e.textureOffset = offset;
+        for (auto &t : m.textures) {
+            offset += 2 * sizeof(uint32_t) + t.second.size();
+        }
+        e.lodOffset = offset;
+        offset += m.lods.size() * sizeof(MeshLOD);
+        e.meshletOffset = offset;
+        offset += m.meshlets.size() * sizeof(Meshlet);
+    }
+
+    return writeFileAtomically(path, "mesh cache", [&](std::ofstream &out) {
+        auto padTo = [&](uint64_t target) {
+            const char zeros[BLOB_ALIGNMENT] = { 0 };
+            uint64_t pos = (uint64_t)out.tellp();
+            out.write(zeros, (std::streamsize)(target - pos));
+        };
+
+        out.write((const char*)&header, sizeof(header));
+        out.write((const char*)entries.data(), entries.size() * sizeof(CacheEntry));
+        for (size_t i = 0; i < meshes.size(); i++) {
+            const MeshData &m = meshes[i];
+            padTo(entries[i].vertexOffset);
+            if (entries[i].packed)
+                out.write((const char*)m.packed.data(), m.packed.size() * sizeof(PackedVertex));
+            else
+                out.write((const char*)m.vertices.data(), m.vertices.size() * sizeof(Vertex));
+            padTo(entries[i].indexOffset);
+            if (entries[i].shortIndices)
+                out.write((const char*)m.shortIndices.data(), m.shortIndices.size() * sizeof(uint16_t));
+            else
+                out.write((const char*)m.indices.data(), m.indices.size() * sizeof(unsigned int));
+            for (auto &t : m.textures) {
+                uint32_t record[2] = { (uint32_t)t.first, (uint32_t)t.second.size() };
+                out.write((const char*)record, sizeof(record));
+                out.write(t.second.data(), t.second.size());
+            }
+            out.write((const char*)m.lods.data(), m.lods.size() * sizeof(MeshLOD));
+            out.write((const char*)m.meshlets.data(), m.meshlets.size() * sizeof(Meshlet));
+        }
+        return true;
+    });
+}
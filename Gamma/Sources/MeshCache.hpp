@@ -0,0 +1,70 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <memory>
+#include <utility>
+#include "Mesh.hpp"
+#include "VirtualFS.hpp"
+
+/*
+    On-disk cache of imported model geometry.
+
+    Stores the vertex (float or packed) and index (16 or 32-bit) arrays of every mesh in a model, together with
+    its material, bounding box, texture references, levels of detail and meshlets, in a flat binary file.
+    The file is memory mapped on load (through the VFS, so it can also live
+    in a packed archive) and the arrays are streamed straight from the
+    mapping to the GPU, so a warm load never touches Assimp.
+*/
+
+// Mesh produced by the importer, owns its data
+struct MeshData {
+    vector<Vertex> vertices;
+    vector<PackedVertex> packed; // used instead of vertices if not empty
+    vector<unsigned int> indices;
+    vector<uint16_t> shortIndices; // used instead of indices if not empty
+    Material material;
+    AABB aabb;
+    vector<std::pair<TextureMask, std::string>> textures; // paths relative to model
+    vector<MeshLOD> lods; // ranges of the index array, empty for a single level
+    vector<Meshlet> meshlets; // clusters of the full level
+};
+
+// Non-owning view of a mesh, either freshly imported or mapped from the cache
+struct MeshView {
+    MeshView(void) = default;
+    MeshView(const MeshData &d);
+
+    const Vertex *vertices = nullptr;
+    const PackedVertex *packed = nullptr; // one of these is set
+    size_t numVertices = 0;
+    const unsigned int *indices = nullptr;
+    const uint16_t *shortIndices = nullptr; // one of these is set
+    size_t numIndices = 0;
+    Material material;
+    AABB aabb;
+    vector<std::pair<TextureMask, std::string>> textures;
+    vector<MeshLOD> lods;
+    vector<Meshlet> meshlets;
+};
+
+class MeshCache {
+public:
+    // Map existing cache file, throws if it is unreadable or stale
+    MeshCache(const std::string &path, size_t key);
+    ~MeshCache() = default;
+
+    size_t numMeshes() const { return views.size(); }
+    const MeshView& getMesh(size_t ind) const { return views[ind]; }
+
+    // Key covers source contents and everything that affects the imported result
+    static size_t cacheKey(const std::string &sourcePath, unsigned int importFlags, bool packed);
+    static std::string cachePath(size_t key);
+    static bool write(const std::string &path, size_t key, const vector<MeshData> &meshes);
+
+    MeshCache(const MeshCache&) = delete;
+    MeshCache& operator=(const MeshCache&) = delete;
+
+private:
+    FileBuffer file;
+    vector<MeshView> views;
+};
@@ -0,0 +1,719 @@
+#include "MeshOptimizer.hpp"
+#include "utils.hpp"
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+void VertexCacheStats::add(const VertexCacheStats &s) {
+    triangles += s.triangles;
+    vertices += s.vertices;
+    transformed += s.transformed;
+}
+
+// FIFO cache simulated with timestamps: a vertex is a hit while fewer than
+// VERTEX_CACHE_SIZE other vertices were transformed after it.
+// Returns the number of misses of one triangle and updates the cache.
+static unsigned int updateCache(const unsigned int *tri, vector<unsigned int> &cacheTime, unsigned int &time) {
+    unsigned int misses = 0;
+    for (int i = 0; i < 3; i++) {
+        if (time - cacheTime[tri[i]] > VERTEX_CACHE_SIZE) {
+            cacheTime[tri[i]] = time++;
+            misses++;
+        }
+    }
+    return misses;
+}
+
+VertexCacheStats analyzeVertexCache(const vector<unsigned int> &indices, size_t numVertices) {
+    VertexCacheStats stats;
+    stats.triangles = indices.size() / 3;
+
+    vector<unsigned int> cacheTime(numVertices, 0);
+    unsigned int time = VERTEX_CACHE_SIZE + 1;
+    vector<bool> used(numVertices, false);
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        stats.transformed += updateCache(&indices[i], cacheTime, time);
+        for (int j = 0; j < 3; j++) {
+            if (!used[indices[i + j]]) {
+                used[indices[i + j]] = true;
+                stats.vertices++;
+            }
+        }
+    }
+
+    return stats;
+}
+
+void weldVertices(vector<Vertex> &vertices, vector<unsigned int> &indices) {
+    // Buckets by content hash, compared bytewise on collision
+    std::unordered_multimap<size_t, unsigned int> seen;
+    seen.reserve(vertices.size());
+    vector<unsigned int> remap(vertices.size());
+    vector<Vertex> unique;
+    unique.reserve(vertices.size());
+
+    for (size_t i = 0; i < vertices.size(); i++) {
+        const size_t h = computeHash(&vertices[i], sizeof(Vertex));
+        auto range = seen.equal_range(h);
+        auto it = range.first;
+        while (it != range.second && std::memcmp(&unique[it->second], &vertices[i], sizeof(Vertex)) != 0)
+            ++it;
+
+        if (it != range.second) {
+            remap[i] = it->second;
+        }
+        else {
+            remap[i] = (unsigned int)unique.size();
+            seen.insert(std::make_pair(h, remap[i]));
+            unique.push_back(vertices[i]);
+        }
+    }
+
+    for (unsigned int &i : indices) {
+        i = remap[i];
+    }
+    vertices.swap(unique);
+}
+
+void optimizeVertexCache(vector<unsigned int> &indices, size_t numVertices, vector<size_t> &clusterStarts) {
+    const size_t numTris = indices.size() / 3;
+    clusterStarts.clear();
+    if (numTris == 0)
+        return;
+
+    // Triangles around each vertex
+    vector<unsigned int> offsets(numVertices + 1, 0);
+    for (unsigned int i : indices) {
+        offsets[i + 1]++;
+    }
+    for (size_t v = 0; v < numVertices; v++) {
+        offsets[v + 1] += offsets[v];
+    }
+    vector<unsigned int> adjacency(indices.size());
+    vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++) {
+        adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+    }
+
+    // Triangles not yet emitted around each vertex
+    vector<unsigned int> live(numVertices);
+    for (size_t v = 0; v < numVertices; v++) {
+        live[v] = offsets[v + 1] - offsets[v];
+    }
+
+    vector<unsigned int> cacheTime(numVertices, 0);
+    unsigned int time = VERTEX_CACHE_SIZE + 1;
+    vector<bool> emitted(numTris, false);
+    vector<unsigned int> deadEnd;
+    vector<unsigned int> candidates;
+    vector<unsigned int> output;
+    output.reserve(indices.size());
+
+    size_t cursor = 0;
+    long long fanning = indices[0];
+    clusterStarts.push_back(0);
+
+    while (fanning >= 0) {
+        // Emit every remaining triangle around the fanning vertex
+        candidates.clear();
+        for (unsigned int a = offsets[fanning]; a < offsets[fanning + 1]; a++) {
+            const unsigned int t = adjacency[a];
+            if (emitted[t])
+                continue;
+
+            const unsigned int *tri = &indices[t * 3];
+            for (int i = 0; i < 3; i++) {
+                output.push_back(tri[i]);
+                deadEnd.push_back(tri[i]);
+                candidates.push_back(tri[i]);
+                live[tri[i]]--;
+            }
+            updateCache(tri, cacheTime, time);
+            emitted[t] = true;
+        }
+
+        // Next fanning vertex: the oldest candidate that will still be in the cache after its fan
+        fanning = -1;
+        long long best = -1;
+        for (unsigned int v : candidates) {
+            if (live[v] == 0)
+                continue;
+            long long priority = 0;
+            if (time - cacheTime[v] + 2 * live[v] <= VERTEX_CACHE_SIZE)
+                priority = time - cacheTime[v];
+            if (priority > best) {
+                best = priority;
+                fanning = v;
+            }
+        }
+
+        if (fanning >= 0)
+            continue;
+
+        // Dead end: recently used vertices first, then input order
+        while (!deadEnd.empty() && fanning < 0) {
+            const unsigned int v = deadEnd.back();
+            deadEnd.pop_back();
+            if (live[v] > 0)
+                fanning = v;
+        }
+        while (cursor < indices.size() && fanning < 0) {
+            if (live[indices[cursor]] > 0)
+                fanning = indices[cursor];
+            cursor++;
+        }
+        if (fanning >= 0)
+            clusterStarts.push_back(output.size() / 3);
+    }
+
+    indices.swap(output);
+}
+
+// Split hard clusters where the running cache efficiency is close to the cluster's own
+static vector<size_t> softBoundaries(const vector<unsigned int> &indices, size_t numVertices,
+                                     const vector<size_t> &clusterStarts, float threshold) {
+    vector<size_t> boundaries;
+    vector<unsigned int> cacheTime(numVertices, 0);
+    unsigned int time = VERTEX_CACHE_SIZE + 1;
+    const size_t numTris = indices.size() / 3;
+
+    for (size_t c = 0; c < clusterStarts.size(); c++) {
+        const size_t begin = clusterStarts[c];
+        const size_t end = (c + 1 < clusterStarts.size()) ? clusterStarts[c + 1] : numTris;
+
+        time += VERTEX_CACHE_SIZE + 1; // cold cache
+        size_t misses = 0;
+        for (size_t t = begin; t < end; t++) {
+            misses += updateCache(&indices[t * 3], cacheTime, time);
+        }
+        const float clusterThreshold = threshold * misses / (float)(end - begin);
+
+        time += VERTEX_CACHE_SIZE + 1;
+        boundaries.push_back(begin);
+        size_t runningMisses = 0, runningTris = 0;
+        for (size_t t = begin; t < end; t++) {
+            runningMisses += updateCache(&indices[t * 3], cacheTime, time);
+            runningTris++;
+            if (runningMisses <= clusterThreshold * runningTris && t + 1 < end) {
+                boundaries.push_back(t + 1);
+                time += VERTEX_CACHE_SIZE + 1;
+                runningMisses = runningTris = 0;
+            }
+        }
+    }
+
+    return boundaries;
+}
+
+void optimizeOverdraw(const vector<Vertex> &vertices, vector<unsigned int> &indices,
+                      const vector<size_t> &clusterStarts, float threshold) {
+    const size_t numTris = indices.size() / 3;
+    if (numTris == 0)
+        return;
+
+    const vector<size_t> clusters = softBoundaries(indices, vertices.size(), clusterStarts, threshold);
+
+    // Area weighted centroid and normal of each cluster, and of the whole mesh
+    vector<glm::vec3> centroids(clusters.size(), glm::vec3(0.0f));
+    vector<glm::vec3> normals(clusters.size(), glm::vec3(0.0f));
+    vector<float> areas(clusters.size(), 0.0f);
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+
+    for (size_t c = 0; c < clusters.size(); c++) {
+        const size_t end = (c + 1 < clusters.size()) ? clusters[c + 1] : numTris;
+        for (size_t t = clusters[c]; t < end; t++) {
+            const glm::vec3 &p0 = vertices[indices[t * 3]].position;
+            const glm::vec3 &p1 = vertices[indices[t * 3 + 1]].position;
+            const glm::vec3 &p2 = vertices[indices[t * 3 + 2]].position;
+            const glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+            const float area = glm::length(n);
+            centroids[c] += (p0 + p1 + p2) * (area / 3.0f);
+            normals[c] += n;
+            areas[c] += area;
+        }
+        meshCentroid += centroids[c];
+        meshArea += areas[c];
+    }
+    if (meshArea > 0.0f)
+        meshCentroid /= meshArea;
+
+    vector<float> sortKeys(clusters.size(), 0.0f);
+    for (size_t c = 0; c < clusters.size(); c++) {
+        const float len = glm::length(normals[c]);
+        if (areas[c] > 0.0f && len > 0.0f)
+            sortKeys[c] = glm::dot(centroids[c] / areas[c] - meshCentroid, normals[c] / len);
+    }
+
+    // Clusters facing outwards occlude the rest, so they go first
+    vector<size_t> order(clusters.size());
+    for (size_t c = 0; c < order.size(); c++) {
+        order[c] = c;
+    }
+    std::stable_sort(order.begin(), order.end(), [&sortKeys](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });
+
+    vector<unsigned int> output;
+    output.reserve(indices.size());
+    for (size_t c : order) {
+        const size_t end = (c + 1 < clusters.size()) ? clusters[c + 1] : numTris;
+        output.insert(output.end(), indices.begin() + clusters[c] * 3, indices.begin() + end * 3);
+    }
+    indices.swap(output);
+}
+
+void optimizeVertexFetch(vector<Vertex> &vertices, vector<unsigned int> &indices) {
+    const unsigned int UNUSED = ~0u;
+    vector<unsigned int> remap(vertices.size(), UNUSED);
+    vector<Vertex> ordered;
+    ordered.reserve(vertices.size());
+
+    for (unsigned int &i : indices) {
+        if (remap[i] == UNUSED) {
+            remap[i] = (unsigned int)ordered.size();
+            ordered.push_back(vertices[i]);
+        }
+        i = remap[i];
+    }
+    vertices.swap(ordered);
+}
+
+void splitMesh(const vector<Vertex> &vertices, const vector<unsigned int> &indices, size_t maxVertices,
+               vector<vector<Vertex>> &partVertices, vector<vector<unsigned int>> &partIndices) {
+    const unsigned int UNUSED = ~0u;
+    vector<unsigned int> remap(vertices.size(), UNUSED);
+    vector<unsigned int> touched; // vertices of the current part, for resetting remap
+
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+        size_t added = 0;
+        for (int i = 0; i < 3; i++) {
+            added += (remap[indices[t + i]] == UNUSED) ? 1 : 0;
+        }
+
+        if (partVertices.empty() || partVertices.back().size() + added > maxVertices) {
+            for (unsigned int v : touched) {
+                remap[v] = UNUSED;
+            }
+            touched.clear();
+            partVertices.push_back(vector<Vertex>());
+            partIndices.push_back(vector<unsigned int>());
+        }
+
+        vector<Vertex> &part = partVertices.back();
+        for (int i = 0; i < 3; i++) {
+            const unsigned int v = indices[t + i];
+            if (remap[v] == UNUSED) {
+                remap[v] = (unsigned int)part.size();
+                touched.push_back(v);
+                part.push_back(vertices[v]);
+            }
+            partIndices.back().push_back(remap[v]);
+        }
+    }
+}
+
+void optimizeMesh(vector<Vertex> &vertices, vector<unsigned int> &indices, VertexCacheStats *before, VertexCacheStats *after) {
+    if (before)
+        *before = analyzeVertexCache(indices, vertices.size());
+    if (indices.size() % 3 != 0) {
+        // Points or lines, left as they are
+        if (after)
+            *after = analyzeVertexCache(indices, vertices.size());
+        return;
+    }
+
+    weldVertices(vertices, indices);
+    vector<size_t> clusterStarts;
+    optimizeVertexCache(indices, vertices.size(), clusterStarts);
+    optimizeOverdraw(vertices, indices, clusterStarts);
+    optimizeVertexFetch(vertices, indices);
+
+    if (after)
+        *after = analyzeVertexCache(indices, vertices.size());
+}
+
+// Sum of squared distances to a set of planes, as a symmetric 4x4 matrix
+struct Quadric {
+    double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+    double b0 = 0, b1 = 0, b2 = 0;
+    double c = 0;
+
+    void addPlane(const glm::vec3 &n, float d) {
+        a00 += n.x * n.x; a01 += n.x * n.y; a02 += n.x * n.z;
+        a11 += n.y * n.y; a12 += n.y * n.z; a22 += n.z * n.z;
+        b0 += n.x * d; b1 += n.y * d; b2 += n.z * d;
+        c += d * d;
+    }
+
+    void add(const Quadric &q) {
+        a00 += q.a00; a01 += q.a01; a02 += q.a02;
+        a11 += q.a11; a12 += q.a12; a22 += q.a22;
+        b0 += q.b0; b1 += q.b1; b2 += q.b2;
+        c += q.c;
+    }
+
+    double eval(const glm::vec3 &p) const {
+        const double x = p.x, y = p.y, z = p.z;
+        const double r = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z)
+                       + 2.0 * (b0 * x + b1 * y + b2 * z) + c;
+        return r > 0.0 ? r : 0.0;
+    }
+};
+
+struct Collapse {
+    unsigned int from, to;
+    double cost;
+};
+
+static glm::vec3 triangleNormal(const glm::vec3 &p0, const glm::vec3 &p1, const glm::vec3 &p2) {
+    return glm::cross(p1 - p0, p2 - p0);
+}
+
+// Vertices sharing a position map to the first of them
+static vector<unsigned int> canonicalPositions(const vector<Vertex> &vertices) {
+    std::unordered_map<size_t, vector<unsigned int>> byHash;
+    vector<unsigned int> canonical(vertices.size());
+    for (unsigned int v = 0; v < vertices.size(); v++) {
+        vector<unsigned int> &bucket = byHash[computeHash(&vertices[v].position, sizeof(glm::vec3))];
+        canonical[v] = v;
+        for (unsigned int other : bucket) {
+            if (std::memcmp(&vertices[other].position, &vertices[v].position, sizeof(glm::vec3)) == 0) {
+                canonical[v] = other;
+                break;
+            }
+        }
+        if (canonical[v] == v)
+            bucket.push_back(v);
+    }
+    return canonical;
+}
+
+// Number of triangles on each edge between canonical vertices, keyed by the pair of them
+static std::unordered_map<unsigned long long, unsigned int> edgeUses(const vector<unsigned int> &canonical,
+                                                                     const vector<unsigned int> &indices) {
+    std::unordered_map<unsigned long long, unsigned int> edges;
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+        for (int i = 0; i < 3; i++) {
+            unsigned long long a = canonical[indices[t + i]], b = canonical[indices[t + (i + 1) % 3]];
+            if (a > b)
+                std::swap(a, b);
+            edges[(a << 32) | b]++;
+        }
+    }
+    return edges;
+}
+
+// Closed and consistently wound: every edge between canonical vertices is used once in each direction
+static bool closedAndOriented(const vector<unsigned int> &canonical, const vector<unsigned int> &indices) {
+    std::unordered_map<unsigned long long, unsigned int> directed;
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+        for (int i = 0; i < 3; i++) {
+            const unsigned long long a = canonical[indices[t + i]], b = canonical[indices[t + (i + 1) % 3]];
+            if (a != b)
+                directed[(a << 32) | b]++;
+        }
+    }
+
+    for (auto &e : directed) {
+        const unsigned long long reversed = ((e.first & 0xffffffffull) << 32) | (e.first >> 32);
+        if (e.second != 1 || directed.find(reversed) == directed.end())
+            return false;
+    }
+    return true;
+}
+
+// Vertices that must keep their place: on open borders, non-manifold edges or attribute seams
+static vector<bool> lockedVertices(const vector<Vertex> &vertices, const vector<unsigned int> &indices) {
+    const vector<unsigned int> canonical = canonicalPositions(vertices);
+    vector<unsigned int> copies(vertices.size(), 0);
+    for (unsigned int v = 0; v < vertices.size(); v++) {
+        copies[canonical[v]]++;
+    }
+
+    vector<bool> lockedPosition(vertices.size(), false);
+    for (auto &e : edgeUses(canonical, indices)) {
+        if (e.second != 2) {
+            lockedPosition[(unsigned int)(e.first >> 32)] = true;
+            lockedPosition[(unsigned int)(e.first & 0xffffffffu)] = true;
+        }
+    }
+
+    vector<bool> locked(vertices.size());
+    for (unsigned int v = 0; v < vertices.size(); v++) {
+        locked[v] = copies[canonical[v]] > 1 || lockedPosition[canonical[v]];
+    }
+    return locked;
+}
+
+vector<unsigned int> simplifyMesh(const vector<Vertex> &vertices, const vector<unsigned int> &indices,
+                                  size_t targetIndices, float maxError, float *resultError) {
+    vector<unsigned int> result = indices;
+    float error = 0.0f;
+    if (resultError)
+        *resultError = 0.0f;
+    if (indices.size() % 3 != 0)
+        return result;
+
+    const vector<bool> locked = lockedVertices(vertices, indices);
+
+    vector<Quadric> quadrics(vertices.size());
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+        const glm::vec3 &p0 = vertices[indices[t]].position;
+        glm::vec3 n = triangleNormal(p0, vertices[indices[t + 1]].position, vertices[indices[t + 2]].position);
+        const float len = glm::length(n);
+        if (len == 0.0f)
+            continue;
+        n = n / len;
+        const float d = -glm::dot(n, p0);
+        for (int i = 0; i < 3; i++) {
+            quadrics[indices[t + i]].addPlane(n, d);
+        }
+    }
+
+    const double maxCost = (double)maxError * maxError;
+    vector<unsigned int> offsets, adjacency, fill;
+    vector<Collapse> collapses;
+    vector<unsigned int> remap(vertices.size());
+    vector<bool> touched(vertices.size());
+
+    // Each pass collapses the cheapest edges whose neighbourhoods do not overlap
+    while (result.size() > targetIndices) {
+        offsets.assign(vertices.size() + 1, 0);
+        for (unsigned int i : result) {
+            offsets[i + 1]++;
+        }
+        for (size_t v = 0; v < vertices.size(); v++) {
+            offsets[v + 1] += offsets[v];
+        }
+        adjacency.resize(result.size());
+        fill.assign(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < result.size(); i++) {
+            adjacency[fill[result[i]]++] = (unsigned int)(i / 3);
+        }
+
+        collapses.clear();
+        for (size_t t = 0; t < result.size(); t += 3) {
+            for (int i = 0; i < 3; i++) {
+                const unsigned int a = result[t + i], b = result[t + (i + 1) % 3];
+                Quadric q = quadrics[a];
+                q.add(quadrics[b]);
+                if (!locked[a])
+                    collapses.push_back({ a, b, q.eval(vertices[b].position) });
+                if (!locked[b])
+                    collapses.push_back({ b, a, q.eval(vertices[a].position) });
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse &x, const Collapse &y) { return x.cost < y.cost; });
+
+        for (size_t v = 0; v < vertices.size(); v++) {
+            remap[v] = (unsigned int)v;
+        }
+        touched.assign(vertices.size(), false);
+
+        size_t removed = 0;
+        const size_t excess = result.size() - targetIndices;
+        for (const Collapse &c : collapses) {
+            if (c.cost > maxCost || removed >= excess)
+                break;
+            if (touched[c.from] || touched[c.to])
+                continue;
+
+            // Triangles around the removed vertex must not flip or degenerate
+            bool valid = true;
+            size_t degenerate = 0;
+            for (unsigned int a = offsets[c.from]; a < offsets[c.from + 1] && valid; a++) {
+                const unsigned int *tri = &result[adjacency[a] * 3];
+                if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to) {
+                    degenerate++;
+                    continue;
+                }
+
+                glm::vec3 p[3], q[3];
+                for (int i = 0; i < 3; i++) {
+                    p[i] = q[i] = vertices[tri[i]].position;
+                    if (tri[i] == c.from)
+                        q[i] = vertices[c.to].position;
+                }
+                const glm::vec3 before = triangleNormal(p[0], p[1], p[2]);
+                const glm::vec3 after = triangleNormal(q[0], q[1], q[2]);
+                valid = glm::dot(before, after) > 0.25f * glm::length(before) * glm::length(after);
+            }
+            if (!valid)
+                continue;
+
+            remap[c.from] = c.to;
+            quadrics[c.to].add(quadrics[c.from]);
+            for (unsigned int a = offsets[c.from]; a < offsets[c.from + 1]; a++) {
+                const unsigned int *tri = &result[adjacency[a] * 3];
+                touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = true;
+            }
+            error = std::max(error, (float)std::sqrt(c.cost));
+            removed += degenerate * 3;
+        }
+
+        if (removed == 0)
+            break;
+
+        // Drop triangles that lost an edge
+        size_t write = 0;
+        for (size_t t = 0; t < result.size(); t += 3) {
+            const unsigned int a = remap[result[t]], b = remap[result[t + 1]], c = remap[result[t + 2]];
+            if (a != b && b != c && a != c) {
+                result[write++] = a;
+                result[write++] = b;
+                result[write++] = c;
+            }
+        }
+        result.resize(write);
+    }
+
+    if (resultError)
+        *resultError = error;
+    return result;
+}
+
+// Bounding sphere around the vertices and cone around the face normals of a meshlet
+static void meshletBounds(const vector<Vertex> &vertices, const unsigned int *indices, size_t numIndices,
+                          bool closed, Meshlet &m) {
+    AABB box;
+    for (size_t i = 0; i < numIndices; i++) {
+        box.expand(vertices[indices[i]].position);
+    }
+    m.center = (box.mins + box.maxs) * 0.5f;
+    m.radius = 0.0f;
+    for (size_t i = 0; i < numIndices; i++) {
+        m.radius = std::max(m.radius, glm::length(vertices[indices[i]].position - m.center));
+    }
+
+    // Backfaces of open or inconsistently wound meshes can be seen, their cones are left disabled
+    m.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+    m.coneCutoff = 2.0f;
+    if (!closed)
+        return;
+
+    vector<glm::vec3> normals;
+    glm::vec3 axis(0.0f);
+    for (size_t i = 0; i + 2 < numIndices; i += 3) {
+        const glm::vec3 n = triangleNormal(vertices[indices[i]].position, vertices[indices[i + 1]].position,
+                                           vertices[indices[i + 2]].position);
+        const float len = glm::length(n);
+        if (len == 0.0f)
+            continue;
+        normals.push_back(n / len);
+        axis += normals.back();
+    }
+
+    const float axisLen = glm::length(axis);
+    if (normals.empty() || axisLen == 0.0f)
+        return;
+    axis /= axisLen;
+
+    float minDot = 1.0f;
+    for (const glm::vec3 &n : normals) {
+        minDot = std::min(minDot, glm::dot(axis, n));
+    }
+
+    // Spread over 90 degrees, some face is visible from anywhere
+    if (minDot <= 0.0f)
+        return;
+
+    m.coneAxis = axis;
+    m.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+}
+
+vector<Meshlet> buildMeshlets(const vector<Vertex> &vertices, vector<unsigned int> &indices, size_t maxTriangles) {
+    vector<Meshlet> meshlets;
+    const size_t numTris = indices.size() / 3;
+    if (numTris == 0 || indices.size() % 3 != 0)
+        return meshlets;
+
+    const bool closed = closedAndOriented(canonicalPositions(vertices), indices);
+
+    // Triangles around each vertex
+    vector<unsigned int> offsets(vertices.size() + 1, 0);
+    for (unsigned int i : indices) {
+        offsets[i + 1]++;
+    }
+    for (size_t v = 0; v < vertices.size(); v++) {
+        offsets[v + 1] += offsets[v];
+    }
+    vector<unsigned int> adjacency(indices.size());
+    vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++) {
+        adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+    }
+
+    vector<bool> assigned(numTris, false);
+    vector<unsigned int> stamp(vertices.size(), 0); // meshlet number + 1 for vertices in a meshlet
+    vector<unsigned int> candidates;
+    vector<unsigned int> output;
+    output.reserve(indices.size());
+
+    // Grow from the first free triangle, preferring neighbours that add the fewest vertices.
+    // Ties go to the earlier triangle, which keeps the cache friendly input order.
+    for (size_t seed = 0; seed < numTris; seed++) {
+        if (assigned[seed])
+            continue;
+
+        const unsigned int id = (unsigned int)meshlets.size() + 1;
+        const size_t first = output.size();
+        candidates.clear();
+        long long next = (long long)seed;
+        size_t count = 0;
+
+        while (next >= 0 && count < maxTriangles) {
+            const unsigned int t = (unsigned int)next;
+            assigned[t] = true;
+            count++;
+            for (int i = 0; i < 3; i++) {
+                const unsigned int v = indices[t * 3 + i];
+                output.push_back(v);
+                if (stamp[v] == id)
+                    continue;
+                stamp[v] = id;
+                for (unsigned int a = offsets[v]; a < offsets[v + 1]; a++) {
+                    if (!assigned[adjacency[a]])
+                        candidates.push_back(adjacency[a]);
+                }
+            }
+
+            next = -1;
+            int bestScore = -1;
+            size_t write = 0;
+            for (unsigned int c : candidates) {
+                if (assigned[c])
+                    continue;
+                candidates[write++] = c;
+                const int score = (stamp[indices[c * 3]] == id) + (stamp[indices[c * 3 + 1]] == id) + (stamp[indices[c * 3 + 2]] == id);
+                if (score > bestScore || (score == bestScore && c < next)) {
+                    bestScore = score;
+                    next = c;
+                }
+            }
+            candidates.resize(write);
+        }
+
+        // Reorder within the meshlet for the vertex cache, the range stays contiguous
+        vector<unsigned int> global, local;
+        for (size_t i = first; i < output.size(); i++) {
+            auto it = std::find(global.begin(), global.end(), output[i]);
+            local.push_back((unsigned int)(it - global.begin()));
+            if (it == global.end())
+                global.push_back(output[i]);
+        }
+        vector<size_t> clusters;
+        optimizeVertexCache(local, global.size(), clusters);
+        for (size_t i = 0; i < local.size(); i++) {
+            output[first + i] = global[local[i]];
+        }
+
+        Meshlet m;
+        m.firstIndex = (uint32_t)first;
+        m.numIndices = (uint32_t)(output.size() - first);
+        meshletBounds(vertices, &output[first], m.numIndices, closed, m);
+        meshlets.push_back(m);
+    }
+
+    indices.swap(output);
+    return meshlets;
+}
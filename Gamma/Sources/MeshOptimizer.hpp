@@ -0,0 +1,75 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include "Mesh.hpp"
+
+/*
+    Import-time optimization of triangle meshes.
+
+    Identical vertices are welded, then triangles are reordered for the
+    post-transform vertex cache with Tipsify (Sander et al. 2007). The
+    resulting clusters are sorted so that outward facing ones come first,
+    which lowers overdraw without giving up much cache efficiency. Finally
+    vertices are renumbered in the order they are first referenced, so the
+    vertex fetch walks memory linearly. Meshes too large for 16-bit indices
+    can then be split along that order with little duplication.
+
+    Levels of detail are built by quadric error simplification, which only
+    rewrites the index buffer, so every level shares the original vertices.
+    The full level is divided into meshlets, small clusters of triangles with
+    bounds for culling them individually at draw time.
+
+    Cache efficiency is reported as ACMR (transformed vertices per triangle,
+    0.5 is optimal for large regular meshes) and ATVR (transformed vertices
+    per vertex, 1.0 is optimal), simulated with a FIFO cache.
+*/
+
+// Post-transform cache size assumed by the optimizer and the statistics
+static const unsigned int VERTEX_CACHE_SIZE = 16;
+
+struct VertexCacheStats {
+    size_t triangles = 0;
+    size_t vertices = 0;
+    size_t transformed = 0; // cache misses
+
+    float acmr() const { return triangles ? (float)transformed / triangles : 0.0f; }
+    float atvr() const { return vertices ? (float)transformed / vertices : 0.0f; }
+    void add(const VertexCacheStats &s);
+};
+
+VertexCacheStats analyzeVertexCache(const std::vector<unsigned int> &indices, size_t numVertices);
+
+// Merge bitwise identical vertices
+void weldVertices(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices);
+
+// Tipsify, clusterStarts receives the first triangle of each cluster that begins at a dead end
+void optimizeVertexCache(std::vector<unsigned int> &indices, size_t numVertices, std::vector<size_t> &clusterStarts);
+
+// Sort clusters front to back by how much they face away from the mesh center.
+// Clusters are split further wherever the cache efficiency stays within threshold of the original.
+void optimizeOverdraw(const std::vector<Vertex> &vertices, std::vector<unsigned int> &indices,
+                      const std::vector<size_t> &clusterStarts, float threshold = 1.05f);
+
+// Renumber vertices in order of first use, unreferenced vertices are dropped
+void optimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices);
+
+// Split into parts of at most maxVertices vertices, indices become local to their part.
+// Triangles keep their order, vertices shared by neighbouring parts are duplicated.
+void splitMesh(const std::vector<Vertex> &vertices, const std::vector<unsigned int> &indices, size_t maxVertices,
+               std::vector<std::vector<Vertex>> &partVertices, std::vector<std::vector<unsigned int>> &partIndices);
+
+// Weld, then optimize for the vertex cache, overdraw and vertex fetch
+void optimizeMesh(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices,
+                  VertexCacheStats *before = nullptr, VertexCacheStats *after = nullptr);
+
+// Coarser index buffer over the same vertices, by quadric error edge collapses (Garland and Heckbert 1997).
+// Stops at targetIndices or before moving the surface further than maxError. Open borders and attribute
+// seams are kept in place. resultError receives the largest distance introduced, in object space.
+std::vector<unsigned int> simplifyMesh(const std::vector<Vertex> &vertices, const std::vector<unsigned int> &indices,
+                                       size_t targetIndices, float maxError, float *resultError = nullptr);
+
+// Split into groups of up to maxTriangles connected triangles, reordering indices so each is one range.
+// Meshlets of closed, consistently wound meshes get a normal cone for backface culling, others only a
+// bounding sphere.
+std::vector<Meshlet> buildMeshlets(const std::vector<Vertex> &vertices, std::vector<unsigned int> &indices,
+                                   size_t maxTriangles = 128);
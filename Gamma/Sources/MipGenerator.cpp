@@ -0,0 +1,201 @@
+#include "MipGenerator.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define MIP_USE_SSE
+#endif
+
+static const float FILTER_PI = 3.14159265f;
+static const float FILTER_RADIUS = 3.0f; // in destination texels
+static const float KAISER_ALPHA = 4.0f;
+static const float DISPLAY_GAMMA = 2.2f;
+
+// Zeroth order modified Bessel function of the first kind
+static float besselI0(float x) {
+    float sum = 1.0f, term = 1.0f;
+    for (int k = 1; k < 16; k++) {
+        float t = x / (2.0f * k);
+        term *= t * t;
+        sum += term;
+    }
+    return sum;
+}
+
+// Windowed sinc, x in destination texels
+static float kaiserSinc(float x) {
+    const float ax = std::abs(x);
+    if (ax >= FILTER_RADIUS)
+        return 0.0f;
+
+    const float t = x / FILTER_RADIUS;
+    const float window = besselI0(KAISER_ALPHA * std::sqrt(1.0f - t * t)) / besselI0(KAISER_ALPHA);
+    const float sinc = (ax < 1e-5f) ? 1.0f : std::sin(FILTER_PI * x) / (FILTER_PI * x);
+    return sinc * window;
+}
+
+// Normalized taps for resampling one axis, source indices already wrapped
+struct Filter1D {
+    int taps = 0;
+    std::vector<int> index;     // dstSize * taps
+    std::vector<float> weight;  // dstSize * taps
+};
+
+static Filter1D makeFilter(int srcSize, int dstSize) {
+    Filter1D f;
+    const float scale = (float)srcSize / dstSize;
+    f.taps = (int)std::ceil(2.0f * FILTER_RADIUS * scale) + 1;
+    f.index.resize((size_t)dstSize * f.taps);
+    f.weight.resize((size_t)dstSize * f.taps);
+
+    for (int x = 0; x < dstSize; x++) {
+        const float center = (x + 0.5f) * scale;
+        const int first = (int)std::floor(center - FILTER_RADIUS * scale);
+        float sum = 0.0f;
+        for (int k = 0; k < f.taps; k++) {
+            const int i = first + k;
+            const float w = kaiserSinc((i + 0.5f - center) / scale);
+            f.index[(size_t)x * f.taps + k] = ((i % srcSize) + srcSize) % srcSize;
+            f.weight[(size_t)x * f.taps + k] = w;
+            sum += w;
+        }
+        for (int k = 0; k < f.taps; k++) {
+            f.weight[(size_t)x * f.taps + k] /= sum;
+        }
+    }
+
+    return f;
+}
+
+// 8-bit to filtering space, per channel
+static void makeDecodeTable(MipMode mode, float table[4][256]) {
+    for (int v = 0; v < 256; v++) {
+        const float f = v / 255.0f;
+        for (int c = 0; c < 4; c++) {
+            table[c][v] = f;
+        }
+        if (mode == MipMode::COLOR) {
+            table[0][v] = table[1][v] = table[2][v] = std::pow(f, DISPLAY_GAMMA);
+        }
+        else if (mode == MipMode::NORMAL) {
+            table[0][v] = table[1][v] = table[2][v] = f * 2.0f - 1.0f;
+        }
+    }
+}
+
+static unsigned char toByte(float f) {
+    return (unsigned char)(std::min(std::max(f, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+// Filtering space back to 8-bit
+static void encodePixel(const float *p, MipMode mode, unsigned char *out) {
+    if (mode == MipMode::COLOR) {
+        for (int c = 0; c < 3; c++) {
+            out[c] = toByte(std::pow(std::max(p[c], 0.0f), 1.0f / DISPLAY_GAMMA));
+        }
+    }
+    else if (mode == MipMode::NORMAL) {
+        float len = std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+        float n[3] = { 0.0f, 0.0f, 1.0f };
+        if (len > 1e-6f) {
+            for (int c = 0; c < 3; c++) n[c] = p[c] / len;
+        }
+        for (int c = 0; c < 3; c++) {
+            out[c] = toByte(n[c] * 0.5f + 0.5f);
+        }
+    }
+    else {
+        for (int c = 0; c < 3; c++) {
+            out[c] = toByte(p[c]);
+        }
+    }
+    out[3] = toByte(p[3]);
+}
+
+// Vertical pass into a float row of source width, then horizontal pass straight to the output row
+static void downsample(const unsigned char *src, int srcW, int srcH, unsigned char *dst, int dstW, int dstH,
+                       MipMode mode, const float table[4][256]) {
+    const Filter1D fx = makeFilter(srcW, dstW);
+    const Filter1D fy = makeFilter(srcH, dstH);
+
+    ThreadPool::shared().parallelFor(dstH, [&](size_t y) {
+        std::vector<float> row(4 * (size_t)srcW, 0.0f);
+
+        for (int k = 0; k < fy.taps; k++) {
+            const float w = fy.weight[y * fy.taps + k];
+            if (w == 0.0f)
+                continue;
+
+            const unsigned char *s = src + 4 * (size_t)fy.index[y * fy.taps + k] * srcW;
+#ifdef MIP_USE_SSE
+            const __m128 vw = _mm_set1_ps(w);
+            for (int x = 0; x < srcW; x++, s += 4) {
+                __m128 v = _mm_set_ps(table[3][s[3]], table[2][s[2]], table[1][s[1]], table[0][s[0]]);
+                float *r = &row[4 * (size_t)x];
+                _mm_storeu_ps(r, _mm_add_ps(_mm_loadu_ps(r), _mm_mul_ps(vw, v)));
+            }
+#else
+            for (int x = 0; x < srcW; x++, s += 4) {
+                float *r = &row[4 * (size_t)x];
+                for (int c = 0; c < 4; c++)
+                    r[c] += w * table[c][s[c]];
+            }
+#endif
+        }
+
+        unsigned char *d = dst + 4 * y * dstW;
+        for (int x = 0; x < dstW; x++, d += 4) {
+            const int *idx = &fx.index[(size_t)x * fx.taps];
+            const float *wts = &fx.weight[(size_t)x * fx.taps];
+            float acc[4];
+#ifdef MIP_USE_SSE
+            __m128 sum = _mm_setzero_ps();
+            for (int k = 0; k < fx.taps; k++) {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(wts[k]), _mm_loadu_ps(&row[4 * (size_t)idx[k]])));
+            }
+            _mm_storeu_ps(acc, sum);
+#else
+            acc[0] = acc[1] = acc[2] = acc[3] = 0.0f;
+            for (int k = 0; k < fx.taps; k++) {
+                for (int c = 0; c < 4; c++)
+                    acc[c] += wts[k] * row[4 * (size_t)idx[k] + c];
+            }
+#endif
+            encodePixel(acc, mode, d);
+        }
+    });
+}
+
+int numMipLevels(int width, int height) {
+    int levels = 1;
+    while (width > 1 || height > 1) {
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+        levels++;
+    }
+    return levels;
+}
+
+// Every level is filtered from the previous 8-bit level, so only the output needs to be kept in memory
+std::vector<std::vector<unsigned char>> generateMipChain(const unsigned char *rgba, int width, int height, MipMode mode) {
+    float table[4][256];
+    makeDecodeTable(mode, table);
+
+    std::vector<std::vector<unsigned char>> levels(numMipLevels(width, height));
+    levels[0].assign(rgba, rgba + 4 * (size_t)width * height);
+
+    int w = width, h = height;
+    for (size_t i = 1; i < levels.size(); i++) {
+        const int nw = std::max(1, w / 2);
+        const int nh = std::max(1, h / 2);
+        levels[i].resize(4 * (size_t)nw * nh);
+        downsample(levels[i - 1].data(), w, h, levels[i].data(), nw, nh, mode, table);
+        w = nw;
+        h = nh;
+    }
+
+    return levels;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <vector>
+
+/*
+    CPU mip chain generation for textures loaded from disk.
+
+    Each level is filtered from the one above with a separable Kaiser-windowed
+    sinc (wrapping at the edges, matching GL_REPEAT). Filtering happens in
+    float with SSE where available, rows are split across the shared thread
+    pool. Albedo is filtered in linear space and re-encoded with gamma 2.2
+    (the same curve the shaders decode with), normal maps are renormalized
+    after filtering.
+*/
+
+enum class MipMode {
+    LINEAR, // data maps, filtered as stored
+    COLOR,  // albedo, filtered after decoding gamma 2.2
+    NORMAL  // tangent space normals in [0,1], renormalized per level
+};
+
+// All levels of an RGBA8 image down to 1x1, level 0 is a copy of the input
+std::vector<std::vector<unsigned char>> generateMipChain(const unsigned char *rgba, int width, int height, MipMode mode);
+
+// Number of levels in a full chain
+int numMipLevels(int width, int height);
@@ -1,16 +1,95 @@
 #include "Model.hpp"
 #include "utils.hpp"
+#include "MeshCache.hpp"
+#include "MeshOptimizer.hpp"
+#include "RenderQueue.hpp"
+#include "ResourceRegistry.hpp"
+#include "VirtualFS.hpp"
+#include "AssimpIO.hpp"
 #include <iostream>
 #include <algorithm>
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
 
-Model::Model(std::string path) {
+// Geometry read from disk, not yet uploaded
+struct ModelSource {
+    std::string dirPath;
+    vector<MeshView> views;
+    shared_ptr<const void> storage; // mesh cache mapping or imported data the views point into
+};
+
+// Coarser levels stop once they would deviate from the full mesh by more than this fraction of its size
+static const size_t MAX_LODS = 5;
+static const float LOD_MAX_ERROR = 0.05f;
+
+float Model::lodErrorPixels = 1.0f; // static
+float Model::shadowLODBias = 4.0f; // static
+
+// Split meshes with more vertices than 16-bit indices can address
+static void splitLargeMeshes(vector<MeshData> &meshes) {
+    vector<MeshData> result;
+    for (MeshData &m : meshes) {
+        if (m.vertices.size() <= Mesh::MAX_SHORT_VERTICES || m.indices.size() % 3 != 0) {
+            result.push_back(std::move(m));
+            continue;
+        }
+
+        vector<vector<Vertex>> partVertices;
+        vector<vector<unsigned int>> partIndices;
+        splitMesh(m.vertices, m.indices, Mesh::MAX_SHORT_VERTICES, partVertices, partIndices);
+        for (size_t i = 0; i < partVertices.size(); i++) {
+            MeshData part;
+            part.vertices = std::move(partVertices[i]);
+            part.indices = std::move(partIndices[i]);
+            part.material = m.material;
+            part.textures = m.textures;
+            for (const Vertex &v : part.vertices) {
+                part.aabb.expand(v.position);
+            }
+            result.push_back(std::move(part));
+        }
+    }
+
+    meshes.swap(result);
+}
+
+// Append simplified index buffers, each about half the previous one, and record their ranges
+static void generateLODs(MeshData &m) {
+    if (m.indices.size() % 3 != 0 || m.indices.empty())
+        return;
+
+    const float maxError = LOD_MAX_ERROR * glm::length(m.aabb.maxs - m.aabb.mins);
+    m.lods.push_back({ 0, (uint32_t)m.indices.size(), 0.0f });
+
+    vector<unsigned int> current = m.indices;
+    float error = 0.0f;
+    while (m.lods.size() < MAX_LODS) {
+        // Each level is simplified from the previous one, so their errors add up
+        float levelError;
+        vector<unsigned int> lod = simplifyMesh(m.vertices, current, current.size() / 6 * 3, maxError - error, &levelError);
+        if (lod.empty() || lod.size() > current.size() * 3 / 4)
+            break;
+
+        vector<size_t> clusters;
+        optimizeVertexCache(lod, m.vertices.size(), clusters);
+        error += levelError;
+        m.lods.push_back({ (uint32_t)m.indices.size(), (uint32_t)lod.size(), error });
+        m.indices.insert(m.indices.end(), lod.begin(), lod.end());
+        current.swap(lod);
+    }
+
+    if (m.lods.size() == 1)
+        m.lods.clear();
+}
+
+Model::Model(std::string path) : Model(readSource(path)) {}
+
+// Buffers and textures are streamed in by the upload queue
+Model::Model(shared_ptr<ModelSource> source) {
     setXform(glm::mat4(1.0f));
-    importMesh(path);
+    createMeshes(*source);
     calculateAABB();
-    texCache.clear();
 }
 
 Model::Model(Mesh & m) {
@@ -18,22 +97,81 @@ Model::Model(Mesh & m) {
     addMesh(m);
 }
 
-// Assumes correct program is active
-void Model::render(GLProgram *prog) {
-    prog->setUniform("M", M);
-    prog->setUniform("M_it", M_it);
+void Model::enqueue(RenderQueue &queue, const glm::vec3 &cameraPos) {
+    const float maxError = (pixelsPerUnit > 0.0f) ? lodErrorPixels / pixelsPerUnit : 0.0f;
     for (Mesh &m : meshes) {
-        m.setupGGXParams(prog);
-        m.render(prog);
+        const AABB box = m.getAABB();
+        if (!insideView(box))
+            continue;
+
+        const glm::vec3 center = glm::vec3(M * glm::vec4(0.5f * (box.mins + box.maxs), 1.0f));
+        const float depth = glm::length(center - cameraPos);
+        RenderQueue::Draw draw = { this, &m, m.selectLOD(maxError), hasView ? &clusterView : nullptr };
+        queue.push(RenderQueue::makeKey(RenderQueue::PASS_OPAQUE, m.textureSet(), m.vertexArray(), depth), draw);
+    }
+}
+
+// Box (object space) not entirely outside one of the frustum planes
+bool Model::insideView(const AABB &box) const {
+    if (!hasView)
+        return true;
+
+    for (const glm::vec4 &p : clusterView.planes) {
+        // Corner furthest along the plane normal
+        const glm::vec3 corner(p.x > 0.0f ? box.maxs.x : box.mins.x,
+                               p.y > 0.0f ? box.maxs.y : box.mins.y,
+                               p.z > 0.0f ? box.maxs.z : box.mins.z);
+        if (glm::dot(glm::vec3(p), corner) + p.w < 0.0f)
+            return false;
     }
+    return true;
 }
 
-// For shadow map depth pass
-void Model::renderUnshaded(GLProgram *prog) {
-    prog->setUniform("M", M);
+// For shadow map depth passes, which see more than the camera frustum
+void Model::enqueueShadowCasters(RenderQueue &queue) {
+    const float maxError = (pixelsPerUnit > 0.0f) ? lodErrorPixels * shadowLODBias / pixelsPerUnit : 0.0f;
     for (Mesh &m : meshes) {
-        m.render(prog);
+        RenderQueue::Draw draw = { this, &m, m.selectLOD(maxError), nullptr };
+        queue.push(RenderQueue::makeKey(RenderQueue::PASS_SHADOW, 0, m.vertexArray(), 0.0f), draw);
+    }
+}
+
+// Frustum planes and camera position in object space, for culling meshlets
+void Model::updateClusterView(const glm::mat4 &V, const glm::mat4 &P, bool backfacesCulled) {
+    // Rows of the combined matrix (Gribb and Hartmann)
+    const glm::mat4 T = glm::transpose(P * V * M);
+    for (int i = 0; i < 3; i++) {
+        clusterView.planes[2 * i] = T[3] + T[i];
+        clusterView.planes[2 * i + 1] = T[3] - T[i];
+    }
+
+    clusterView.position = glm::vec3(glm::inverse(V * M) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    const float det = glm::dot(glm::cross(glm::vec3(M[0]), glm::vec3(M[1])), glm::vec3(M[2]));
+    clusterView.cullBackfaces = backfacesCulled && P[3][3] == 0.0f && det > 0.0f;
+    hasView = true;
+}
+
+// Scale from object space to pixels at the point of the bounding box nearest to the camera
+void Model::updateView(const glm::mat4 &V, const glm::mat4 &P, float viewportHeight, bool backfacesCulled) {
+    updateClusterView(V, P, backfacesCulled);
+    if (aabb.mins.x > aabb.maxs.x) {
+        pixelsPerUnit = 0.0f;
+        return;
     }
+
+    float scale = 0.0f;
+    for (int c = 0; c < 3; c++) {
+        scale = std::max(scale, glm::length(glm::vec3(M[c])));
+    }
+    const glm::vec3 center = glm::vec3(V * M * glm::vec4((aabb.mins + aabb.maxs) * 0.5f, 1.0f));
+    const float radius = 0.5f * glm::length(aabb.maxs - aabb.mins) * scale;
+
+    // Perspective projections divide by distance, orthographic ones do not
+    float w = 1.0f;
+    if (P[3][3] == 0.0f)
+        w = std::max(glm::length(center) - radius, 1e-4f);
+
+    pixelsPerUnit = P[1][1] * 0.5f * viewportHeight * scale / w;
 }
 
 void Model::normalizeScale() {
@@ -62,16 +200,17 @@ std::vector<Material*> Model::getMaterials() {
     return materials;
 }
 
+// Textures are decoded once and shared by all meshes
 void Model::loadPBRTextures(std::map<std::string, std::string>& paths) {
+    vector<shared_ptr<Texture>> textures = Mesh::createPBRTextures(paths);
     for (Mesh &m : meshes) {
-        m.loadPBRTextures(paths);
+        m.setTextures(textures);
     }
 }
 
 void Model::loadPBRTextures(std::string path) {
-    for (Mesh &m : meshes) {
-        m.loadPBRTextures(path);
-    }
+    std::map<std::string, std::string> paths = Mesh::defaultPBRPaths(path);
+    loadPBRTextures(paths);
 }
 
 Model& Model::scale(float s) {
@@ -84,42 +223,121 @@ Model& Model::translate(float x, float y, float z) {
     return *this;
 }
 
-void Model::importMesh(std::string path) {
+// Flags affect the imported geometry, so they are part of the cache key
+static const unsigned int IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_FlipUVs;
+
+shared_ptr<ModelSource> Model::readSource(std::string path) {
+    shared_ptr<ModelSource> source = std::make_shared<ModelSource>();
+
+    // Save directory for texture loading
+    source->dirPath = path.substr(0, path.find_last_of('/'));
+
+    // Try to map previously imported geometry
+    const bool packed = Mesh::compactVertices;
+    size_t key = MeshCache::cacheKey(path, IMPORT_FLAGS, packed);
+    std::string cachePath = MeshCache::cachePath(key);
+    shared_ptr<MeshCache> cache;
+    if (VFS::instance().exists(cachePath)) {
+        try {
+            cache = std::make_shared<MeshCache>(cachePath, key);
+        }
+        catch (std::runtime_error &e) {
+            std::cout << "Ignoring mesh cache: " << e.what() << std::endl;
+        }
+    }
+
+    if (cache) {
+        for (size_t i = 0; i < cache->numMeshes(); i++) {
+            source->views.push_back(cache->getMesh(i));
+        }
+        source->storage = cache;
+        return source;
+    }
+
+    // Importer owns the IO handler
     Assimp::Importer importer;
-    const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+    importer.SetIOHandler(new VFSIOSystem());
+    const aiScene *scene = importer.ReadFile(path, IMPORT_FLAGS);
 
     if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
         std::cout << "ASSIMP error: " << importer.GetErrorString() << std::endl;
         throw std::runtime_error("Model loading failed!");
     }
 
-    // Save directory for texture loading
-    dirPath = path.substr(0, path.find_last_of('/'));
-    recurseNodes(scene->mRootNode, scene);
+    shared_ptr<vector<MeshData>> data = std::make_shared<vector<MeshData>>();
+    recurseNodes(scene->mRootNode, scene, *data);
+
+    // Weld and reorder for the vertex cache, overdraw and vertex fetch
+    VertexCacheStats before, after;
+    for (MeshData &m : *data) {
+        VertexCacheStats b, a;
+        optimizeMesh(m.vertices, m.indices, &b, &a);
+        before.add(b);
+        after.add(a);
+    }
+    std::cout << "Optimized " << path << ": ACMR " << before.acmr() << " -> " << after.acmr()
+              << ", ATVR " << before.atvr() << " -> " << after.atvr() << std::endl;
+
+    // Meshlets and levels of detail, then 16-bit indices wherever the vertex count allows
+    splitLargeMeshes(*data);
+    size_t triangles = 0, lodTriangles = 0;
+    for (MeshData &m : *data) {
+        m.meshlets = buildMeshlets(m.vertices, m.indices);
+        generateLODs(m);
+        triangles += (m.lods.empty() ? m.indices.size() : m.lods[0].numIndices) / 3;
+        lodTriangles += m.lods.empty() ? 0 : (m.indices.size() - m.lods[0].numIndices) / 3;
+
+        if (m.vertices.size() <= Mesh::MAX_SHORT_VERTICES) {
+            m.shortIndices.assign(m.indices.begin(), m.indices.end());
+            vector<unsigned int>().swap(m.indices);
+        }
+    }
+    std::cout << "LODs for " << path << ": " << triangles << " triangles, " << lodTriangles << " in coarser levels" << std::endl;
+
+    // Packed here, off the GL thread, so that cached and fresh imports stream the same data
+    if (packed) {
+        for (MeshData &m : *data) {
+            m.packed = Mesh::pack(m.vertices.data(), m.vertices.size(), m.aabb);
+            vector<Vertex>().swap(m.vertices);
+        }
+    }
+    MeshCache::write(cachePath, key, *data);
+
+    source->views.assign(data->begin(), data->end());
+    source->storage = data;
+    return source;
+}
+
+std::vector<std::pair<std::string, TextureMask>> Model::textureReferences(const ModelSource &source) {
+    std::vector<std::pair<std::string, TextureMask>> refs;
+    for (const MeshView &view : source.views) {
+        for (auto &t : view.textures) {
+            refs.push_back(std::make_pair(source.dirPath + '/' + t.second, t.first));
+        }
+    }
+    return refs;
 }
 
 // Recursively process current node and its children
-void Model::recurseNodes(aiNode * node, const aiScene * scene) {
+void Model::recurseNodes(aiNode * node, const aiScene * scene, vector<MeshData> &target) {
     for (unsigned int i = 0; i < node->mNumMeshes; i++) {
         aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-        meshes.push_back(createMesh(mesh, scene));
+        target.push_back(MeshData());
+        extractMesh(mesh, scene, target.back());
     }
     for (unsigned int i = 0; i < node->mNumChildren; i++) {
-        recurseNodes(node->mChildren[i], scene);
+        recurseNodes(node->mChildren[i], scene, target);
     }
 }
 
-// Create mesh object from an aiMesh struct
-Mesh Model::createMesh(aiMesh * mesh, const aiScene * scene) {
-    std::vector<Vertex> vertices;
-    std::vector<unsigned int> indices;
-    std::vector<shared_ptr<Texture>> textures;
-    
+// Copy vertices, indices and material out of an aiMesh struct
+void Model::extractMesh(aiMesh * mesh, const aiScene * scene, MeshData &target) {
     auto spread = [](glm::vec3 &v1, aiVector3D &v2) {
         for (int i = 0; i < 3; i++) v1[i] = v2[i];
     };
     
     // Fill vertices
+    target.vertices.reserve(mesh->mNumVertices);
     for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
         Vertex v;
         spread(v.position, mesh->mVertices[i]);
@@ -131,35 +349,36 @@ Mesh Model::createMesh(aiMesh * mesh, const aiScene * scene) {
             v.texCoords.y = mesh->mTextureCoords[0][i].y;
         }
 
-        vertices.push_back(v);
+        target.vertices.push_back(v);
+        target.aabb.expand(v.position);
     }
 
     // Fill indices
     for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
         aiFace face = mesh->mFaces[i];
         for (unsigned int j = 0; j < face.mNumIndices; j++) {
-            indices.push_back(face.mIndices[j]);
+            target.indices.push_back(face.mIndices[j]);
         }
     }
 
     // Material
     aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
-    Material mat = Material();
+    Material &mat = target.material;
     material->Get(AI_MATKEY_COLOR_DIFFUSE, mat.Kd);
     material->Get(AI_MATKEY_SHININESS, mat.alpha);
     // Remapping (from Simon's tech blog)
     if (mat.alpha > 1.0f) {
         mat.alpha = sqrt(2.0f / (mat.alpha + 2.0f));
     }
-    loadTextures(material, aiTextureType_DIFFUSE, textures);
-    loadTextures(material, aiTextureType_NORMALS, textures);
-    loadTextures(material, aiTextureType_SHININESS, textures);
-    std::for_each(textures.begin(), textures.end(), [&mat](shared_ptr<Texture> &t) { mat.texMask |= t->type; });
-
-    return Mesh(vertices, indices, textures, mat);
+    collectTextures(material, aiTextureType_DIFFUSE, target);
+    collectTextures(material, aiTextureType_NORMALS, target);
+    collectTextures(material, aiTextureType_SHININESS, target);
+    for (auto &t : target.textures) {
+        mat.texMask |= t.first;
+    }
 }
 
-void Model::loadTextures(aiMaterial *mat, aiTextureType type, std::vector<shared_ptr<Texture>>& target) {
+void Model::collectTextures(aiMaterial *mat, aiTextureType type, MeshData &target) {
     unsigned int count = mat->GetTextureCount(type);
 
     if (count > 1)
@@ -168,26 +387,44 @@ void Model::loadTextures(aiMaterial *mat, aiTextureType type, std::vector<shared
     for (unsigned int i = 0; i < count; i++) {
         aiString str;
         mat->GetTexture(type, i, &str);
-       
-        // Check for duplicates
-        auto match = std::find_if(texCache.begin(), texCache.end(), [str](shared_ptr<Texture> &t) {
-            return !std::strcmp(t->path.data(), str.C_Str()); // strcmp returns 0 for match
-        });
-
-        if (match == texCache.end()) {
-            shared_ptr<Texture> texture = std::make_shared<Texture>();
-            texture->id = textureFromFile(this->dirPath + '/' + str.C_Str());
-            texture->type = texTypeToMask(type);
-            texture->path = str.C_Str();
-            target.push_back(texture);
-            texCache.push_back(texture);
-        }
-        else {
-            target.push_back(*match);
-        }
+        target.textures.push_back(std::make_pair(texTypeToMask(type), std::string(str.C_Str())));
     }
 }
 
+void Model::createMeshes(const ModelSource &source) {
+    dirPath = source.dirPath;
+    for (const MeshView &v : source.views) {
+        meshes.push_back(createMesh(v, source.storage));
+    }
+}
+
+// Create buffers, resolve texture references
+Mesh Model::createMesh(const MeshView &view, shared_ptr<const void> owner) {
+    std::vector<shared_ptr<Texture>> textures;
+    for (auto &t : view.textures) {
+        shared_ptr<Texture> tex = ResourceRegistry::instance().getTexture(dirPath + '/' + t.second, t.first);
+        if (tex)
+            textures.push_back(tex);
+    }
+
+    const void *indices = view.shortIndices ? (const void*)view.shortIndices : (const void*)view.indices;
+    const GLenum indexType = view.shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+    if (view.packed) {
+        Mesh mesh(view.packed, view.numVertices, indices, view.numIndices, indexType, view.aabb, view.material, owner);
+        mesh.setTextures(textures);
+        mesh.setLODs(view.lods);
+        mesh.setMeshlets(view.meshlets);
+        return mesh;
+    }
+
+    Mesh mesh(view.vertices, view.numVertices, indices, view.numIndices, indexType, view.aabb, view.material, owner);
+    mesh.setTextures(textures);
+    mesh.setLODs(view.lods);
+    mesh.setMeshlets(view.meshlets);
+    return mesh;
+}
+
 void Model::calculateAABB() {
     for (Mesh &m : meshes) {
         AABB box = m.getAABB();
@@ -11,19 +11,34 @@
 
 using std::shared_ptr;
 
-class GLProgram;
+class RenderQueue;
+struct MeshData;
+struct MeshView;
+struct ModelSource;
 class Model
 {
 public:
     Model(std::string path);
+    Model(shared_ptr<ModelSource> source);
     Model(Mesh &m);
     Model(void) {};
     ~Model() = default;
 
-    void render(GLProgram *prog);
-    void renderUnshaded(GLProgram *prog);
+    // Queue the meshes inside the view frustum, ordered by distance from cameraPos (world space)
+    void enqueue(RenderQueue &queue, const glm::vec3 &cameraPos);
+    // Queue every mesh for the shadow maps, grouped by geometry only
+    void enqueueShadowCasters(RenderQueue &queue);
+
+    // Pick levels of detail and cull meshlets in the following render calls for this camera.
+    // Meshlets facing away are only dropped if the draws cull back faces as well.
+    void updateView(const glm::mat4 &V, const glm::mat4 &P, float viewportHeight, bool backfacesCulled);
+
+    // Largest projected LOD error in pixels, shadow passes allow shadowLODBias times more
+    static float lodErrorPixels;
+    static float shadowLODBias;
     
     glm::mat4 getXform() { return M; }
+    const glm::mat4& getNormalXform() const { return M_it; }
     void setXform(glm::mat4 m) { M = m; M_it = glm::transpose(glm::inverse(m)); }
     void normalizeScale();
 
@@ -43,17 +58,28 @@ public:
     Model& scale(float s);
     Model& translate(float x, float y, float z);
 
+    // Read geometry from the mesh cache or through Assimp, safe to call on any thread
+    static shared_ptr<ModelSource> readSource(std::string path);
+
+    // Texture files referenced by the materials of a source
+    static std::vector<std::pair<std::string, TextureMask>> textureReferences(const ModelSource &source);
+
 private:
-    void importMesh(std::string path);
-    void recurseNodes(aiNode *node, const aiScene *scene);
-    Mesh createMesh(aiMesh * mesh, const aiScene * scene);
-    void loadTextures(aiMaterial *mat, aiTextureType type, std::vector<shared_ptr<Texture>> &target);
+    static void recurseNodes(aiNode *node, const aiScene *scene, vector<MeshData> &target);
+    static void extractMesh(aiMesh *mesh, const aiScene *scene, MeshData &target);
+    static void collectTextures(aiMaterial *mat, aiTextureType type, MeshData &target);
+    void createMeshes(const ModelSource &source);
+    Mesh createMesh(const MeshView &view, shared_ptr<const void> owner);
     void calculateAABB();
+    void updateClusterView(const glm::mat4 &V, const glm::mat4 &P, bool backfacesCulled);
+    bool insideView(const AABB &box) const;
 
     AABB aabb;
     glm::mat4 M; // model transform
     glm::mat4 M_it; // inverse transpose of M
     vector<Mesh> meshes;
-    vector<shared_ptr<Texture>> texCache;
     std::string dirPath;
+    float pixelsPerUnit = 0.0f; // object space to screen, 0 selects full detail
+    ClusterView clusterView;
+    bool hasView = false;
 };
@@ -0,0 +1,247 @@
+#include "RenderQueue.hpp"
+#include "Model.hpp"
+#include "GLState.hpp"
+#include "utils.hpp"
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+const GLuint RenderQueue::DRAW_INDEX_ATTRIB;
+const unsigned int RenderQueue::DRAW_DATA_UNIT;
+const size_t RenderQueue::MAX_DRAWS;
+
+bool RenderQueue::useIndirect = true; // static
+
+static const UniformID U_DRAW_DATA("drawData");
+
+static_assert(sizeof(DrawCommand) == 5 * sizeof(GLuint), "Indirect commands must be tightly packed");
+
+RenderQueue::~RenderQueue() {
+    glDeleteTextures(1, &dataTexture);
+    glDeleteBuffers(1, &dataBuffer);
+    glDeleteBuffers(1, &commandBuffer);
+}
+
+bool RenderQueue::baseInstanceSupported() {
+    static const bool supported = glSupports(4, 2, "GL_ARB_base_instance");
+    return supported;
+}
+
+bool RenderQueue::indirectSupported() {
+    static const bool supported = baseInstanceSupported() && glSupports(4, 3, "GL_ARB_multi_draw_indirect");
+    return supported;
+}
+
+size_t RenderQueue::maxDraws() {
+    static size_t draws = 0;
+    if (draws == 0) {
+        GLint texels = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &texels);
+        draws = std::min(MAX_DRAWS, (size_t)texels * sizeof(glm::vec4) / sizeof(DrawData));
+    }
+    return draws;
+}
+
+// Instanced attribute over 0, 1, 2, ... so that instance 0 of a draw reads its base instance
+void RenderQueue::setupDrawIndex() {
+    if (!baseInstanceSupported())
+        return;
+
+    static GLuint instanceIDs = 0;
+    if (instanceIDs == 0) {
+        std::vector<GLuint> ids(MAX_DRAWS);
+        for (size_t i = 0; i < ids.size(); i++) {
+            ids[i] = (GLuint)i;
+        }
+        glGenBuffers(1, &instanceIDs);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceIDs);
+        glBufferData(GL_ARRAY_BUFFER, ids.size() * sizeof(GLuint), ids.data(), GL_STATIC_DRAW);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, instanceIDs);
+    glEnableVertexAttribArray(DRAW_INDEX_ATTRIB);
+    glVertexAttribIPointer(DRAW_INDEX_ATTRIB, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+    glVertexAttribDivisor(DRAW_INDEX_ATTRIB, 1);
+}
+
+uint64_t RenderQueue::makeKey(unsigned int pass, unsigned int textureSet, unsigned int vertexArray, float depth) {
+    // Non-negative floats order like their bit patterns, the top 30 bits keep 21 of the mantissa
+    uint32_t depthBits;
+    std::memcpy(&depthBits, &depth, sizeof(depthBits));
+
+    return ((uint64_t)(pass & 0x3) << 62) |
+           ((uint64_t)(textureSet & 0xFFFF) << 46) |
+           ((uint64_t)(vertexArray & 0xFFFF) << 30) |
+           (uint64_t)(depthBits >> 2);
+}
+
+// Uploaded batches point into the draws
+void RenderQueue::clear() {
+    draws.clear();
+    entries.clear();
+    batches.clear();
+    commands.clear();
+}
+
+void RenderQueue::push(uint64_t key, const Draw &draw) {
+    Entry e;
+    e.key = key;
+    e.draw = (uint32_t)draws.size();
+    entries.push_back(e);
+    draws.push_back(draw);
+}
+
+void RenderQueue::sort() {
+    const size_t n = entries.size();
+    if (n < 2)
+        return;
+
+    // Histograms of all eight bytes in one pass
+    size_t counts[8][256] = {};
+    for (const Entry &e : entries) {
+        for (int b = 0; b < 8; b++) {
+            counts[b][(e.key >> (8 * b)) & 0xFF]++;
+        }
+    }
+
+    scratch.resize(n);
+    Entry *src = entries.data();
+    Entry *dst = scratch.data();
+    for (int b = 0; b < 8; b++) {
+        // Every key has the same value in this byte, the order stays as it is
+        if (counts[b][(src[0].key >> (8 * b)) & 0xFF] == n)
+            continue;
+
+        size_t offsets[256];
+        size_t sum = 0;
+        for (int i = 0; i < 256; i++) {
+            offsets[i] = sum;
+            sum += counts[b][i];
+        }
+        for (size_t i = 0; i < n; i++) {
+            dst[offsets[(src[i].key >> (8 * b)) & 0xFF]++] = src[i];
+        }
+        std::swap(src, dst);
+    }
+
+    if (src != entries.data())
+        entries.swap(scratch);
+}
+
+void RenderQueue::upload(bool textured) {
+    this->textured = textured;
+    indirect = useIndirect && indirectSupported();
+    batches.clear();
+    commands.clear();
+    drawData.clear();
+    calls = 0;
+
+    for (const Entry &e : entries) {
+        if (drawData.size() == maxDraws()) {
+            static bool warned = false;
+            if (!warned)
+                std::cout << "WARN: " << entries.size() << " draws queued, only " << maxDraws() << " are drawn" << std::endl;
+            warned = true;
+            break;
+        }
+
+        const Draw &d = draws[e.draw];
+        const size_t first = commands.size();
+        d.mesh->appendDraws(commands, d.lod, d.view, (GLuint)drawData.size());
+        if (commands.size() == first)
+            continue;
+
+        const Material &mat = d.mesh->getMaterial();
+        DrawData data = {};
+        data.M = d.model->getXform();
+        data.M_it = d.model->getNormalXform();
+        data.Kd = mat.Kd;
+        data.metallic = mat.metallic;
+        d.mesh->positionDecode(data.posScale, data.posOffset);
+        data.shininess = mat.alpha;
+        data.texMask = (float)d.mesh->residentTextures();
+        drawData.push_back(data);
+
+        // Extend the last batch while the geometry (and textures) stay the same
+        if (!batches.empty()) {
+            const Mesh *last = batches.back().mesh;
+            if (last->vertexArray() == d.mesh->vertexArray() && (!textured || last->textureSet() == d.mesh->textureSet())) {
+                batches.back().numCommands += commands.size() - first;
+                continue;
+            }
+        }
+        Batch b = { d.mesh, first, commands.size() - first };
+        batches.push_back(b);
+    }
+
+    if (dataBuffer == 0) {
+        glGenBuffers(1, &dataBuffer);
+        glGenBuffers(1, &commandBuffer);
+        glGenTextures(1, &dataTexture);
+        glBindBuffer(GL_TEXTURE_BUFFER, dataBuffer);
+        GLState::instance().bindTexture(DRAW_DATA_UNIT, GL_TEXTURE_BUFFER, dataTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, dataBuffer);
+    }
+
+    // New storage each frame, the driver keeps the old one until the GPU is done with it
+    glBindBuffer(GL_TEXTURE_BUFFER, dataBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, drawData.size() * sizeof(DrawData), drawData.data(), GL_STREAM_DRAW);
+    if (indirect) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawCommand), commands.data(), GL_STREAM_DRAW);
+    }
+    glCheckError();
+}
+
+void RenderQueue::submit(GLProgram *prog) {
+    if (batches.empty())
+        return;
+
+    GLState &gl = GLState::instance();
+    gl.bindTexture(DRAW_DATA_UNIT, GL_TEXTURE_BUFFER, dataTexture);
+    prog->setUniform(U_DRAW_DATA, (int)DRAW_DATA_UNIT);
+    if (indirect)
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+
+    for (const Batch &b : batches) {
+        if (textured)
+            b.mesh->bindTextures();
+        b.mesh->bindGeometry(prog);
+
+        const GLenum type = b.mesh->getIndexType();
+        if (indirect) {
+            glMultiDrawElementsIndirect(GL_TRIANGLES, type, (const void*)(b.firstCommand * sizeof(DrawCommand)), (GLsizei)b.numCommands, 0);
+            calls++;
+            continue;
+        }
+
+        const size_t indexSize = (type == GL_UNSIGNED_SHORT) ? sizeof(uint16_t) : sizeof(unsigned int);
+        const DrawCommand *c = commands.data() + b.firstCommand;
+        const DrawCommand *end = c + b.numCommands;
+        if (baseInstanceSupported()) {
+            for (; c != end; c++) {
+                glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, c->count, type, (const void*)(c->firstIndex * indexSize), 1,
+                                                              c->baseVertex, c->baseInstance);
+                calls++;
+            }
+            continue;
+        }
+
+        // Constant draw index, the ranges of one draw go in one call
+        while (c != end) {
+            const GLuint drawIndex = c->baseInstance;
+            counts.clear();
+            offsets.clear();
+            baseVertices.clear();
+            for (; c != end && c->baseInstance == drawIndex; c++) {
+                counts.push_back((GLsizei)c->count);
+                offsets.push_back((const void*)(c->firstIndex * indexSize));
+                baseVertices.push_back(c->baseVertex);
+            }
+            glVertexAttribI1ui(DRAW_INDEX_ATTRIB, drawIndex);
+            glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), type, offsets.data(), (GLsizei)counts.size(), baseVertices.data());
+            calls++;
+        }
+    }
+    glCheckError();
+}
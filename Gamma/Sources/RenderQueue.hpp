@@ -0,0 +1,138 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "Mesh.hpp"
+
+/*
+    Draws of a frame, submitted in an order that minimizes state changes.
+
+    Each draw is described by a 64-bit key, from the most significant bit:
+    pass (2 bits), texture set (16), vertex array (16) and depth (30). All
+    draws of a pass use one program. Sorting by key groups the draws sharing
+    a set of textures, then geometry. Draws that share both are ordered
+    front to back, so early depth testing still rejects fragments hidden
+    behind earlier draws.
+
+    Keys are sorted with an LSD radix sort over bytes. Bytes that are equal
+    in every key (such as the pass, usually) cost only the histogram.
+
+    The sorted draws are uploaded once per frame: their transforms,
+    materials and position dequantization go to a texture buffer read in
+    draw_data.glh, and draws that share a vertex array (and textures, if
+    bound) form a batch of indirect commands. The base instance of each
+    command selects its data through an instanced attribute, so with GL 4.3
+    or ARB_multi_draw_indirect a batch is one glMultiDrawElementsIndirect
+    however many draws it holds. Shadow maps submit the same upload once
+    per light.
+
+    Meshes are sub-allocated from a few shared geometry arenas (one per
+    vertex layout and index type, GeometryArena.hpp) and addressed with
+    baseVertex and firstIndex, so untextured passes such as the shadow maps
+    need one call per arena. Material textures are still bound per batch:
+    the shading pass costs one call per texture set in view, not one per
+    mesh, but does grow with the number of different materials.
+
+    Without multi-draw indirect the commands are issued one by one. Without
+    GL 4.2 or ARB_base_instance the draw index is a constant attribute set
+    before each draw instead.
+*/
+
+class Model;
+
+class RenderQueue {
+public:
+    enum Pass { PASS_OPAQUE = 0, PASS_SHADOW = 1 };
+
+    struct Draw {
+        Model *model;
+        Mesh *mesh;
+        size_t lod;
+        const ClusterView *view; // meshlet culling, may be null
+    };
+
+    RenderQueue(void) = default;
+    ~RenderQueue();
+
+    RenderQueue(const RenderQueue&) = delete;
+    RenderQueue& operator=(const RenderQueue&) = delete;
+
+    // Fields wider than their bits are truncated, depth must not be negative
+    static uint64_t makeKey(unsigned int pass, unsigned int textureSet, unsigned int vertexArray, float depth);
+
+    void clear();
+    void push(uint64_t key, const Draw &draw);
+    void sort();
+
+    // Batch the sorted draws and upload their data and commands, batches bind textures if textured
+    void upload(bool textured = true);
+    // Draw the uploaded batches in key order with prog, which must be in use. Can be repeated.
+    void submit(GLProgram *prog);
+
+    size_t size() const { return draws.size(); }
+    size_t numBatches() const { return batches.size(); }
+    size_t numCommands() const { return commands.size(); }
+    size_t drawCalls() const { return calls; } // GL draw calls since upload()
+
+    // Point the draw index attribute of the bound vertex array at the instance IDs, if used
+    static void setupDrawIndex();
+    static bool indirectSupported();
+
+    // Submit batches with glMultiDrawElementsIndirect where supported
+    static bool useIndirect;
+
+    static const GLuint DRAW_INDEX_ATTRIB = 3;
+    static const unsigned int DRAW_DATA_UNIT = 7;
+    static const size_t MAX_DRAWS = 1 << 16; // per upload, more are dropped
+
+private:
+    struct Entry {
+        uint64_t key;
+        uint32_t draw;
+    };
+
+    // Draws with the same geometry arena and textures, consecutive commands
+    struct Batch {
+        Mesh *mesh;
+        size_t firstCommand;
+        size_t numCommands;
+    };
+
+    // Layout of draw_data.glh, DRAW_DATA_TEXELS RGBA32F texels
+    struct DrawData {
+        glm::mat4 M;
+        glm::mat4 M_it;    // inverse transpose
+        glm::vec3 Kd;
+        float metallic;
+        glm::vec3 posScale;
+        float shininess;
+        glm::vec3 posOffset;
+        float texMask;     // small integer, exact as float
+    };
+    static_assert(sizeof(DrawData) == 11 * sizeof(glm::vec4), "DrawData must match draw_data.glh");
+
+    // MAX_DRAWS, or fewer if the texture buffer cannot hold their data
+    static size_t maxDraws();
+
+    static bool baseInstanceSupported();
+
+    std::vector<Draw> draws;
+    std::vector<Entry> entries;
+    std::vector<Entry> scratch; // radix sort ping-pong buffer, reused between frames
+
+    std::vector<Batch> batches;
+    std::vector<DrawCommand> commands;
+    std::vector<DrawData> drawData;
+    std::vector<GLsizei> counts; // multi-draw arguments without base instances
+    std::vector<const void*> offsets;
+    std::vector<GLint> baseVertices;
+    bool textured = true;
+    bool indirect = false; // commands uploaded for glMultiDrawElementsIndirect
+    size_t calls = 0;
+
+    GLuint dataBuffer = 0;
+    GLuint dataTexture = 0;
+    GLuint commandBuffer = 0;
+};
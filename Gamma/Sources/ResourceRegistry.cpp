@@ -0,0 +1,125 @@
+#include "ResourceRegistry.hpp"
+#include "Mesh.hpp"
+#include "ImageLoader.hpp"
+#include "UploadQueue.hpp"
+#include "TextureCompression.hpp"
+#include "utils.hpp"
+
+ResourceRegistry& ResourceRegistry::instance() {
+    static ResourceRegistry registry;
+    return registry;
+}
+
+// Paths that are not uploaded below drop their prefetched image, nothing else would free it
+std::shared_ptr<Texture> ResourceRegistry::getTexture(const std::string &path, TextureMask type) {
+    const GLenum format = TextureCompression::enabled ? TextureCompression::formatFor(type) : 0;
+
+    size_t parts[3];
+    try {
+        parts[0] = fileHash(path);
+        parts[1] = (size_t)type;
+        parts[2] = (size_t)format;
+    }
+    catch (std::runtime_error&) {
+        cancelPrefetch(path);
+        return nullptr;
+    }
+
+    const size_t key = computeHash(parts, sizeof(parts));
+    auto match = textures.find(key);
+    if (match != textures.end()) {
+        std::shared_ptr<Texture> tex = match->second.texture.lock();
+        if (tex) {
+            cancelPrefetch(path);
+            savedBytes += tex->bytes;
+            return tex;
+        }
+    }
+
+    prune();
+
+    std::shared_ptr<Texture> tex = std::make_shared<Texture>();
+    tex->path = path;
+    tex->type = type;
+    // Mips are built on the thread pool
+    const MipMode mode = mipMode(type);
+    UploadQueue::instance().enqueueTexture(tex, format ? loadCompressedAsync(path, format, mode) : loadMipmappedAsync(path, mode));
+
+    // The size is recorded by the upload queue once the image has been decoded
+    textures[key].texture = tex;
+    return tex;
+}
+
+void ResourceRegistry::prefetchTextures(const std::vector<std::pair<std::string, TextureMask>> &textures) {
+    std::vector<std::string> paths;
+    for (const auto &t : textures) {
+        const GLenum format = TextureCompression::enabled ? TextureCompression::formatFor(t.second) : 0;
+        if (format && hasCompressedCache(t.first, format, mipMode(t.second)))
+            continue;
+        paths.push_back(t.first);
+    }
+    prefetchImages(paths);
+}
+
+MipMode ResourceRegistry::mipMode(TextureMask type) {
+    if (type == TextureMask::DIFFUSE)
+        return MipMode::COLOR;
+    else if (type == TextureMask::NORMAL)
+        return MipMode::NORMAL;
+    else
+        return MipMode::LINEAR;
+}
+
+bool ResourceRegistry::findGeometry(size_t key, std::shared_ptr<GeometryRange> &geometry) {
+    auto match = meshes.find(key);
+    if (match == meshes.end())
+        return false;
+
+    MeshEntry &e = match->second;
+    std::shared_ptr<GeometryRange> found = e.geometry.lock();
+    if (!found)
+        return false;
+
+    savedBytes += e.bytes;
+    geometry = found;
+    return true;
+}
+
+void ResourceRegistry::addGeometry(size_t key, const std::shared_ptr<GeometryRange> &geometry, size_t bytes) {
+    prune();
+
+    MeshEntry &e = meshes[key];
+    e.geometry = geometry;
+    e.bytes = bytes;
+}
+
+size_t ResourceRegistry::geometryKey(const void *vertices, size_t vertexBytes, const void *indices, size_t indexBytes) {
+    size_t parts[2] = { computeHash(vertices, vertexBytes), computeHash(indices, indexBytes) };
+    return computeHash(parts, sizeof(parts));
+}
+
+size_t ResourceRegistry::numTextures() {
+    prune();
+    return textures.size();
+}
+
+size_t ResourceRegistry::numMeshBuffers() {
+    prune();
+    return meshes.size();
+}
+
+void ResourceRegistry::prune() {
+    for (auto it = textures.begin(); it != textures.end();) {
+        if (it->second.texture.expired())
+            it = textures.erase(it);
+        else
+            ++it;
+    }
+
+    for (auto it = meshes.begin(); it != meshes.end();) {
+        if (it->second.geometry.expired())
+            it = meshes.erase(it);
+        else
+            ++it;
+    }
+}
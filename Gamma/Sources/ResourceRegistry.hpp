@@ -0,0 +1,69 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <map>
+#include <vector>
+#include "Material.hpp"
+#include "GeometryArena.hpp"
+#include "MipGenerator.hpp"
+
+class Texture;
+
+/*
+    Process-wide registry of GPU resources, keyed by xxHash of their contents.
+
+    Identical texture files and identical mesh geometry are uploaded once and
+    shared between all meshes and models that reference them, no matter which
+    path or import they came from. The registry only holds weak references:
+    a resource is freed when the last mesh using it goes away.
+
+    Must only be used on the thread that owns the GL context.
+*/
+
+class ResourceRegistry {
+public:
+    static ResourceRegistry& instance();
+
+    // Shared texture for the file contents, queued for upload on first request.
+    // Returns nullptr if the file cannot be read.
+    std::shared_ptr<Texture> getTexture(const std::string &path, TextureMask type);
+
+    // Start decoding textures that will be requested later, except those whose compressed form is cached
+    void prefetchTextures(const std::vector<std::pair<std::string, TextureMask>> &textures);
+
+    // Albedo is filtered in linear space, normals are renormalized
+    static MipMode mipMode(TextureMask type);
+
+    // Arena range previously registered for identical geometry
+    bool findGeometry(size_t key, std::shared_ptr<GeometryRange> &geometry);
+    void addGeometry(size_t key, const std::shared_ptr<GeometryRange> &geometry, size_t bytes);
+    static size_t geometryKey(const void *vertices, size_t vertexBytes, const void *indices, size_t indexBytes);
+
+    // Statistics
+    size_t numTextures();
+    size_t numMeshBuffers();
+    size_t bytesSaved() const { return savedBytes; }
+
+    ResourceRegistry(const ResourceRegistry&) = delete;
+    ResourceRegistry& operator=(const ResourceRegistry&) = delete;
+
+private:
+    ResourceRegistry(void) = default;
+    ~ResourceRegistry() = default;
+
+    // Forget resources that have been freed
+    void prune();
+
+    struct TextureEntry {
+        std::weak_ptr<Texture> texture;
+    };
+
+    struct MeshEntry {
+        std::weak_ptr<GeometryRange> geometry;
+        size_t bytes;
+    };
+
+    std::map<size_t, TextureEntry> textures;
+    std::map<size_t, MeshEntry> meshes;
+    size_t savedBytes = 0; // uploads avoided since startup
+};
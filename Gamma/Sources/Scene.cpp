@@ -1,7 +1,10 @@
 #include "Scene.hpp"
 #include "String.hpp"
 #include "FilePath.hpp"
+#include "ResourceRegistry.hpp"
+#include "VirtualFS.hpp"
 #include <map>
+#include <sstream>
 
 Scene::Scene(const char * scenefile) : Scene() {
     initFromFile(scenefile);
@@ -13,15 +16,72 @@ Scene::~Scene() {
     }
 }
 
+// Scene file keys of material textures
+static const std::map<std::string, TextureMask> textureKeys = {
+    { "albedo", TextureMask::DIFFUSE },
+    { "roughness", TextureMask::ROUGHNESS },
+    { "normal", TextureMask::NORMAL },
+    { "metallic", TextureMask::METALLIC }
+};
+
+// Lines of a scene file, false if it cannot be read
+static bool readLines(const char *scenefile, std::vector<std::string> &lines) {
+    std::string contents;
+    try {
+        contents = VFS::instance().readText(FilePath(scenefile).fullPath());
+    }
+    catch (std::runtime_error&) {
+        std::cout << "Could not open scenefile '" << scenefile << "'" << std::endl;
+        return false;
+    }
+
+    std::istringstream specs(contents);
+    for (std::string line; getline(specs, line);) {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        lines.push_back(line);
+    }
+    return true;
+}
+
+bool Scene::listAssets(const char *scenefile, SceneAssets &assets) {
+    std::vector<std::string> lines;
+    if (!readLines(scenefile, lines))
+        return false;
+
+    const std::string folder = FilePath(scenefile).folderPath();
+    for (const std::string &line : lines) {
+        auto parts = gma::String(line).split(' ');
+        if (parts.size() < 2) continue;
+        auto tex = textureKeys.find(parts[0]);
+        if (parts[0] == "geometry")
+            assets.models.push_back(folder + parts[1]);
+        else if (parts[0] == "environment")
+            assets.environments.push_back(folder + parts[1]);
+        else if (tex != textureKeys.end())
+            assets.textures.push_back(std::make_pair(folder + parts[1], tex->second));
+    }
+    return true;
+}
+
 void Scene::initFromFile(const char * scenefile) {
     FilePath path(scenefile);
     std::string folder = path.folderPath();
-    
-    std::ifstream specs(path.fullPath());
-    if (!specs.good()) {
-        std::cout << "Could not open scenefile '" << scenefile << "'" << std::endl;
+
+    std::vector<std::string> lines;
+    if (!readLines(scenefile, lines))
         return;
+
+    // Decode every referenced texture in the background while models are imported
+    std::vector<std::pair<std::string, TextureMask>> images;
+    for (const std::string &l : lines) {
+        auto parts = gma::String(l).split(' ');
+        if (parts.size() < 2) continue;
+        auto type = textureKeys.find(parts[0]);
+        if (type != textureKeys.end())
+            images.push_back(std::make_pair(folder + parts[1], type->second));
     }
+    ResourceRegistry::instance().prefetchTextures(images);
 
     Model *model = nullptr; // model currently being processed (scenefile can contain multiple)
     std::map<std::string, std::string> texPaths;
@@ -36,8 +96,7 @@ void Scene::initFromFile(const char * scenefile) {
         }
     };
     
-    std::string line;
-    while (getline(specs, line)) {
+    for (const std::string &line : lines) {
         auto parts = gma::String(line).split(' ');
         std::string key = parts[0];
         if (key == "geometry") {
@@ -7,6 +7,13 @@
 
 using std::string;
 
+// Files referenced by a scene file, relative to the working directory
+struct SceneAssets {
+    std::vector<std::string> models;
+    std::vector<std::pair<std::string, TextureMask>> textures;
+    std::vector<std::string> environments;
+};
+
 class Scene {
 
 public:
@@ -15,6 +22,9 @@ public:
     ~Scene();
 
     void initFromFile(const char* scenefile);
+
+    // Parse a scene file without loading anything, false if it cannot be read
+    static bool listAssets(const char* scenefile, SceneAssets &assets);
     void addModel(Model &m) { mModels.push_back(m); }
     void clearModels() { mModels.clear(); }
     std::vector<Model>& models() { return mModels; };
@@ -0,0 +1,157 @@
+#include "ShaderSource.hpp"
+#include "VirtualFS.hpp"
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+// Text up to an #include, followed by the included file (if any)
+struct ShaderSource::File {
+    struct Chunk {
+        std::string text;
+        std::string include;
+    };
+    std::vector<Chunk> chunks;
+    long long mtime = -1; // -1: not a loose file (archived), never changes
+    long long size = -1;
+};
+
+std::map<std::string, ShaderSource::File> ShaderSource::s_files; // static
+
+// Asked of the VFS rather than the disk, a loose copy shadowed by the archive is not what gets read
+static void statFile(const std::string &path, long long &mtime, long long &size) {
+    if (!VFS::instance().fileTime(path, mtime, size))
+        mtime = size = -1;
+}
+
+// Path between the quotes or angle brackets of an include line
+static std::string includeTarget(const std::string &line, const std::string &path) {
+    size_t begin = line.find_first_of("\"<", line.find("#include") + 8);
+    size_t end = (begin == std::string::npos) ? begin : line.find_first_of("\">", begin + 1);
+    if (end == std::string::npos) {
+        std::cout << "Malformed include in " << path << ": " << line << std::endl;
+        throw std::runtime_error("Malformed include in " + path);
+    }
+    return line.substr(begin + 1, end - begin - 1);
+}
+
+const ShaderSource::File& ShaderSource::parse(const std::string &path) {
+    auto cached = s_files.find(path);
+    if (cached != s_files.end())
+        return cached->second;
+
+    File parsed;
+    statFile(path, parsed.mtime, parsed.size);
+
+    std::istringstream file;
+    try {
+        file.str(VFS::instance().readText(path));
+    }
+    catch (std::runtime_error&) {
+        std::cout << "Cannot open file " << path << std::endl;
+        throw std::runtime_error("Cannot open file " + path);
+    }
+
+    size_t idx = path.find_last_of('/');
+    std::string dir = (idx == std::string::npos) ? "" : path.substr(0, idx + 1);
+
+    File::Chunk chunk;
+    std::string line;
+    while (file.good()) {
+        getline(file, line);
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        if (line.find("#include") == std::string::npos) {
+            chunk.text.append(line + "\n");
+        }
+        else {
+            chunk.include = VFS::normalize(dir + includeTarget(line, path));
+            parsed.chunks.push_back(chunk);
+            chunk = File::Chunk();
+            chunk.text = "\n";
+        }
+    }
+    parsed.chunks.push_back(chunk);
+
+    return s_files[path] = parsed;
+}
+
+void ShaderSource::expand(const std::string &path, std::string &out, std::set<std::string> *files, std::set<std::string> &stack) {
+    if (!stack.insert(path).second) {
+        std::cout << "Include cycle at " << path << std::endl;
+        throw std::runtime_error("Include cycle at " + path);
+    }
+
+    if (files)
+        files->insert(path);
+
+    const File &file = parse(path);
+    for (const File::Chunk &chunk : file.chunks) {
+        out.append(chunk.text);
+        if (!chunk.include.empty())
+            expand(chunk.include, out, files, stack);
+    }
+
+    stack.erase(path);
+}
+
+// Keys are matched at each position, longest first, and the output is never rescanned
+static std::string applyReplacements(const std::string &src, const std::map<std::string, std::string> &repl) {
+    bool startsKey[256] = {};
+    for (auto &p : repl) {
+        if (!p.first.empty())
+            startsKey[(unsigned char)p.first[0]] = true;
+    }
+
+    std::string out;
+    out.reserve(src.size());
+    size_t i = 0;
+    while (i < src.size()) {
+        const std::pair<const std::string, std::string> *best = nullptr;
+        if (startsKey[(unsigned char)src[i]]) {
+            for (auto &p : repl) {
+                if (!p.first.empty() && (!best || p.first.size() > best->first.size()) && src.compare(i, p.first.size(), p.first) == 0)
+                    best = &p;
+            }
+        }
+
+        if (best) {
+            out.append(best->second);
+            i += best->first.size();
+        }
+        else {
+            out.push_back(src[i++]);
+        }
+    }
+
+    return out;
+}
+
+std::string ShaderSource::read(const std::string &path, const std::map<std::string, std::string> &repl, std::set<std::string> *files) {
+    std::string output;
+    std::set<std::string> stack;
+    expand(VFS::normalize(path), output, files, stack);
+    return repl.empty() ? output : applyReplacements(output, repl);
+}
+
+std::set<std::string> ShaderSource::invalidateChanged() {
+    std::set<std::string> changed;
+    for (auto it = s_files.begin(); it != s_files.end();) {
+        long long mtime, size;
+        statFile(it->first, mtime, size);
+        if (mtime != it->second.mtime || size != it->second.size) {
+            changed.insert(it->first);
+            it = s_files.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    return changed;
+}
+
+void ShaderSource::clear() {
+    s_files.clear();
+}
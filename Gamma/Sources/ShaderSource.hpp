@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+#include <map>
+#include <set>
+
+/*
+    Shader preprocessor with a cache of parsed files.
+
+    Each file is read and split at its #include lines once. Expanding a
+    shader splices the cached pieces together, so headers shared by many
+    programs are not re-read or re-parsed per program. The modification time
+    of every parsed file is recorded, invalidateChanged() drops the files
+    edited since and reports them, so that only the programs depending on
+    them need to be rebuilt.
+
+    Replacements (e.g. "$MAX_LIGHTS" -> "#define MAX_LIGHTS 4") are applied
+    in a single pass over the expanded source. Must be used from one thread.
+*/
+
+class ShaderSource {
+public:
+    // Expanded source of a shader, includes are relative to the including file.
+    // Every file the result was built from is added to files.
+    static std::string read(const std::string &path,
+                            const std::map<std::string, std::string> &repl = std::map<std::string, std::string>(),
+                            std::set<std::string> *files = nullptr);
+
+    // Forget files modified on disk since they were parsed, returns their paths
+    static std::set<std::string> invalidateChanged();
+
+    // Forget all parsed files
+    static void clear();
+
+private:
+    struct File;
+    static const File& parse(const std::string &path);
+    static void expand(const std::string &path, std::string &out, std::set<std::string> *files, std::set<std::string> &stack);
+
+    // Parsed files by normalized path
+    static std::map<std::string, File> s_files;
+};
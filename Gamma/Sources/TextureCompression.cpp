@@ -0,0 +1,384 @@
+#include "TextureCompression.hpp"
+#include "ThreadPool.hpp"
+#include "utils.hpp"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+bool TextureCompression::enabled = true;
+
+GLenum TextureCompression::formatFor(TextureMask type) {
+    switch (type) {
+    case TextureMask::DIFFUSE:
+        if (glSupports(4, 2, "GL_ARB_texture_compression_bptc"))
+            return GL_COMPRESSED_RGBA_BPTC_UNORM;
+        return glHasExtension("GL_EXT_texture_compression_s3tc") ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : 0;
+    case TextureMask::NORMAL: return GL_COMPRESSED_RG_RGTC2;
+    case TextureMask::SHININESS:
+    case TextureMask::ROUGHNESS:
+    case TextureMask::METALLIC: return GL_COMPRESSED_RED_RGTC1;
+    default: return 0;
+    }
+}
+
+GLenum TextureCompression::baseFormat(GLenum format) {
+    switch (format) {
+    case GL_COMPRESSED_RGBA_BPTC_UNORM: return GL_RGBA;
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return GL_RGB;
+    case GL_COMPRESSED_RG_RGTC2: return GL_RG;
+    case GL_COMPRESSED_RED_RGTC1: return GL_RED;
+    default: throw std::runtime_error("Unsupported compressed format");
+    }
+}
+
+static size_t blockBytes(GLenum format) {
+    return (format == GL_COMPRESSED_RED_RGTC1 || format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) ? 8 : 16;
+}
+
+size_t TextureCompression::compressedSize(int width, int height, GLenum format) {
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+// One task per row of blocks, edge blocks repeat the last row/column
+std::vector<unsigned char> TextureCompression::compress(const unsigned char *rgba, int width, int height, GLenum format) {
+    const int blocksX = (width + 3) / 4;
+    const int blocksY = (height + 3) / 4;
+    const size_t bytes = blockBytes(format);
+    std::vector<unsigned char> out(compressedSize(width, height, format));
+
+    ThreadPool::shared().parallelFor(blocksY, [&](size_t by) {
+        unsigned char block[16 * 4];
+        for (int bx = 0; bx < blocksX; bx++) {
+            for (int i = 0; i < 16; i++) {
+                int x = std::min(bx * 4 + (i & 3), width - 1);
+                int y = std::min((int)by * 4 + (i >> 2), height - 1);
+                std::memcpy(block + 4 * i, rgba + 4 * ((size_t)y * width + x), 4);
+            }
+
+            unsigned char *dst = out.data() + (by * blocksX + bx) * bytes;
+            if (format == GL_COMPRESSED_RED_RGTC1) {
+                encodeBC4(block, 4, dst);
+            }
+            else if (format == GL_COMPRESSED_RG_RGTC2) {
+                encodeBC4(block, 4, dst);
+                encodeBC4(block + 1, 4, dst + 8);
+            }
+            else if (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) {
+                encodeBC1(block, dst);
+            }
+            else {
+                encodeBC7(block, dst);
+            }
+        }
+    });
+
+    return out;
+}
+
+static uint16_t packRGB565(const glm::vec3 &c) {
+    const int r = std::min(std::max((int)(c.x * 31.0f / 255.0f + 0.5f), 0), 31);
+    const int g = std::min(std::max((int)(c.y * 63.0f / 255.0f + 0.5f), 0), 63);
+    const int b = std::min(std::max((int)(c.z * 31.0f / 255.0f + 0.5f), 0), 31);
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void unpackRGB565(uint16_t c, int *rgb) {
+    const int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+// Endpoints at the extremes of the principal axis, four color mode (alpha is dropped)
+void TextureCompression::encodeBC1(const unsigned char *pixels, unsigned char *out) {
+    glm::vec3 mean(0.0f), lo(255.0f), hi(0.0f);
+    for (int i = 0; i < 16; i++) {
+        glm::vec3 c(pixels[4 * i], pixels[4 * i + 1], pixels[4 * i + 2]);
+        mean += c / 16.0f;
+        lo = glm::min(lo, c);
+        hi = glm::max(hi, c);
+    }
+
+    float cov[3][3] = {};
+    for (int i = 0; i < 16; i++) {
+        glm::vec3 d = glm::vec3(pixels[4 * i], pixels[4 * i + 1], pixels[4 * i + 2]) - mean;
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; c < 3; c++)
+                cov[r][c] += d[r] * d[c];
+    }
+
+    glm::vec3 axis = hi - lo;
+    for (int iter = 0; iter < 8; iter++) {
+        glm::vec3 next(0.0f);
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; c < 3; c++)
+                next[r] += cov[r][c] * axis[c];
+        float len = glm::length(next);
+        if (len < 1e-6f)
+            break;
+        axis = next / len;
+    }
+
+    float tmin = 0.0f, tmax = 0.0f;
+    float axisLen2 = glm::dot(axis, axis);
+    if (axisLen2 > 1e-12f) {
+        axis /= std::sqrt(axisLen2);
+        tmin = 1e30f;
+        tmax = -1e30f;
+        for (int i = 0; i < 16; i++) {
+            float t = glm::dot(glm::vec3(pixels[4 * i], pixels[4 * i + 1], pixels[4 * i + 2]) - mean, axis);
+            tmin = std::min(tmin, t);
+            tmax = std::max(tmax, t);
+        }
+    }
+
+    // The larger endpoint goes first, equal endpoints decode every index to the first one
+    uint16_t c0 = packRGB565(mean + tmax * axis);
+    uint16_t c1 = packRGB565(mean + tmin * axis);
+    if (c0 < c1)
+        std::swap(c0, c1);
+
+    int palette[4][3];
+    unpackRGB565(c0, palette[0]);
+    unpackRGB565(c1, palette[1]);
+    for (int ch = 0; ch < 3; ch++) {
+        palette[2][ch] = (2 * palette[0][ch] + palette[1][ch]) / 3;
+        palette[3][ch] = (palette[0][ch] + 2 * palette[1][ch]) / 3;
+    }
+
+    uint32_t bits = 0;
+    if (c0 != c1) {
+        for (int i = 0; i < 16; i++) {
+            int best = 0, bestErr = 1 << 30;
+            for (int k = 0; k < 4; k++) {
+                int err = 0;
+                for (int ch = 0; ch < 3; ch++) {
+                    const int d = palette[k][ch] - pixels[4 * i + ch];
+                    err += d * d;
+                }
+                if (err < bestErr) {
+                    bestErr = err;
+                    best = k;
+                }
+            }
+            bits |= (uint32_t)best << (2 * i);
+        }
+    }
+
+    out[0] = (unsigned char)c0;
+    out[1] = (unsigned char)(c0 >> 8);
+    out[2] = (unsigned char)c1;
+    out[3] = (unsigned char)(c1 >> 8);
+    for (int b = 0; b < 4; b++) {
+        out[4 + b] = (unsigned char)(bits >> (8 * b));
+    }
+}
+
+// Max/min endpoints, eight level palette
+void TextureCompression::encodeBC4(const unsigned char *values, int stride, unsigned char *out) {
+    int lo = 255, hi = 0;
+    for (int i = 0; i < 16; i++) {
+        lo = std::min(lo, (int)values[i * stride]);
+        hi = std::max(hi, (int)values[i * stride]);
+    }
+
+    out[0] = (unsigned char)hi;
+    out[1] = (unsigned char)lo;
+
+    uint64_t bits = 0;
+    if (hi > lo) {
+        // Palette: hi, lo, then six steps from hi towards lo
+        int palette[8] = { hi, lo };
+        for (int i = 1; i < 7; i++) {
+            palette[i + 1] = ((7 - i) * hi + i * lo) / 7;
+        }
+
+        for (int i = 0; i < 16; i++) {
+            int v = values[i * stride];
+            int best = 0;
+            for (int p = 1; p < 8; p++) {
+                if (std::abs(palette[p] - v) < std::abs(palette[best] - v))
+                    best = p;
+            }
+            bits |= (uint64_t)best << (3 * i);
+        }
+    }
+
+    for (int b = 0; b < 6; b++) {
+        out[2 + b] = (unsigned char)(bits >> (8 * b));
+    }
+}
+
+// Mode 6: one subset, RGBA endpoints with 7 bits + shared p-bit, 4-bit indices
+static const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct BC7Endpoints {
+    int q[2][4]; // 7-bit values
+    int p[2];    // p-bits
+};
+
+// Quantize endpoint to 7 bits per channel, picking the p-bit with the least error
+static void quantizeEndpoint(const glm::vec4 &e, int *q, int &p) {
+    float bestErr = 1e30f;
+    for (int pbit = 0; pbit < 2; pbit++) {
+        int cand[4];
+        float err = 0.0f;
+        for (int c = 0; c < 4; c++) {
+            cand[c] = glm::clamp((int)std::floor((e[c] - pbit) / 2.0f + 0.5f), 0, 127);
+            float d = (float)((cand[c] << 1) | pbit) - e[c];
+            err += d * d;
+        }
+        if (err < bestErr) {
+            bestErr = err;
+            p = pbit;
+            std::copy(cand, cand + 4, q);
+        }
+    }
+}
+
+// Choose indices for quantized endpoints, returns total squared error
+static float assignIndices(const unsigned char *pixels, const BC7Endpoints &ep, int *indices) {
+    int palette[16][4];
+    for (int c = 0; c < 4; c++) {
+        int e0 = (ep.q[0][c] << 1) | ep.p[0];
+        int e1 = (ep.q[1][c] << 1) | ep.p[1];
+        for (int k = 0; k < 16; k++) {
+            palette[k][c] = ((64 - BC7_WEIGHTS[k]) * e0 + BC7_WEIGHTS[k] * e1 + 32) >> 6;
+        }
+    }
+
+    float total = 0.0f;
+    for (int i = 0; i < 16; i++) {
+        int bestErr = 1 << 30;
+        for (int k = 0; k < 16; k++) {
+            int err = 0;
+            for (int c = 0; c < 4; c++) {
+                int d = palette[k][c] - pixels[4 * i + c];
+                err += d * d;
+            }
+            if (err < bestErr) {
+                bestErr = err;
+                indices[i] = k;
+            }
+        }
+        total += (float)bestErr;
+    }
+
+    return total;
+}
+
+void TextureCompression::encodeBC7(const unsigned char *pixels, unsigned char *out) {
+    // Principal axis of the block colors
+    glm::vec4 mean(0.0f), lo(255.0f), hi(0.0f);
+    for (int i = 0; i < 16; i++) {
+        glm::vec4 c(pixels[4 * i], pixels[4 * i + 1], pixels[4 * i + 2], pixels[4 * i + 3]);
+        mean += c / 16.0f;
+        lo = glm::min(lo, c);
+        hi = glm::max(hi, c);
+    }
+
+    float cov[4][4] = {};
+    for (int i = 0; i < 16; i++) {
+        glm::vec4 d = glm::vec4(pixels[4 * i], pixels[4 * i + 1], pixels[4 * i + 2], pixels[4 * i + 3]) - mean;
+        for (int r = 0; r < 4; r++)
+            for (int c = 0; c < 4; c++)
+                cov[r][c] += d[r] * d[c];
+    }
+
+    glm::vec4 axis = hi - lo;
+    for (int iter = 0; iter < 8; iter++) {
+        glm::vec4 next(0.0f);
+        for (int r = 0; r < 4; r++)
+            for (int c = 0; c < 4; c++)
+                next[r] += cov[r][c] * axis[c];
+        float len = glm::length(next);
+        if (len < 1e-6f)
+            break;
+        axis = next / len;
+    }
+
+    // Endpoints at the extremes of the projection
+    float tmin = 0.0f, tmax = 0.0f;
+    float axisLen2 = glm::dot(axis, axis);
+    if (axisLen2 > 1e-12f) {
+        axis /= std::sqrt(axisLen2);
+        tmin = 1e30f;
+        tmax = -1e30f;
+        for (int i = 0; i < 16; i++) {
+            glm::vec4 c(pixels[4 * i], pixels[4 * i + 1], pixels[4 * i + 2], pixels[4 * i + 3]);
+            float t = glm::dot(c - mean, axis);
+            tmin = std::min(tmin, t);
+            tmax = std::max(tmax, t);
+        }
+    }
+
+    glm::vec4 e0 = glm::clamp(mean + tmin * axis, glm::vec4(0.0f), glm::vec4(255.0f));
+    glm::vec4 e1 = glm::clamp(mean + tmax * axis, glm::vec4(0.0f), glm::vec4(255.0f));
+
+    BC7Endpoints ep;
+    quantizeEndpoint(e0, ep.q[0], ep.p[0]);
+    quantizeEndpoint(e1, ep.q[1], ep.p[1]);
+    int indices[16];
+    float err = assignIndices(pixels, ep, indices);
+
+    // One least squares refinement of the endpoints for the chosen indices
+    float a00 = 0.0f, a01 = 0.0f, a11 = 0.0f;
+    glm::vec4 b0(0.0f), b1(0.0f);
+    for (int i = 0; i < 16; i++) {
+        float w = BC7_WEIGHTS[indices[i]] / 64.0f;
+        glm::vec4 c(pixels[4 * i], pixels[4 * i + 1], pixels[4 * i + 2], pixels[4 * i + 3]);
+        a00 += (1.0f - w) * (1.0f - w);
+        a01 += (1.0f - w) * w;
+        a11 += w * w;
+        b0 += (1.0f - w) * c;
+        b1 += w * c;
+    }
+
+    float det = a00 * a11 - a01 * a01;
+    if (std::abs(det) > 1e-6f) {
+        glm::vec4 r0 = glm::clamp((a11 * b0 - a01 * b1) / det, glm::vec4(0.0f), glm::vec4(255.0f));
+        glm::vec4 r1 = glm::clamp((a00 * b1 - a01 * b0) / det, glm::vec4(0.0f), glm::vec4(255.0f));
+
+        BC7Endpoints refined;
+        int refinedIndices[16];
+        quantizeEndpoint(r0, refined.q[0], refined.p[0]);
+        quantizeEndpoint(r1, refined.q[1], refined.p[1]);
+        if (assignIndices(pixels, refined, refinedIndices) < err) {
+            ep = refined;
+            std::copy(refinedIndices, refinedIndices + 16, indices);
+        }
+    }
+
+    // Anchor index must have its top bit clear
+    if (indices[0] & 8) {
+        for (int c = 0; c < 4; c++)
+            std::swap(ep.q[0][c], ep.q[1][c]);
+        std::swap(ep.p[0], ep.p[1]);
+        for (int i = 0; i < 16; i++)
+            indices[i] = 15 - indices[i];
+    }
+
+    // Pack, least significant bit first
+    std::memset(out, 0, 16);
+    int pos = 0;
+    auto write = [out, &pos](unsigned int value, int numBits) {
+        for (int b = 0; b < numBits; b++, pos++) {
+            if ((value >> b) & 1)
+                out[pos >> 3] |= (unsigned char)(1 << (pos & 7));
+        }
+    };
+
+    write(1 << 6, 7); // mode 6
+    for (int c = 0; c < 4; c++) {
+        write(ep.q[0][c], 7);
+        write(ep.q[1][c], 7);
+    }
+    write(ep.p[0], 1);
+    write(ep.p[1], 1);
+    write(indices[0], 3);
+    for (int i = 1; i < 16; i++) {
+        write(indices[i], 4);
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <glad/glad.h>
+#include <vector>
+#include "Material.hpp"
+
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+
+/*
+    CPU block compression of material textures.
+
+    Albedo is stored as BC7 (single subset mode 6), or as opaque BC1 where
+    BPTC is not supported. Normal maps are BC5 (X and Y, Z is reconstructed
+    in the shader) and scalar maps BC4. Blocks are encoded in parallel on the
+    shared thread pool. Input is always RGBA8.
+*/
+
+class TextureCompression {
+public:
+    // Compress textures loaded from now on
+    static bool enabled;
+
+    // Compressed format for the texture type, 0 to keep it uncompressed.
+    // Checks driver support, must be called on the context thread.
+    static GLenum formatFor(TextureMask type);
+
+    // Base format (GL_RED, GL_RG, GL_RGBA) of a supported compressed format
+    static GLenum baseFormat(GLenum format);
+
+    static size_t compressedSize(int width, int height, GLenum format);
+    static std::vector<unsigned char> compress(const unsigned char *rgba, int width, int height, GLenum format);
+
+private:
+    static void encodeBC1(const unsigned char *pixels, unsigned char *out);
+    static void encodeBC4(const unsigned char *values, int stride, unsigned char *out);
+    static void encodeBC7(const unsigned char *pixels, unsigned char *out);
+};
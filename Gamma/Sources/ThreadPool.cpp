@@ -0,0 +1,84 @@
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <atomic>
+
+ThreadPool::ThreadPool(size_t numThreads) {
+    numThreads = std::max((size_t)1, numThreads);
+    for (size_t i = 0; i < numThreads; i++) {
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+    }
+}
+
+// Finishes queued jobs before joining
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    for (std::thread &t : workers) {
+        t.join();
+    }
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool(std::thread::hardware_concurrency());
+    return pool;
+}
+
+void ThreadPool::workerLoop() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this]() { return stopping || !jobs.empty(); });
+            if (jobs.empty())
+                return; // stopping
+
+            job = std::move(jobs.front());
+            jobs.pop();
+        }
+        job();
+    }
+}
+
+// Helpers that start after all items have been taken exit without touching fn,
+// so only helpers that are actually running need to be waited for
+void ThreadPool::parallelFor(size_t n, const std::function<void(size_t)> &fn) {
+    struct State {
+        std::atomic<size_t> next;
+        std::atomic<int> running;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+
+    std::shared_ptr<State> state = std::make_shared<State>();
+    state->next = 0;
+    state->running = 0;
+
+    const std::function<void(size_t)> *f = &fn;
+    auto work = [state, f, n]() {
+        state->running++;
+        for (size_t i = state->next++; i < n; i = state->next++) {
+            (*f)(i);
+        }
+        if (--state->running == 0) {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->done.notify_all();
+        }
+    };
+
+    const size_t numHelpers = std::min(workers.size(), n) - std::min((size_t)1, n);
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (size_t i = 0; i < numHelpers; i++) {
+            jobs.push(work);
+        }
+    }
+    cv.notify_all();
+
+    work();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait(lock, [&state]() { return state->running == 0; });
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <memory>
+
+/* Fixed-size pool of worker threads for CPU-side jobs (decoding, compression etc.) */
+
+class ThreadPool {
+public:
+    ThreadPool(size_t numThreads);
+    ~ThreadPool();
+
+    // Process-wide pool with one worker per hardware thread
+    static ThreadPool& shared();
+
+    size_t size() const { return workers.size(); }
+
+    // Run job on a worker, result (or exception) delivered through the future
+    template <typename F>
+    auto enqueue(F job) -> std::future<decltype(job())> {
+        typedef decltype(job()) R;
+        auto task = std::make_shared<std::packaged_task<R()>>(job);
+        std::future<R> result = task->get_future();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobs.push([task]() { (*task)(); });
+        }
+        cv.notify_one();
+        return result;
+    }
+
+    // Run fn(i) for every i in [0, n) and wait. The calling thread takes part,
+    // so this is safe to use from within a job running on the same pool.
+    void parallelFor(size_t n, const std::function<void(size_t)> &fn);
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+private:
+    void workerLoop();
+
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+};
@@ -0,0 +1,144 @@
+#include "UniformRing.hpp"
+#include "GLProgram.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+const unsigned int UniformRing::FRAMES_IN_FLIGHT;
+const size_t UniformRing::DEFAULT_FRAME_SIZE;
+
+UniformRing& UniformRing::instance() {
+    static UniformRing ring;
+    return ring;
+}
+
+void UniformRing::create(size_t bytesPerFrame) {
+    // Names of the blocks in uniform_blocks.glh
+    static bool registered = false;
+    if (!registered) {
+        GLProgram::bindUniformBlock("FrameData", FRAME_BLOCK);
+        GLProgram::bindUniformBlock("LightData", LIGHT_BLOCK);
+        GLProgram::bindUniformBlock("ShadowData", SHADOW_BLOCK);
+        registered = true;
+    }
+
+    GLint align = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+    alignment = std::max((size_t)align, (size_t)16);
+    frameSize = (bytesPerFrame + alignment - 1) / alignment * alignment;
+    const size_t total = frameSize * FRAMES_IN_FLIGHT;
+
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    if (glSupports(4, 4, "GL_ARB_buffer_storage")) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_UNIFORM_BUFFER, total, nullptr, flags);
+        mapped = static_cast<unsigned char*>(glMapBufferRange(GL_UNIFORM_BUFFER, 0, total, flags));
+        if (!mapped) {
+            // Immutable storage cannot be respecified, start over with a plain buffer
+            std::cout << "Could not map uniform ring persistently" << std::endl;
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+            glDeleteBuffers(1, &buffer);
+            glGenBuffers(1, &buffer);
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        }
+    }
+    if (!mapped) {
+        glBufferData(GL_UNIFORM_BUFFER, total, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glCheckError();
+}
+
+void UniformRing::wait(GLsync &fence) {
+    if (!fence)
+        return;
+
+    GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+        numStalls++;
+        while (status == GL_TIMEOUT_EXPIRED) {
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); // 1 ms
+        }
+    }
+    glDeleteSync(fence);
+    fence = 0;
+}
+
+void UniformRing::beginFrame() {
+    // Grow to fit the largest frame so far, once the GPU is done with the old buffer
+    if (buffer && lastBytes > frameSize) {
+        size_t size = frameSize;
+        while (size < lastBytes) size *= 2;
+        std::cout << "Growing uniform ring to " << (size >> 10) << " KB per frame" << std::endl;
+        release();
+        create(size);
+    }
+    if (!buffer) {
+        create(DEFAULT_FRAME_SIZE);
+    }
+
+    wait(fences[frame]);
+    head = frame * frameSize;
+    frameBytes = 0;
+}
+
+void UniformRing::endFrame() {
+    fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    frame = (frame + 1) % FRAMES_IN_FLIGHT;
+    lastBytes = frameBytes;
+}
+
+void UniformRing::bind(UniformBlockBinding binding, const void *data, size_t bytes) {
+    if (!buffer)
+        throw std::runtime_error("Uniform block written outside of a frame");
+    if (bytes > frameSize)
+        throw std::runtime_error("Uniform block larger than the uniform ring");
+
+    const size_t regionStart = frame * frameSize;
+    size_t offset = (head + alignment - 1) / alignment * alignment;
+    const bool wrap = offset + bytes > regionStart + frameSize;
+    if (wrap) {
+        // Region full, reuse it once the GPU has caught up
+        GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        wait(fence);
+        offset = regionStart;
+    }
+
+    if (mapped) {
+        std::memcpy(mapped + offset, data, bytes);
+    }
+    else {
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        void *dst = glMapBufferRange(GL_UNIFORM_BUFFER, offset, bytes,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (dst) {
+            std::memcpy(dst, data, bytes);
+            glUnmapBuffer(GL_UNIFORM_BUFFER);
+        }
+        else {
+            std::cout << "Could not map uniform ring" << std::endl;
+        }
+    }
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, bytes);
+    frameBytes += wrap ? bytes : offset + bytes - head;
+    head = offset + bytes;
+}
+
+void UniformRing::release() {
+    for (GLsync &fence : fences) {
+        wait(fence);
+    }
+    if (mapped) {
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        mapped = nullptr;
+    }
+    glDeleteBuffers(1, &buffer);
+    buffer = 0;
+    frame = 0;
+    head = frameBytes = 0;
+}
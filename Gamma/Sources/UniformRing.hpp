@@ -0,0 +1,99 @@
+#pragma once
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <cstddef>
+
+/*
+    Uniform blocks streamed through one buffer object.
+
+    The buffer is split into a region per frame in flight. Blocks are copied
+    into the current frame's region and bound with glBindBufferRange, so
+    every draw keeps its own copy and nothing is overwritten while the GPU
+    may still read it. Each region is guarded by a fence set at the end of
+    its frame, which is waited on before the region is written again, three
+    frames later.
+
+    With GL 4.4 or ARB_buffer_storage the buffer stays persistently mapped
+    and writes are plain copies. Otherwise each block is written with an
+    unsynchronized glMapBufferRange, which the fences make safe as well.
+
+    A frame that does not fit waits for the GPU to finish the region before
+    reusing it, and the ring grows at the start of the next frame.
+*/
+
+// Binding points of the blocks in uniform_blocks.glh
+enum UniformBlockBinding : GLuint {
+    FRAME_BLOCK = 0,
+    LIGHT_BLOCK = 1,
+    SHADOW_BLOCK = 2
+};
+
+// std140 layouts of uniform_blocks.glh, LightData is declared with the renderer.
+// Model transforms are per draw data of the render queue (RenderQueue.hpp).
+struct FrameData {
+    glm::mat4 P;
+    glm::mat4 V;
+    glm::vec3 cameraPos;
+    float pad;
+};
+
+struct ShadowData {
+    glm::mat4 shadowMatrices[6]; // point lights, one per cube face
+    glm::mat4 lightSpaceMatrix;  // directional lights
+    glm::vec3 lightPos;
+    float farPlane;
+};
+
+static_assert(sizeof(FrameData) == 144 && sizeof(ShadowData) == 464,
+              "Uniform blocks must match their std140 layout");
+
+class UniformRing {
+public:
+    // Process-wide ring, must only be used on the thread that owns the GL context
+    static UniformRing& instance();
+
+    // Start writing the next region, waits if the GPU is still reading it
+    void beginFrame();
+    // Fence the blocks written since beginFrame()
+    void endFrame();
+
+    // Copy a block into the ring and bind it until the next block for the same binding
+    void bind(UniformBlockBinding binding, const void *data, size_t bytes);
+
+    template <typename T>
+    void bind(UniformBlockBinding binding, const T &block) {
+        bind(binding, &block, sizeof(T));
+    }
+
+    // Free the buffer before the context is destroyed
+    void release();
+
+    size_t lastFrameBytes() const { return lastBytes; }
+    size_t capacity() const { return frameSize; }
+    size_t stalls() const { return numStalls; } // waits for the GPU since startup
+
+    static const unsigned int FRAMES_IN_FLIGHT = 3;
+
+    UniformRing(const UniformRing&) = delete;
+    UniformRing& operator=(const UniformRing&) = delete;
+
+private:
+    UniformRing(void) = default;
+    ~UniformRing() = default;
+
+    void create(size_t bytesPerFrame);
+    void wait(GLsync &fence);
+
+    static const size_t DEFAULT_FRAME_SIZE = 256 << 10;
+
+    GLuint buffer = 0;
+    unsigned char *mapped = nullptr; // persistent mapping, if supported
+    size_t frameSize = 0;
+    size_t alignment = 256; // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    GLsync fences[FRAMES_IN_FLIGHT] = {};
+    unsigned int frame = 0;
+    size_t head = 0; // next write position
+    size_t frameBytes = 0;
+    size_t lastBytes = 0;
+    size_t numStalls = 0;
+};
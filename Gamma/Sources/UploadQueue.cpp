@@ -0,0 +1,297 @@
+#include "UploadQueue.hpp"
+#include "Mesh.hpp"
+#include "GeometryArena.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+static const size_t STAGING_ALIGNMENT = 16;
+
+const int UploadQueue::TAIL_SIZE;
+const size_t UploadQueue::RING_SIZE;
+const size_t UploadQueue::MAX_CHUNK;
+
+UploadQueue& UploadQueue::instance() {
+    static UploadQueue queue;
+    return queue;
+}
+
+void UploadQueue::enqueueTexture(std::shared_ptr<Texture> target, std::shared_future<ImageData> image) {
+    target->resident = false;
+    Job job;
+    job.texture = target;
+    job.image = image;
+    jobs.push_back(job);
+}
+
+void UploadQueue::enqueueGeometry(std::shared_ptr<GeometryRange> target, bool indices, std::shared_ptr<const void> owner, const void *data) {
+    const GeometryArena &arena = *target->arena;
+    target->pendingUploads++;
+    Job job;
+    job.geometry = target;
+    job.indices = indices;
+    job.owner = owner;
+    job.data = static_cast<const unsigned char*>(data);
+    job.bytes = indices ? target->numIndices * arena.indexSize() : target->numVertices * arena.vertexSize();
+    jobs.push_back(job);
+}
+
+void UploadQueue::processFrame() {
+    frameBytes = 0;
+    if (jobs.empty() && fences.empty())
+        return;
+
+    if (!ring) {
+        glGenBuffers(1, &ring);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, ring);
+        glBufferData(GL_COPY_WRITE_BUFFER, RING_SIZE, nullptr, GL_STREAM_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glCheckError();
+    }
+
+    retireFences();
+
+    typedef std::chrono::high_resolution_clock Clock;
+    const Clock::time_point start = Clock::now();
+    auto elapsedMs = [&start]() {
+        return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+    };
+
+    size_t budget = maxBytesPerFrame;
+    frameUsed = 0;
+    ringFull = false;
+
+    // Mip tails of every decoded texture first, so that nothing waits behind a large upload
+    for (auto tail = jobs.begin(); tail != jobs.end() && !ringFull;) {
+        StepResult result = STEP_WAITING;
+        if (tail->image.valid() && tail->inTail) {
+            do {
+                result = stepTexture(*tail, budget);
+            } while (result == STEP_PROGRESS && tail->inTail);
+        }
+        if (result == STEP_DONE)
+            tail = jobs.erase(tail);
+        else
+            ++tail;
+    }
+
+    // Jobs are served in order, ones still waiting for decoding are skipped
+    auto it = jobs.begin();
+    while (it != jobs.end() && budget > 0 && !ringFull && elapsedMs() < maxMsPerFrame) {
+        StepResult result = it->image.valid() ? stepTexture(*it, budget) : stepGeometry(*it, budget);
+        if (result == STEP_DONE)
+            it = jobs.erase(it);
+        else if (result == STEP_WAITING)
+            ++it;
+    }
+
+    // Ring space written this frame is released once the GPU passes this point
+    if (frameUsed > 0) {
+        fences.push_back(std::make_pair(frameUsed, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0)));
+    }
+
+    frameBytes = maxBytesPerFrame - budget;
+    glCheckError();
+}
+
+UploadQueue::StepResult UploadQueue::stepTexture(Job &job, size_t &budget) {
+    std::shared_ptr<Texture> tex = job.texture.lock();
+    if (!tex)
+        return STEP_DONE; // released before it was uploaded
+
+    if (job.image.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return STEP_WAITING;
+
+    // Failed decodes have already been reported, the texture stays a placeholder
+    ImageData image;
+    GLenum format;
+    try {
+        image = job.image.get();
+        format = image.compressedFormat ? image.compressedFormat : imageFormat(image);
+    }
+    catch (std::runtime_error&) {
+        return STEP_DONE;
+    }
+
+    const bool compressed = (image.compressedFormat != 0);
+    const int numLevels = image.levels ? (int)image.levels->size() : 1;
+
+    if (tex->id == 0) {
+        glGenTextures(1, &tex->id);
+        glBindTexture(GL_TEXTURE_2D, tex->id);
+        allocateTextureStorage(image);
+        tex->bytes = 0;
+        for (int level = 0; level < numLevels; level++) {
+            tex->bytes += image.levels ? (*image.levels)[level].size() : (size_t)image.width * image.height * image.channels;
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        job.level = numLevels - 1;
+        job.rowsDone = 0;
+    }
+
+    // Rows of pixels, or rows of 4x4 blocks for compressed levels
+    const int levelWidth = std::max(1, image.width >> job.level);
+    const int levelHeight = std::max(1, image.height >> job.level);
+    const bool tailLevel = std::max(levelWidth, levelHeight) <= TAIL_SIZE;
+
+    // Single level images have no tail, they are streamed like other levels
+    if (job.inTail && !tailLevel) {
+        job.inTail = false;
+        return STEP_PROGRESS;
+    }
+    const int numRows = compressed ? (levelHeight + 3) / 4 : levelHeight;
+    const unsigned char *src = image.levels ? (*image.levels)[job.level].data() : image.pixels.get();
+    const size_t rowBytes = compressed ? (*image.levels)[job.level].size() / numRows : (size_t)levelWidth * image.channels;
+
+    // Upload in strips of whole rows, at least one row per frame. Tail levels go in one piece.
+    size_t rows = tailLevel ? (size_t)(numRows - job.rowsDone) : std::min((size_t)(numRows - job.rowsDone), std::min(budget, MAX_CHUNK) / rowBytes);
+    if (rows == 0) {
+        if (budget < maxBytesPerFrame) {
+            budget = 0;
+            return STEP_PROGRESS;
+        }
+        rows = 1;
+    }
+
+    const size_t bytes = rows * rowBytes;
+    size_t offset;
+    if (!stage(src + job.rowsDone * rowBytes, bytes, offset))
+        return STEP_WAITING;
+
+    glBindTexture(GL_TEXTURE_2D, tex->id);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring);
+    if (compressed) {
+        const int y = 4 * job.rowsDone;
+        const int height = std::min(4 * (int)rows, levelHeight - y);
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, job.level, 0, y, levelWidth, height, format, (GLsizei)bytes, (void*)offset);
+    }
+    else {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, job.level, 0, job.rowsDone, levelWidth, (GLsizei)rows, format, GL_UNSIGNED_BYTE, (void*)offset);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glCheckError();
+
+    if (!tailLevel)
+        budget -= std::min(budget, bytes);
+    job.rowsDone += (int)rows;
+    if (job.rowsDone < numRows)
+        return STEP_PROGRESS;
+
+    // Sample from the finest level uploaded so far
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, job.level);
+    glCheckError();
+
+    const bool nextInTail = job.level > 0 &&
+        std::max(image.width >> (job.level - 1), image.height >> (job.level - 1)) <= TAIL_SIZE;
+    if (!nextInTail) {
+        job.inTail = false;
+        tex->resident = true;
+    }
+
+    if (--job.level >= 0) {
+        job.rowsDone = 0;
+        return STEP_PROGRESS;
+    }
+
+    return STEP_DONE;
+}
+
+UploadQueue::StepResult UploadQueue::stepGeometry(Job &job, size_t &budget) {
+    std::shared_ptr<GeometryRange> range = job.geometry.lock();
+    if (!range)
+        return STEP_DONE;
+
+    // Looked up on every step, the arena may have grown into new buffers since the last one
+    const GeometryArena &arena = *range->arena;
+    const GLuint buffer = job.indices ? arena.indexBuffer() : arena.vertexBuffer();
+    const size_t start = job.indices ? range->firstIndex * arena.indexSize() : range->firstVertex * arena.vertexSize();
+
+    const size_t bytes = std::min(job.bytes - job.bytesDone, std::min(budget, MAX_CHUNK));
+    if (bytes > 0) {
+        size_t offset;
+        if (!stage(job.data + job.bytesDone, bytes, offset))
+            return STEP_WAITING;
+
+        glBindBuffer(GL_COPY_READ_BUFFER, ring);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, start + job.bytesDone, bytes);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glCheckError();
+
+        budget -= bytes;
+        job.bytesDone += bytes;
+    }
+
+    if (job.bytesDone < job.bytes)
+        return STEP_PROGRESS;
+
+    range->pendingUploads--;
+    return STEP_DONE;
+}
+
+// The GPU may still be reading [head - used, head) (mod RING_SIZE), everything after head is free
+bool UploadQueue::stage(const void *data, size_t bytes, size_t &offset) {
+    size_t start = (head + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+    if (start + bytes > RING_SIZE)
+        start = 0; // skip the tail end of the ring
+
+    const size_t padding = (start >= head) ? start - head : RING_SIZE - head;
+    if (padding + bytes > RING_SIZE - used) {
+        ringFull = true;
+        return false;
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, ring);
+    void *dst = glMapBufferRange(GL_COPY_WRITE_BUFFER, start, bytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (dst) {
+        std::memcpy(dst, data, bytes);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    if (!dst) {
+        std::cout << "Could not map upload staging buffer" << std::endl;
+        ringFull = true;
+        return false;
+    }
+
+    head = start + bytes;
+    used += padding + bytes;
+    frameUsed += padding + bytes;
+    offset = start;
+    return true;
+}
+
+void UploadQueue::retireFences() {
+    while (!fences.empty()) {
+        GLenum status = glClientWaitSync(fences.front().second, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+
+        used -= fences.front().first;
+        glDeleteSync(fences.front().second);
+        fences.pop_front();
+    }
+
+    if (used == 0)
+        head = 0;
+}
+
+void UploadQueue::release() {
+    jobs.clear();
+    for (auto &f : fences) {
+        glDeleteSync(f.second);
+    }
+    fences.clear();
+    glDeleteBuffers(1, &ring);
+    ring = 0;
+    head = used = frameUsed = 0;
+}
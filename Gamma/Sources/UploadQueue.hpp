@@ -0,0 +1,111 @@
+#pragma once
+#include <glad/glad.h>
+#include <memory>
+#include <future>
+#include <list>
+#include <deque>
+#include "ImageLoader.hpp"
+
+class Texture;
+class GeometryRange;
+
+/*
+    Frame-budgeted streaming of textures and buffer data to the GPU.
+
+    Data is copied into a ring of staging memory (one buffer object used as a
+    pixel unpack / copy source) and transferred from there. Each frame's
+    share of the ring is guarded by a fence, so that space is only reused once
+    the GPU has consumed it. Uploads stop for the frame once the byte or time
+    budget is spent, or when the ring is full, and continue on the next frame.
+
+    Targets report residency (Texture::resident, GeometryRange::resident) so
+    that rendering can fall back to placeholders until the data has arrived.
+
+    Textures are streamed smallest level first. The mip tail (levels of at
+    most TAIL_SIZE texels per side) of every decoded texture is uploaded at
+    the start of each frame outside the budget, which makes the texture
+    resident. Larger levels follow within the budget, and GL_TEXTURE_BASE_LEVEL
+    is lowered as each one completes, so sharpness improves progressively.
+
+    Nothing is uploaded before the whole chain is ready. For cached KTX
+    inputs that is as soon as the file is read. Other images are decoded
+    at full resolution and all their mips are generated (and compressed)
+    first, so until then the mesh shows its material constants.
+*/
+
+class UploadQueue {
+public:
+    // Process-wide queue, must only be used on the thread that owns the GL context
+    static UploadQueue& instance();
+
+    // Texture storage is created once the image has been decoded
+    void enqueueTexture(std::shared_ptr<Texture> target, std::shared_future<ImageData> image);
+
+    // Fill the vertices or indices of an arena range, owner keeps data alive until uploaded
+    void enqueueGeometry(std::shared_ptr<GeometryRange> target, bool indices, std::shared_ptr<const void> owner, const void *data);
+
+    // Upload within budget, call once per frame
+    void processFrame();
+
+    // Free staging memory before the context is destroyed
+    void release();
+
+    size_t pendingJobs() const { return jobs.size(); }
+    size_t lastFrameBytes() const { return frameBytes; }
+
+    // Per-frame budget
+    size_t maxBytesPerFrame = 8 << 20;
+    float maxMsPerFrame = 2.0f;
+
+    UploadQueue(const UploadQueue&) = delete;
+    UploadQueue& operator=(const UploadQueue&) = delete;
+
+private:
+    UploadQueue(void) = default;
+    ~UploadQueue() = default;
+
+    struct Job {
+        // Texture job
+        std::weak_ptr<Texture> texture;
+        std::shared_future<ImageData> image;
+        int level = -1; // level being uploaded, counts down to 0
+        int rowsDone = 0;
+        bool inTail = true;
+
+        // Geometry job
+        std::weak_ptr<GeometryRange> geometry;
+        bool indices = false;
+        std::shared_ptr<const void> owner;
+        const unsigned char *data = nullptr;
+        size_t bytes = 0;
+        size_t bytesDone = 0;
+    };
+
+    enum StepResult { STEP_DONE, STEP_PROGRESS, STEP_WAITING };
+
+    // Upload the next chunk of a job, budget is reduced by the bytes sent
+    // (except for mip tail levels, which are sent whole)
+    StepResult stepTexture(Job &job, size_t &budget);
+    StepResult stepGeometry(Job &job, size_t &budget);
+
+    // Copy data to staging memory, fails if the ring is full
+    bool stage(const void *data, size_t bytes, size_t &offset);
+    void retireFences();
+
+    std::list<Job> jobs;
+
+    // Largest mip tail level, per side
+    static const int TAIL_SIZE = 64;
+
+    // Staging ring
+    static const size_t RING_SIZE = 32 << 20;
+    static const size_t MAX_CHUNK = RING_SIZE / 4;
+    GLuint ring = 0;
+    size_t head = 0; // next write position
+    size_t used = 0; // bytes still read by the GPU, including padding at wrap
+    size_t frameUsed = 0;
+    bool ringFull = false;
+    std::deque<std::pair<size_t, GLsync>> fences; // ring bytes released by each fence
+
+    size_t frameBytes = 0;
+};
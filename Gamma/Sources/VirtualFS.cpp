@@ -0,0 +1,460 @@
+#include "VirtualFS.hpp"
+#include "MappedFile.hpp"
+#include "LZ4.hpp"
+#include "utils.hpp"
+#include "xxhash.h"
+#include <algorithm>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+static const char *DEFAULT_ARCHIVE = "Gamma/Assets.pak";
+
+static const char PACK_MAGIC[4] = { 'G', 'P', 'A', 'K' };
+static const uint32_t PACK_VERSION = 1;
+static const uint64_t ENTRY_ALIGNMENT = 64;
+
+enum PackCompression : uint32_t {
+    PACK_STORED = 0,
+    PACK_LZ4 = 1
+};
+
+struct PackHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t numEntries;
+    uint32_t reserved;
+    uint64_t tocOffset;
+    uint64_t namesOffset;
+};
+
+struct PackArchive::Entry {
+    uint64_t pathHash;
+    uint64_t offset;
+    uint64_t storedSize;
+    uint64_t size;
+    uint64_t contentHash;
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t compression;
+    uint32_t reserved;
+};
+
+// Independent of the platform word size, unlike computeHash
+static uint64_t pathHash(const std::string &path) {
+    return XXH64(path.data(), path.size(), 0);
+}
+
+// LooseFolder
+
+LooseFolder::LooseFolder(const std::string &root) : root(root) {
+    if (!this->root.empty() && this->root.back() != '/')
+        this->root += "/";
+}
+
+std::string LooseFolder::fullPath(const std::string &path) const {
+    return root + path;
+}
+
+// Only stats the file, nothing is opened
+bool LooseFolder::exists(const std::string &path) const {
+    struct stat info;
+    return stat(fullPath(path).c_str(), &info) == 0 && (info.st_mode & S_IFDIR) == 0;
+}
+
+bool LooseFolder::read(const std::string &path, FileBuffer &out) const {
+    if (!exists(path))
+        return false;
+
+    std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(fullPath(path));
+    out.data = file->data();
+    out.size = file->size();
+    out.owner = file;
+    return true;
+}
+
+bool LooseFolder::fileTime(const std::string &path, long long &mtime, long long &size) const {
+    struct stat info;
+    if (stat(fullPath(path).c_str(), &info) != 0 || (info.st_mode & S_IFDIR) != 0)
+        return false;
+
+    mtime = (long long)info.st_mtime;
+    size = (long long)info.st_size;
+    return true;
+}
+
+#ifdef _WIN32
+
+std::vector<std::string> LooseFolder::listFiles(const std::string &dir) {
+    std::vector<std::string> files;
+    WIN32_FIND_DATAA data;
+    HANDLE h = FindFirstFileA((dir + "/*").c_str(), &data);
+    if (h == INVALID_HANDLE_VALUE)
+        return files;
+
+    do {
+        std::string name = data.cFileName;
+        if (name == "." || name == "..")
+            continue;
+
+        std::string path = dir + "/" + name;
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            std::vector<std::string> sub = listFiles(path);
+            files.insert(files.end(), sub.begin(), sub.end());
+        }
+        else {
+            files.push_back(path);
+        }
+    } while (FindNextFileA(h, &data));
+
+    FindClose(h);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+#else
+
+std::vector<std::string> LooseFolder::listFiles(const std::string &dir) {
+    std::vector<std::string> files;
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return files;
+
+    while (struct dirent *e = readdir(d)) {
+        std::string name = e->d_name;
+        if (name == "." || name == "..")
+            continue;
+
+        std::string path = dir + "/" + name;
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0)
+            continue;
+
+        if (S_ISDIR(info.st_mode)) {
+            std::vector<std::string> sub = listFiles(path);
+            files.insert(files.end(), sub.begin(), sub.end());
+        }
+        else if (S_ISREG(info.st_mode)) {
+            files.push_back(path);
+        }
+    }
+
+    closedir(d);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+#endif
+
+// PackArchive
+
+PackArchive::PackArchive(const std::string &path) : archivePath(path) {
+    file = std::make_shared<MappedFile>(path);
+    const unsigned char *base = file->data();
+    const size_t size = file->size();
+
+    PackHeader header;
+    if (size < sizeof(header))
+        throw std::runtime_error("Truncated archive " + path);
+
+    std::memcpy(&header, base, sizeof(header));
+    if (std::memcmp(header.magic, PACK_MAGIC, 4) || header.version != PACK_VERSION)
+        throw std::runtime_error("Unsupported archive " + path);
+
+    auto inBounds = [size](uint64_t offset, uint64_t bytes) {
+        return offset <= size && bytes <= size - offset;
+    };
+
+    // Everything is validated once here, lookups trust the table
+    const uint64_t tocBytes = (uint64_t)header.numEntries * sizeof(Entry);
+    if (!inBounds(header.tocOffset, tocBytes) || header.tocOffset % 8 != 0 || !inBounds(header.namesOffset, 0))
+        throw std::runtime_error("Corrupt archive " + path);
+
+    toc = base + header.tocOffset;
+    names = (const char*)(base + header.namesOffset);
+    numFiles = header.numEntries;
+
+    for (size_t i = 0; i < numFiles; i++) {
+        const Entry &e = reinterpret_cast<const Entry*>(toc)[i];
+        if (!inBounds(e.offset, e.storedSize) || !inBounds(header.namesOffset + e.nameOffset, e.nameLength) ||
+            (e.compression != PACK_STORED && e.compression != PACK_LZ4) ||
+            (e.compression == PACK_STORED && e.storedSize != e.size))
+            throw std::runtime_error("Corrupt archive " + path);
+    }
+}
+
+// Table is sorted by path hash, collisions are told apart by name
+const PackArchive::Entry* PackArchive::find(const std::string &path) const {
+    const Entry *begin = reinterpret_cast<const Entry*>(toc);
+    const Entry *end = begin + numFiles;
+    const uint64_t h = pathHash(path);
+
+    const Entry *e = std::lower_bound(begin, end, h, [](const Entry &a, uint64_t b) { return a.pathHash < b; });
+    for (; e != end && e->pathHash == h; ++e) {
+        if (e->nameLength == path.size() && std::memcmp(names + e->nameOffset, path.data(), path.size()) == 0)
+            return e;
+    }
+
+    return nullptr;
+}
+
+bool PackArchive::exists(const std::string &path) const {
+    return find(path) != nullptr;
+}
+
+bool PackArchive::read(const std::string &path, FileBuffer &out) const {
+    const Entry *e = find(path);
+    if (!e)
+        return false;
+
+    const unsigned char *stored = file->data() + e->offset;
+    if (e->compression == PACK_STORED) {
+        out.data = stored;
+        out.size = (size_t)e->size;
+        out.owner = file;
+        return true;
+    }
+
+    std::shared_ptr<std::vector<unsigned char>> data = std::make_shared<std::vector<unsigned char>>((size_t)e->size);
+    if (!lz4::decompress(stored, (size_t)e->storedSize, data->data(), data->size())) {
+        std::cout << "Corrupt entry " << path << " in " << archivePath << std::endl;
+        throw std::runtime_error("Corrupt archive entry " + path);
+    }
+
+    out.data = data->data();
+    out.size = data->size();
+    out.owner = data;
+    return true;
+}
+
+bool PackArchive::storedHash(const std::string &path, size_t &hash) const {
+    const Entry *e = find(path);
+    if (!e)
+        return false;
+
+    hash = (size_t)e->contentHash;
+    return true;
+}
+
+// Layout: header, aligned entry data, table of contents, names
+bool PackArchive::write(const std::string &path, const std::vector<std::string> &files, bool compress) {
+    size_t numEntries = 0;
+    bool ok = writeFileAtomically(path, "archive", [&](std::ofstream &out) {
+        PackHeader header;
+        std::memset(&header, 0, sizeof(header));
+        out.write((const char*)&header, sizeof(header)); // filled in at the end
+
+        // Always read from the disk, never from an archive that is already mounted
+        LooseFolder disk;
+        std::vector<Entry> entries;
+        std::string nameBlock;
+        uint64_t offset = sizeof(header);
+
+        for (const std::string &f : files) {
+            const std::string name = VFS::normalize(f);
+            FileBuffer buf;
+            try {
+                if (!disk.read(name, buf))
+                    throw std::runtime_error("missing");
+            }
+            catch (std::runtime_error&) {
+                std::cout << "Skipping unreadable file " << name << std::endl;
+                continue;
+            }
+
+            Entry e;
+            std::memset(&e, 0, sizeof(e));
+            e.pathHash = pathHash(name);
+            e.size = buf.size;
+            e.contentHash = computeHash(buf.data, buf.size);
+            e.nameOffset = (uint32_t)nameBlock.size();
+            e.nameLength = (uint32_t)name.size();
+            nameBlock += name;
+
+            // Keep the compressed form only if it saves at least an eighth
+            std::vector<unsigned char> packed;
+            if (compress && buf.size > 0) {
+                packed = lz4::compress(buf.data, buf.size);
+                if (packed.size() > buf.size - buf.size / 8)
+                    packed.clear();
+            }
+
+            const uint64_t aligned = (offset + ENTRY_ALIGNMENT - 1) & ~(ENTRY_ALIGNMENT - 1);
+            const std::vector<char> padding((size_t)(aligned - offset), 0);
+            out.write(padding.data(), padding.size());
+
+            e.offset = aligned;
+            e.compression = packed.empty() ? PACK_STORED : PACK_LZ4;
+            e.storedSize = packed.empty() ? buf.size : packed.size();
+            out.write(packed.empty() ? (const char*)buf.data : (const char*)packed.data(), (std::streamsize)e.storedSize);
+
+            offset = aligned + e.storedSize;
+            entries.push_back(e);
+        }
+
+        std::sort(entries.begin(), entries.end(), [&nameBlock](const Entry &a, const Entry &b) {
+            if (a.pathHash != b.pathHash)
+                return a.pathHash < b.pathHash;
+            return nameBlock.compare(a.nameOffset, a.nameLength, nameBlock, b.nameOffset, b.nameLength) < 0;
+        });
+
+        const uint64_t tocOffset = (offset + 7) & ~(uint64_t)7;
+        const std::vector<char> padding((size_t)(tocOffset - offset), 0);
+        out.write(padding.data(), padding.size());
+        out.write((const char*)entries.data(), entries.size() * sizeof(Entry));
+        out.write(nameBlock.data(), nameBlock.size());
+
+        std::memcpy(header.magic, PACK_MAGIC, 4);
+        header.version = PACK_VERSION;
+        header.numEntries = (uint32_t)entries.size();
+        header.tocOffset = tocOffset;
+        header.namesOffset = tocOffset + entries.size() * sizeof(Entry);
+        out.seekp(0);
+        out.write((const char*)&header, sizeof(header));
+
+        numEntries = entries.size();
+        return true;
+    });
+
+    if (ok)
+        std::cout << "Packed " << numEntries << " files into " << path << std::endl;
+    return ok;
+}
+
+bool PackArchive::packAssets() {
+    std::vector<std::string> files = LooseFolder::listFiles("Gamma/Shaders");
+    std::vector<std::string> assets = LooseFolder::listFiles("Gamma/Assets");
+    files.insert(files.end(), assets.begin(), assets.end());
+
+    // Leftovers of interrupted cache writes, and program binaries that only work on this driver
+    files.erase(std::remove_if(files.begin(), files.end(), [](const std::string &f) {
+        return endsWith(f, ".tmp") || endsWith(f, ".glbin");
+    }), files.end());
+    return write(DEFAULT_ARCHIVE, files);
+}
+
+// VFS
+
+VFS& VFS::instance() {
+    static VFS *vfs = []() {
+        VFS *v = new VFS();
+        if (std::ifstream(DEFAULT_ARCHIVE).good()) {
+            try {
+                v->mount(std::make_shared<PackArchive>(DEFAULT_ARCHIVE));
+            }
+            catch (std::runtime_error &e) {
+                std::cout << "Ignoring archive: " << e.what() << std::endl;
+            }
+        }
+        v->mount(std::make_shared<LooseFolder>());
+        return v;
+    }();
+    return *vfs;
+}
+
+void VFS::mount(std::shared_ptr<FileSource> source) {
+    sources.push_back(source);
+}
+
+void VFS::unmountAll() {
+    sources.clear();
+}
+
+bool VFS::exists(const std::string &path) const {
+    const std::string p = normalize(path);
+    for (const std::shared_ptr<FileSource> &s : sources) {
+        if (s->exists(p))
+            return true;
+    }
+    return false;
+}
+
+bool VFS::storedHash(const std::string &path, size_t &hash) const {
+    const std::string p = normalize(path);
+    for (const std::shared_ptr<FileSource> &s : sources) {
+        if (s->exists(p))
+            return s->storedHash(p, hash);
+    }
+    return false;
+}
+
+bool VFS::fileTime(const std::string &path, long long &mtime, long long &size) const {
+    const std::string p = normalize(path);
+    for (const std::shared_ptr<FileSource> &s : sources) {
+        if (s->exists(p))
+            return s->fileTime(p, mtime, size);
+    }
+    return false;
+}
+
+FileBuffer VFS::read(const std::string &path) const {
+    const std::string p = normalize(path);
+    FileBuffer buf;
+    for (const std::shared_ptr<FileSource> &s : sources) {
+        if (s->read(p, buf))
+            return buf;
+    }
+
+    throw std::runtime_error("Cannot open file " + path);
+}
+
+std::string VFS::readText(const std::string &path) const {
+    FileBuffer buf = read(path);
+    return std::string((const char*)buf.data, buf.size);
+}
+
+std::string VFS::normalize(const std::string &path) {
+    std::vector<std::string> parts;
+    std::string part;
+    const std::string unixPath = unixifyPath(path);
+    const bool absolute = !unixPath.empty() && unixPath[0] == '/';
+
+    std::istringstream stream(unixPath);
+    while (std::getline(stream, part, '/')) {
+        if (part.empty() || part == ".")
+            continue;
+        if (part == ".." && !parts.empty() && parts.back() != "..")
+            parts.pop_back();
+        else
+            parts.push_back(part);
+    }
+
+    std::string result = absolute ? "/" : "";
+    for (size_t i = 0; i < parts.size(); i++) {
+        result += (i > 0 ? "/" : "") + parts[i];
+    }
+    return result;
+}
+
+// BufferStream
+
+BufferStream::Buf::Buf(const FileBuffer &buffer) {
+    char *begin = (char*)buffer.data;
+    setg(begin, begin, begin + buffer.size);
+}
+
+BufferStream::Buf::pos_type BufferStream::Buf::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) {
+    off_type base = (dir == std::ios_base::beg) ? 0 : (dir == std::ios_base::cur) ? gptr() - eback() : egptr() - eback();
+    return seekpos(pos_type(base + off), which);
+}
+
+BufferStream::Buf::pos_type BufferStream::Buf::seekpos(pos_type pos, std::ios_base::openmode which) {
+    const off_type p = (off_type)pos;
+    if (!(which & std::ios_base::in) || p < 0 || p > egptr() - eback())
+        return pos_type(off_type(-1));
+
+    setg(eback(), eback() + p, egptr());
+    return pos;
+}
+
+BufferStream::BufferStream(const FileBuffer &buffer) : std::istream(nullptr), buffer(buffer), buf(this->buffer) {
+    rdbuf(&buf);
+}
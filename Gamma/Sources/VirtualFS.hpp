@@ -0,0 +1,137 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <istream>
+#include <streambuf>
+#include <cstdint>
+
+class MappedFile;
+
+/*
+    Read-only virtual file system for assets.
+
+    Paths are the same relative paths used everywhere else (Gamma/Assets/...,
+    Gamma/Shaders/...). Sources are searched in mount order: by default a
+    packed archive (Gamma/Assets.pak) if one exists, then the working
+    directory. The archive is a single memory mapped file with a sorted table
+    of contents, so a cold start opens one file instead of hundreds.
+
+    Archive entries are stored at 64-byte aligned offsets, either as-is
+    (returned as views into the mapping) or LZ4 compressed (decompressed into
+    an owned buffer). Each entry records the hash of its contents, which is
+    used in place of hashing the file for cache keys.
+*/
+
+// Contents of a file, either a view into mapped memory or an owned buffer
+struct FileBuffer {
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+    std::shared_ptr<const void> owner; // keeps data alive
+};
+
+// One mounted location
+class FileSource {
+public:
+    virtual ~FileSource() {}
+    virtual bool exists(const std::string &path) const = 0;
+
+    // False if the file is not in this source, throws if it is present but unreadable
+    virtual bool read(const std::string &path, FileBuffer &out) const = 0;
+
+    // Content hash known without reading the file
+    virtual bool storedHash(const std::string&, size_t&) const { return false; }
+
+    // Modification time and size of a file that can change on disk, false for archived entries
+    virtual bool fileTime(const std::string&, long long&, long long&) const { return false; }
+};
+
+// Files on the disk, relative to a root folder
+class LooseFolder : public FileSource {
+public:
+    LooseFolder(const std::string &root = "");
+    bool exists(const std::string &path) const override;
+    bool read(const std::string &path, FileBuffer &out) const override;
+    bool fileTime(const std::string &path, long long &mtime, long long &size) const override;
+
+    // Every regular file below dir, recursively
+    static std::vector<std::string> listFiles(const std::string &dir);
+
+private:
+    std::string fullPath(const std::string &path) const;
+    std::string root;
+};
+
+class PackArchive : public FileSource {
+public:
+    // Map and validate an archive, throws on failure
+    PackArchive(const std::string &path);
+
+    bool exists(const std::string &path) const override;
+    bool read(const std::string &path, FileBuffer &out) const override;
+    bool storedHash(const std::string &path, size_t &hash) const override;
+
+    size_t numEntries() const { return numFiles; }
+
+    // Pack files (VFS paths) into a new archive, entries are LZ4 compressed where it pays off
+    static bool write(const std::string &path, const std::vector<std::string> &files, bool compress = true);
+
+    // Pack Gamma/Shaders and Gamma/Assets (including caches) into the archive mounted at startup
+    static bool packAssets();
+
+private:
+    struct Entry;
+    const Entry* find(const std::string &path) const;
+
+    std::shared_ptr<MappedFile> file;
+    const unsigned char *toc = nullptr;
+    const char *names = nullptr;
+    size_t numFiles = 0;
+    std::string archivePath;
+};
+
+class VFS {
+public:
+    // Mounts Gamma/Assets.pak (if present) and the working directory on first use
+    static VFS& instance();
+
+    // Searched after the sources mounted before it
+    void mount(std::shared_ptr<FileSource> source);
+    void unmountAll();
+
+    bool exists(const std::string &path) const;
+    bool storedHash(const std::string &path, size_t &hash) const;
+
+    // Of the source the path resolves to, so files shadowed by the archive report false
+    bool fileTime(const std::string &path, long long &mtime, long long &size) const;
+
+    // Throws if no source has the file
+    FileBuffer read(const std::string &path) const;
+    std::string readText(const std::string &path) const;
+
+    // Forward slashes, no '.' or '..' components
+    static std::string normalize(const std::string &path);
+
+    VFS(const VFS&) = delete;
+    VFS& operator=(const VFS&) = delete;
+
+private:
+    VFS(void) = default;
+    std::vector<std::shared_ptr<FileSource>> sources;
+};
+
+// std::istream over a file buffer, for readers written against streams
+class BufferStream : public std::istream {
+public:
+    BufferStream(const FileBuffer &buffer);
+
+private:
+    struct Buf : public std::streambuf {
+        Buf(const FileBuffer &buffer);
+        pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+        pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+    };
+
+    FileBuffer buffer;
+    Buf buf;
+};
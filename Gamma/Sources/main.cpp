@@ -1,5 +1,7 @@
 #include "GammaCore.hpp"
+#include "VirtualFS.hpp"
 #include <cstdlib>
+#include <cstring>
 
 #ifdef _MSC_VER 
 extern "C" {
@@ -9,6 +11,9 @@ extern "C" {
 #endif
 
 int main(int argc, char * argv[]) {
+    if (argc > 1 && std::strcmp(argv[1], "--pack") == 0)
+        return PackArchive::packAssets() ? EXIT_SUCCESS : EXIT_FAILURE;
+
     GammaCore core;
     core.mainLoop();
 
@@ -2,44 +2,56 @@
 #include "utils.hpp"
 #include "GLProgram.hpp"
 #include "GLWrappers.hpp"
+#include "GLState.hpp"
+#include "ImageLoader.hpp"
+#include "MappedFile.hpp"
 #include "xxhash.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <mutex>
+#include <vector>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
-unsigned int textureFromFile(std::string path) {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+unsigned int textureFromFile(std::string path, MipMode mode) {
+    return uploadTexture(loadMipmapped(path, mode));
+}
 
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(path.c_str(), &width, &height, &nrComponents, 0);
-    if (!data) {
-        std::cout << "Image loading failed for: " << path << std::endl;
-        throw std::runtime_error("Failed to load image " + std::string(path));
-    }
-    else {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-        else
-            throw std::runtime_error("Unknown image format");
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+// Version and extension list are queried once
+static GLint ctxMajor = -1, ctxMinor = -1;
+static std::vector<std::string> extensions;
+
+static const UniformID U_FBO_ATTACHMENT("fboAttachment");
+static const UniformID U_DEPTH_MAP("depthMap");
+static const UniformID U_SOURCE_TEXTURE("sourceTexture");
+
+static void queryContext() {
+    if (ctxMajor >= 0)
+        return;
+
+    GLint numExtensions = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &ctxMajor);
+    glGetIntegerv(GL_MINOR_VERSION, &ctxMinor);
+    glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+    for (GLint i = 0; i < numExtensions; i++) {
+        const char *ext = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        if (ext) extensions.push_back(ext);
     }
+}
+
+bool glSupports(int major, int minor, const std::string &extension) {
+    queryContext();
+    if (ctxMajor > major || (ctxMajor == major && ctxMinor >= minor))
+        return true;
+
+    return glHasExtension(extension);
+}
 
-    stbi_image_free(data);
-    return textureID;
+bool glHasExtension(const std::string &extension) {
+    queryContext();
+    return std::find(extensions.begin(), extensions.end(), extension) != extensions.end();
 }
 
 
@@ -47,9 +59,8 @@ unsigned int textureFromFile(std::string path) {
 void showFBTex(GLuint texID, int rows, int cols, int idx) {
     GLProgram* prog = getProgram("Render::FB_TEX", "draw_tex_2d.vert", "draw_tex_2d.frag");
     prog->use();
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texID);
-    prog->setUniform("fboAttachment", 0);
+    GLState::instance().bindTexture(0, GL_TEXTURE_2D, texID);
+    prog->setUniform(U_FBO_ATTACHMENT, 0);
     drawTexOverlay(rows, cols, idx);
 }
 
@@ -57,9 +68,8 @@ void showFBTex(GLuint texID, int rows, int cols, int idx) {
 void showDepthTex(GLuint texID, int rows, int cols, int idx) {
     GLProgram* prog = getProgram("Render::FB_DEPTH", "draw_tex_2d.vert", "draw_depth_2d.frag");
     prog->use();
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texID);
-    prog->setUniform("depthMap", 0);
+    GLState::instance().bindTexture(0, GL_TEXTURE_2D, texID);
+    prog->setUniform(U_DEPTH_MAP, 0);
     drawTexOverlay(rows, cols, idx);
 }
 
@@ -123,11 +133,11 @@ void drawTexOverlay(int rows, int cols, int idx) {
         iter = storage.find(key);
     }
 
-    glDisable(GL_DEPTH_TEST);
+    GLState &gl = GLState::instance();
+    gl.setEnabled(GL_DEPTH_TEST, false);
     iter->second.vao->bind();
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-    iter->second.vao->unbind();
-    glEnable(GL_DEPTH_TEST);
+    gl.setEnabled(GL_DEPTH_TEST, true);
 }
 
 void applyFilter(GLProgram * prog, GLuint srcTex, GLuint dstTex, GLuint dstFBO) {
@@ -136,13 +146,14 @@ void applyFilter(GLProgram * prog, GLuint srcTex, GLuint dstTex, GLuint dstFBO)
         return;
     }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, dstFBO);
+    // Only reattached when the target differs from the last pass into dstFBO
+    GLState &gl = GLState::instance();
+    gl.bindFramebuffer(dstFBO);
     if (dstFBO > 0)
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, dstTex, 0);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, srcTex);
+        gl.framebufferTexture(dstTex);
+    gl.bindTexture(0, GL_TEXTURE_2D, srcTex);
     prog->use();
-    prog->setUniform("sourceTexture", 0);
+    prog->setUniform(U_SOURCE_TEXTURE, 0);
 
     // Draw fullscreen quad using filter
     drawFullscreenQuad();
@@ -155,16 +166,27 @@ GLProgram * getProgram(std::string tag, std::string vs, std::string fs, map<stri
 GLProgram * getProgram(std::string tag, std::string vs, std::string gs, std::string fs, map<string, string> repl) {
     GLProgram* prog = GLProgram::get(tag);
     if (!prog) {
-        std::string strVs = (vs != "") ? readShader("Gamma/Shaders/" + vs, repl) : "";
-        std::string strGs = (gs != "") ? readShader("Gamma/Shaders/" + gs, repl) : "";
-        std::string strFs = (fs != "") ? readShader("Gamma/Shaders/" + fs, repl) : "";
-        prog = new GLProgram(strVs, strGs, strFs);
+        prog = GLProgram::fromFiles(vs, gs, fs, repl);
         GLProgram::set(tag, prog);
     }
 
     return prog;
 }
 
+GLProgram * getProgramAsync(std::string tag, std::string vs, std::string fs, map<string, string> repl, GLProgram *fallback) {
+    GLProgram* prog = GLProgram::get(tag);
+    if (!prog && !GLProgram::isBuilding(tag)) {
+        ShaderFiles files;
+        files.stages[0] = vs;
+        files.stages[2] = fs;
+        files.replacements = repl;
+        GLProgram::buildAsync(tag, files);
+        prog = GLProgram::get(tag); // done already if it was compiled in place or cached
+    }
+
+    return prog ? prog : fallback;
+}
+
 size_t computeHash(const void* buffer, size_t length) {
     size_t seed = 0;
 #ifdef ENVIRONMENT64
@@ -176,22 +198,147 @@ size_t computeHash(const void* buffer, size_t length) {
 }
 
 
-// Load file as binary, compute hash
+// Chunked so that only a window of the mapping is paged in at a time
+static size_t hashMappedFile(const MappedFile &file) {
+    const size_t CHUNK_SIZE = 4 << 20;
+    const unsigned char *data = file.data();
+    const size_t size = file.size();
+
+#ifdef ENVIRONMENT64
+    XXH64_state_t *state = XXH64_createState();
+    XXH64_reset(state, 0);
+    for (size_t offset = 0; offset < size; offset += CHUNK_SIZE) {
+        XXH64_update(state, data + offset, std::min(CHUNK_SIZE, size - offset));
+    }
+    size_t const hash = XXH64_digest(state);
+    XXH64_freeState(state);
+#else
+    XXH32_state_t *state = XXH32_createState();
+    XXH32_reset(state, 0);
+    for (size_t offset = 0; offset < size; offset += CHUNK_SIZE) {
+        XXH32_update(state, data + offset, std::min(CHUNK_SIZE, size - offset));
+    }
+    size_t const hash = XXH32_digest(state);
+    XXH32_freeState(state);
+#endif
+    return hash;
+}
+
+// Persistent (path, size, mtime) => hash table, appended to as new hashes are computed.
+// Times are in nanoseconds where the platform has them, an edit within the same second
+// that keeps the size would otherwise be missed.
+static const char *HASH_MEMO_PATH = "Gamma/Assets/cached/file_hashes.txt";
+
+struct HashMemoEntry {
+    unsigned long long size;
+    long long mtime;
+    size_t hash;
+};
+
+static std::map<std::string, HashMemoEntry> hashMemo;
+static std::mutex hashMemoMutex;
+static bool hashMemoLoaded = false;
+
+static long long modificationTime(const struct stat &info) {
+#if defined(__APPLE__)
+    return (long long)info.st_mtimespec.tv_sec * 1000000000LL + info.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+    return (long long)info.st_mtime * 1000000000LL;
+#else
+    return (long long)info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+#endif
+}
+
+// Line format: size mtime hash path (later lines override earlier ones).
+// Rewritten without the overridden lines once they make up half of the file.
+static void loadHashMemo() {
+    std::ifstream in(HASH_MEMO_PATH);
+    HashMemoEntry e;
+    std::string path;
+    size_t lines = 0;
+    while (in >> e.size >> e.mtime >> e.hash && std::getline(in, path)) {
+        lines++;
+        if (path.size() > 1)
+            hashMemo[path.substr(1)] = e;
+    }
+    in.close();
+
+    if (lines > 2 * hashMemo.size()) {
+        writeFileAtomically(HASH_MEMO_PATH, "file hashes", [](std::ofstream &out) {
+            for (auto &m : hashMemo) {
+                out << m.second.size << " " << m.second.mtime << " " << m.second.hash << " " << m.first << "\n";
+            }
+            return true;
+        });
+    }
+}
+
+// Contents are only read if the file changed since it was last hashed.
+// Files in a packed archive use the hash stored with the entry.
 size_t fileHash(const std::string filename) {
-    std::ifstream f(filename, std::ios::binary | std::ios::ate);
+    size_t stored;
+    if (VFS::instance().storedHash(filename, stored))
+        return stored;
+
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0) {
+        std::cout << "Could not open file " << filename << " for hashing" << std::endl;
+        throw std::runtime_error("Failed to open file " + filename);
+    }
+
+    HashMemoEntry e;
+    e.size = (unsigned long long)info.st_size;
+    e.mtime = modificationTime(info);
+
+    {
+        std::unique_lock<std::mutex> lock(hashMemoMutex);
+        if (!hashMemoLoaded) {
+            loadHashMemo();
+            hashMemoLoaded = true;
+        }
+
+        auto match = hashMemo.find(filename);
+        if (match != hashMemo.end() && match->second.size == e.size && match->second.mtime == e.mtime)
+            return match->second.hash;
+    }
 
-    if (!f) {
+    try {
+        MappedFile file(filename);
+        e.hash = hashMappedFile(file);
+    }
+    catch (std::runtime_error&) {
         std::cout << "Could not open file " << filename << " for hashing" << std::endl;
         throw std::runtime_error("Failed to open file " + filename);
     }
 
-    std::ifstream::pos_type pos = f.tellg();
-    std::vector<char> data(pos);
-    f.seekg(0, std::ios::beg);
-    f.read(&data[0], pos);
-    f.close();
+    std::unique_lock<std::mutex> lock(hashMemoMutex);
+    hashMemo[filename] = e;
+    std::ofstream out(HASH_MEMO_PATH, std::ios::app);
+    out << e.size << " " << e.mtime << " " << e.hash << " " << filename << "\n";
+
+    return e.hash;
+}
 
-    return computeHash((const void*)data.data(), (size_t)pos);
+// Written to a temporary file first so that an interrupted write never leaves a valid-looking file
+bool writeFileAtomically(const std::string &path, const std::string &what, const std::function<bool(std::ofstream&)> &writer) {
+    const std::string tmpPath = path + ".tmp";
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    bool ok = out.good() && writer(out) && out.good();
+    out.close();
+    ok = ok && !out.fail();
+
+    // The existing file stays untouched unless the new one is complete
+#ifdef _WIN32
+    // rename does not replace existing files here
+    if (ok)
+        std::remove(path.c_str());
+#endif
+    if (!ok || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        std::cout << "Could not write " << what << " " << path << std::endl;
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
 }
 
 void drawFullscreenQuad() {
@@ -253,7 +400,7 @@ void drawUnitCube() {
         glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
         glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
-        glBindVertexArray(cubeVAO);
+        GLState::instance().bindVertexArray(cubeVAO);
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
         glEnableVertexAttribArray(1);
@@ -261,13 +408,11 @@ void drawUnitCube() {
         glEnableVertexAttribArray(2);
         glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
         glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindVertexArray(0);
     }
     
     // render
-    glBindVertexArray(cubeVAO);
+    GLState::instance().bindVertexArray(cubeVAO);
     glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
     glCheckError();
 }
 
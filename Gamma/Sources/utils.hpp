@@ -5,7 +5,11 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <functional>
 #include <assimp/material.h>
+#include "MipGenerator.hpp"
+#include "VirtualFS.hpp"
+#include "ShaderSource.hpp"
 
 using std::map;
 using std::string;
@@ -82,46 +86,18 @@ inline void replaceAll(string &str, const string& from, const string& to) {
     }
 }
 
-// Read shader file, handle includes by recursion
+// Read shader file with includes resolved, see ShaderSource
 inline std::string readShader(string path, map<string, string> repl = map<string, string>()) {
-    path = unixifyPath(path);
-    std::ifstream file(path);
-    if (!file) {
-        std::cout << "Cannot open file " << path << std::endl;
-        throw std::runtime_error("Cannot open file " + path);
-    }
-
-    size_t idx = path.find_last_of('/');
-    std::string dir = path.substr(0, idx);
-
-    std::string output;
-    std::string line;
-
-    while (file.good()) {
-        getline(file, line);
-
-        if (line.find("#include") == std::string::npos) {
-            output.append(line + "\n");
-        }
-        else {
-            std::string includeFileName = line.substr(10, line.length() - 11);
-            std::string toAppend = readShader(dir + "/" + includeFileName);
-            output.append(toAppend + "\n");
-        }
-    }
-
-    // Perform string replacements
-    for (std::pair<string, string> p : repl) {
-        string key = p.first;
-        string value = p.second;
-        replaceAll(output, key, value);
-    }
-
-    return output;
+    return ShaderSource::read(unixifyPath(path), repl);
 }
 
-// Create GL texture from file
-unsigned int textureFromFile(std::string path);
+// Create GL texture from file, mip levels are filtered on the CPU
+unsigned int textureFromFile(std::string path, MipMode mode = MipMode::LINEAR);
+
+// Context is at least the given version or exposes the extension.
+// Must be called on the context thread.
+bool glSupports(int major, int minor, const std::string &extension);
+bool glHasExtension(const std::string &extension);
 
 // Draw framebuffer texture as overlay for debugging
 void showFBTex(GLuint texID, int rows = 3, int cols = 3, int idx = 2);
@@ -141,10 +117,18 @@ void applyFilter(GLProgram *prog, GLuint srcTex, GLuint dstTex, GLuint dstFBO =
 GLProgram* getProgram(std::string tag, std::string vs, std::string fs, map<string, string> repl = map<string, string>());
 GLProgram* getProgram(std::string tag, std::string vs, std::string gs, std::string fs, map<string, string> repl = map<string, string>());
 
+// Like getProgram, but the program is compiled in the background where the
+// driver allows it. Returns fallback until it is ready, or if it fails to build.
+GLProgram* getProgramAsync(std::string tag, std::string vs, std::string fs, map<string, string> repl, GLProgram *fallback);
+
 // Hashing w/ xxHash
 size_t computeHash(const void* buffer, size_t length);
 size_t fileHash(const std::string filename);
 
+// Write path through writer, which returns false on failure. Prints an error naming what and returns false
+// if the file could not be written, in which case an existing file at path is gone.
+bool writeFileAtomically(const std::string &path, const std::string &what, const std::function<bool(std::ofstream&)> &writer);
+
 // Rendering utilities
 void drawFullscreenQuad();
 void drawUnitCube();
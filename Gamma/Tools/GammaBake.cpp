@@ -0,0 +1,178 @@
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include "utils.hpp"
+#include "VirtualFS.hpp"
+#include "ThreadPool.hpp"
+#include "ImageLoader.hpp"
+#include "TextureCompression.hpp"
+#include "ResourceRegistry.hpp"
+#include "Scene.hpp"
+#include "Model.hpp"
+#include "IBLMaps.hpp"
+#include "BrdfLUT.hpp"
+#include <set>
+#include <cstdlib>
+#include <cstring>
+
+/*
+    gamma-bake: precompute every cache the runtime reads, without a UI.
+
+    Usage: gamma-bake [--pack] [--context native|egl|osmesa] <folder or .gscn>...
+
+    Folders are searched recursively for scenes, models and environments.
+    Mesh imports and texture compression run on all cores, IBL maps and the
+    BRDF LUT are rendered on a hidden GL context in the meantime. With
+    --pack the results are packed into Gamma/Assets.pak afterwards.
+    Run from the repository root, like Gamma itself.
+*/
+
+// Same file types the interactive loader accepts
+static const char *MODEL_TYPES[] = { ".fbx", ".dae", ".obj", ".3ds", ".ply" };
+
+struct BakeList {
+    std::set<std::string> models;
+    std::set<std::pair<std::string, TextureMask>> textures;
+    std::set<std::string> environments;
+};
+
+static void addFile(const std::string &path, BakeList &list) {
+    if (endsWith(path, ".gscn")) {
+        SceneAssets assets;
+        if (!Scene::listAssets(path.c_str(), assets))
+            return;
+        list.models.insert(assets.models.begin(), assets.models.end());
+        list.textures.insert(assets.textures.begin(), assets.textures.end());
+        list.environments.insert(assets.environments.begin(), assets.environments.end());
+    }
+    else if (endsWith(path, ".hdr")) {
+        list.environments.insert(path);
+    }
+    else {
+        for (const char *ext : MODEL_TYPES) {
+            if (endsWith(path, ext))
+                list.models.insert(path);
+        }
+    }
+}
+
+// Hidden window, or an offscreen context where GLFW was built with EGL/OSMesa support
+static GLFWwindow* createContext(const std::string &api) {
+    if (!glfwInit())
+        return nullptr;
+
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    if (api == "egl")
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+    else if (api == "osmesa")
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+
+    GLFWwindow *window = glfwCreateWindow(64, 64, "gamma-bake", nullptr, nullptr);
+    if (!window)
+        return nullptr;
+
+    glfwMakeContextCurrent(window);
+    gladLoadGL();
+    fprintf(stdout, "OpenGL %s\n", glGetString(GL_VERSION));
+    return window;
+}
+
+int main(int argc, char * argv[]) {
+    bool pack = false;
+    std::string api = "native";
+    BakeList list;
+
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--pack") == 0) {
+            pack = true;
+        }
+        else if (std::strcmp(argv[i], "--context") == 0 && i + 1 < argc) {
+            api = argv[++i];
+        }
+        else {
+            std::vector<std::string> files = LooseFolder::listFiles(unixifyPath(argv[i]));
+            if (files.empty())
+                files.push_back(unixifyPath(argv[i])); // not a folder
+            for (const std::string &f : files) {
+                addFile(f, list);
+            }
+        }
+    }
+
+    if (list.models.empty() && list.textures.empty() && list.environments.empty()) {
+        std::cout << "Usage: gamma-bake [--pack] [--context native|egl|osmesa] <folder or .gscn>..." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    GLFWwindow *window = createContext(api);
+    if (!window) {
+        std::cout << "Failed to create OpenGL context" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Imports first: their materials add more textures
+    ThreadPool &pool = ThreadPool::shared();
+    std::vector<std::pair<std::string, std::future<shared_ptr<ModelSource>>>> imports;
+    for (const std::string &path : list.models) {
+        imports.push_back(std::make_pair(path, pool.enqueue([path]() { return Model::readSource(path); })));
+    }
+
+    int failures = 0;
+    for (auto &job : imports) {
+        try {
+            auto refs = Model::textureReferences(*job.second.get());
+            list.textures.insert(refs.begin(), refs.end());
+            std::cout << "Mesh cache: " << job.first << std::endl;
+        }
+        catch (std::runtime_error &e) {
+            std::cout << "Failed to import " << job.first << ": " << e.what() << std::endl;
+            failures++;
+        }
+    }
+
+    // Formats depend on driver support, so they are chosen here on the context thread
+    std::vector<std::pair<std::string, std::shared_future<ImageData>>> compressions;
+    for (auto &t : list.textures) {
+        const GLenum format = TextureCompression::formatFor(t.second);
+        if (format && VFS::instance().exists(t.first))
+            compressions.push_back(std::make_pair(t.first, loadCompressedAsync(t.first, format, ResourceRegistry::mipMode(t.second))));
+    }
+
+    // GL work overlaps with the compression jobs
+    BrdfLUT::get();
+    for (const std::string &env : list.environments) {
+        try {
+            IBLMaps maps(env);
+            std::cout << "IBL maps: " << env << std::endl;
+        }
+        catch (std::runtime_error &e) {
+            std::cout << "Failed to bake " << env << ": " << e.what() << std::endl;
+            failures++;
+        }
+    }
+
+    for (auto &job : compressions) {
+        try {
+            job.second.get();
+            std::cout << "Compressed texture: " << job.first << std::endl;
+        }
+        catch (std::runtime_error &e) {
+            std::cout << "Failed to compress " << job.first << ": " << e.what() << std::endl;
+            failures++;
+        }
+    }
+
+    BrdfLUT::release();
+    glfwDestroyWindow(window);
+    glfwTerminate();
+
+    if (pack && !PackArchive::packAssets())
+        failures++;
+
+    std::cout << "Baked " << list.models.size() << " models, " << compressions.size() << " textures, "
+              << list.environments.size() << " environments, " << failures << " failures" << std::endl;
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}